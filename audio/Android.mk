@@ -1,13 +1,22 @@
 # Copyright 2011 The Android Open Source Project
 
 #AUDIO_POLICY_TEST := true
+#AUDIO_POLICY_BENCH := true
+#AUDIO_HAL_BENCH := true
+#AUDIO_POLICY_RECORD := true
 #ENABLE_AUDIO_DUMP := true
+#AUDIO_POLICY_PERSIST_CAPABILITIES := true
+#AUDIO_POLICY_PERSIST_STATE := true
 
 LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
+    AudioEffectChain.cpp \
     AudioHardwareInterface.cpp \
+    AudioRingBuffer.cpp \
+    AudioStreamConverter.cpp \
+    AudioStreamOutWriteBehind.cpp \
     audio_hw_hal.cpp
 
 LOCAL_MODULE := libaudiohw_legacy
@@ -20,6 +29,10 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     AudioPolicyManagerBase.cpp \
+    AudioPolicyStats.cpp \
+    AudioPolicyRoutingTrace.cpp \
+    AudioPolicyTransaction.cpp \
+    AudioPolicyWorker.cpp \
     AudioPolicyCompatClient.cpp \
     audio_policy_hal.cpp
 
@@ -27,6 +40,19 @@ ifeq ($(AUDIO_POLICY_TEST),true)
   LOCAL_CFLAGS += -DAUDIO_POLICY_TEST
 endif
 
+ifeq ($(AUDIO_POLICY_PERSIST_CAPABILITIES),true)
+  LOCAL_CFLAGS += -DAUDIO_POLICY_PERSIST_CAPABILITIES
+endif
+
+ifeq ($(AUDIO_POLICY_PERSIST_STATE),true)
+  LOCAL_CFLAGS += -DAUDIO_POLICY_PERSIST_STATE
+endif
+
+ifeq ($(AUDIO_POLICY_RECORD),true)
+  LOCAL_SRC_FILES += AudioPolicyTrace.cpp
+  LOCAL_CFLAGS += -DAUDIO_POLICY_RECORD
+endif
+
 LOCAL_STATIC_LIBRARIES := libmedia_helper
 LOCAL_MODULE := libaudiopolicy_legacy
 LOCAL_MODULE_TAGS := optional
@@ -56,6 +82,53 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+ifeq ($(AUDIO_POLICY_BENCH),true)
+# Host build of the legacy policy manager for the benchmarks in bench/.
+# The configuration file is read from the current directory so that each
+# run can select the platform it simulates.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    AudioPolicyManagerBase.cpp \
+    AudioPolicyStats.cpp \
+    AudioPolicyRoutingTrace.cpp \
+    AudioPolicyTransaction.cpp \
+    AudioPolicyWorker.cpp
+
+LOCAL_CFLAGS += \
+    -DAUDIO_POLICY_CONFIG_FILE=\"audio_policy.conf\" \
+    -DAUDIO_POLICY_VENDOR_CONFIG_FILE=\"audio_policy.conf\"
+
+LOCAL_MODULE := libaudiopolicy_legacy_host
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+endif
+
+ifeq ($(AUDIO_HAL_BENCH),true)
+# Host build of the legacy HAL shim over the stub hardware for the benchmarks
+# in bench/. The benchmark provides createAudioHardware().
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    AudioEffectChain.cpp \
+    AudioHardwareInterface.cpp \
+    AudioHardwareStub.cpp \
+    AudioRingBuffer.cpp \
+    AudioStreamConverter.cpp \
+    AudioStreamOutWriteBehind.cpp \
+    audio_hw_hal.cpp
+
+LOCAL_MODULE := libaudiohw_legacy_host
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+endif
+
+ifneq ($(filter true,$(AUDIO_POLICY_BENCH) $(AUDIO_HAL_BENCH)),)
+include $(LOCAL_PATH)/bench/Android.mk
+endif
+
 #ifeq ($(ENABLE_AUDIO_DUMP),true)
 #  LOCAL_SRC_FILES += AudioDumpInterface.cpp
 #  LOCAL_CFLAGS += -DENABLE_AUDIO_DUMP
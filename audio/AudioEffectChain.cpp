@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioEffectChain"
+//#define LOG_NDEBUG 0
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <media/AudioParameter.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "AudioEffectChain.h"
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+// corner frequency of the DC blocker
+#define DC_BLOCK_HZ 20
+// time for the limiter to recover from 20 dB of gain reduction
+#define LIMITER_RELEASE_MS 100
+
+static void pcm16ToFloat(const int16_t *in, float *out, size_t count)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(in + i);
+        vst1q_f32(out + i, vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))));
+        vst1q_f32(out + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        // sign extend by moving the samples to the high halves
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = in[i];
+    }
+}
+
+static void floatToPcm16(const float *in, int16_t *out, size_t count)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 8 <= count; i += 8) {
+        // the conversion to int32 saturates
+        int32x4_t lo = vcvtq_s32_f32(vld1q_f32(in + i));
+        int32x4_t hi = vcvtq_s32_f32(vld1q_f32(in + i + 4));
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+#elif defined(__SSE2__)
+    // out of range conversions to int32 return INT32_MIN whatever the sign: clamp first
+    const __m128 vmax = _mm_set1_ps(32767.0f);
+    const __m128 vmin = _mm_set1_ps(-32768.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128 lo = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + i), vmax), vmin);
+        __m128 hi = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + i + 4), vmax), vmin);
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+#endif
+    for (; i < count; i++) {
+        float sample = in[i];
+        if (sample > 32767.0f) {
+            sample = 32767.0f;
+        } else if (sample < -32768.0f) {
+            sample = -32768.0f;
+        }
+        out[i] = (int16_t)lrintf(sample);
+    }
+}
+
+static float peakAbs(const float *in, size_t count)
+{
+    float peak = 0;
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    float32x4_t vpeak = vdupq_n_f32(0);
+    for (; i + 4 <= count; i += 4) {
+        vpeak = vmaxq_f32(vpeak, vabsq_f32(vld1q_f32(in + i)));
+    }
+    float32x2_t pair = vpmax_f32(vget_low_f32(vpeak), vget_high_f32(vpeak));
+    peak = vget_lane_f32(vpmax_f32(pair, pair), 0);
+#elif defined(__SSE2__)
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 vpeak = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        vpeak = _mm_max_ps(vpeak, _mm_and_ps(_mm_loadu_ps(in + i), absMask));
+    }
+    vpeak = _mm_max_ps(vpeak, _mm_shuffle_ps(vpeak, vpeak, _MM_SHUFFLE(1, 0, 3, 2)));
+    vpeak = _mm_max_ps(vpeak, _mm_shuffle_ps(vpeak, vpeak, _MM_SHUFFLE(2, 3, 0, 1)));
+    peak = _mm_cvtss_f32(vpeak);
+#endif
+    for (; i < count; i++) {
+        float sample = fabsf(in[i]);
+        if (sample > peak) {
+            peak = sample;
+        }
+    }
+    return peak;
+}
+
+// multiplies the frames by a gain going linearly from gain to gain + frames * step
+static void applyGainRamp(float *buffer, size_t frames, uint32_t channelCount,
+                          float gain, float step)
+{
+    size_t count = frames * channelCount;
+    size_t i = 0;
+#if defined(__ARM_NEON__) || defined(__SSE2__)
+    // the gain of each of the 4 lanes: 4 frames in mono, 2 in stereo
+    float lanes[4];
+    for (int lane = 0; lane < 4; lane++) {
+        lanes[lane] = gain + step * (lane / channelCount);
+    }
+    float laneStep = step * (4 / channelCount);
+#if defined(__ARM_NEON__)
+    float32x4_t vgain = vld1q_f32(lanes);
+    float32x4_t vstep = vdupq_n_f32(laneStep);
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(buffer + i, vmulq_f32(vld1q_f32(buffer + i), vgain));
+        vgain = vaddq_f32(vgain, vstep);
+    }
+#else
+    __m128 vgain = _mm_loadu_ps(lanes);
+    __m128 vstep = _mm_set1_ps(laneStep);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), vgain));
+        vgain = _mm_add_ps(vgain, vstep);
+    }
+#endif
+#endif
+    for (; i < count; i++) {
+        buffer[i] *= gain + step * (i / channelCount);
+    }
+}
+
+static float dbToAmplitude(float db)
+{
+    return powf(10.0f, db / 20.0f);
+}
+
+// ----------------------------------------------------------------------------
+
+AudioEffectChain::AudioEffectChain(direction dir)
+    : mDirection(dir), mEnabled(false), mSampleRate(0), mChannelCount(0), mBuffer(NULL),
+      mDcBlock(false), mDcCoef(0), mGainDb(0), mGain(1.0f), mLimiterDb(0),
+      mLimiterThreshold(0), mLimiterGain(1.0f), mLimiterRelease(0)
+{
+    memset(mDcX1, 0, sizeof(mDcX1));
+    memset(mDcY1, 0, sizeof(mDcY1));
+    memset(mEq, 0, sizeof(mEq));
+}
+
+AudioEffectChain::~AudioEffectChain()
+{
+    free(mBuffer);
+}
+
+status_t AudioEffectChain::addEffect(effect_handle_t effect)
+{
+    AutoMutex lock(mLock);
+
+    if (mDirection == OUTPUT) {
+        return INVALID_OPERATION;
+    }
+    for (size_t i = 0; i < mEffects.size(); i++) {
+        if (mEffects[i] == effect) {
+            return INVALID_OPERATION;
+        }
+    }
+    mEffects.add(effect);
+    updateEnabled_l();
+    return NO_ERROR;
+}
+
+status_t AudioEffectChain::removeEffect(effect_handle_t effect)
+{
+    AutoMutex lock(mLock);
+
+    for (size_t i = 0; i < mEffects.size(); i++) {
+        if (mEffects[i] == effect) {
+            mEffects.removeAt(i);
+            updateEnabled_l();
+            return NO_ERROR;
+        }
+    }
+    return BAD_VALUE;
+}
+
+String8 AudioEffectChain::setParameters(const String8& keyValuePairs)
+{
+    if (strstr(keyValuePairs.string(), AUDIO_PARAMETER_FX_PREFIX) == NULL) {
+        return keyValuePairs;
+    }
+
+    AutoMutex lock(mLock);
+    AudioParameter param = AudioParameter(keyValuePairs);
+    String8 key;
+    String8 value;
+    float floatValue;
+    int intValue;
+
+    key = String8(AUDIO_PARAMETER_FX_GAIN);
+    if (param.getFloat(key, floatValue) == NO_ERROR) {
+        mGainDb = floatValue;
+        mGain = dbToAmplitude(floatValue);
+        param.remove(key);
+    }
+    key = String8(AUDIO_PARAMETER_FX_DC_BLOCK);
+    if (param.getInt(key, intValue) == NO_ERROR) {
+        mDcBlock = (intValue != 0);
+        param.remove(key);
+    }
+    key = String8(AUDIO_PARAMETER_FX_LIMITER);
+    if (param.getFloat(key, floatValue) == NO_ERROR) {
+        mLimiterDb = (floatValue < 0) ? floatValue : 0;
+        mLimiterThreshold = (floatValue < 0) ? 32767.0f * dbToAmplitude(floatValue) : 0;
+        mLimiterGain = 1.0f;
+        param.remove(key);
+    }
+    for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+        char name[16];
+        snprintf(name, sizeof(name), "%s%d", AUDIO_PARAMETER_FX_EQ, band);
+        key = String8(name);
+        if (param.get(key, value) != NO_ERROR) {
+            continue;
+        }
+        float frequency, q, gainDb;
+        if (sscanf(value.string(), "%f,%f,%f", &frequency, &q, &gainDb) == 3 &&
+                frequency > 0 && q > 0) {
+            mEq[band].mFrequency = frequency;
+            mEq[band].mQ = q;
+            mEq[band].mGainDb = gainDb;
+        } else {
+            ALOGW("setParameters() invalid EQ band %s=%s", name, value.string());
+        }
+        param.remove(key);
+    }
+
+    // recompute the filters for the new settings
+    if (mSampleRate != 0) {
+        configure_l(mSampleRate, mChannelCount);
+    }
+    updateEnabled_l();
+    return param.toString();
+}
+
+void AudioEffectChain::updateEnabled_l()
+{
+    bool enabled = !mEffects.isEmpty() || mDcBlock || mGainDb != 0 || mLimiterThreshold != 0;
+    for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+        enabled = enabled || mEq[band].mGainDb != 0;
+    }
+    mEnabled = enabled;
+}
+
+void AudioEffectChain::configure_l(uint32_t sampleRate, uint32_t channelCount)
+{
+    ALOGV("configure_l() sample rate %u channels %u", sampleRate, channelCount);
+    if (mBuffer == NULL) {
+        mBuffer = (float *)malloc(EFFECT_CHAIN_BLOCK_FRAMES * EFFECT_CHAIN_MAX_CHANNELS *
+                                  sizeof(float));
+    }
+    if (sampleRate != mSampleRate || channelCount != mChannelCount) {
+        memset(mDcX1, 0, sizeof(mDcX1));
+        memset(mDcY1, 0, sizeof(mDcY1));
+        for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+            memset(mEq[band].mZ1, 0, sizeof(mEq[band].mZ1));
+            memset(mEq[band].mZ2, 0, sizeof(mEq[band].mZ2));
+        }
+        mLimiterGain = 1.0f;
+    }
+    mSampleRate = sampleRate;
+    mChannelCount = channelCount;
+
+    mDcCoef = 1.0f - (2.0f * (float)M_PI * DC_BLOCK_HZ / sampleRate);
+
+    // peaking EQ from the audio EQ cookbook (R. Bristow-Johnson)
+    for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+        Biquad *eq = &mEq[band];
+        if (eq->mGainDb == 0 || eq->mFrequency >= sampleRate / 2) {
+            eq->mB0 = 1.0f;
+            eq->mB1 = eq->mB2 = eq->mA1 = eq->mA2 = 0;
+            continue;
+        }
+        double a = pow(10.0, eq->mGainDb / 40.0);
+        double w0 = 2 * M_PI * eq->mFrequency / sampleRate;
+        double alpha = sin(w0) / (2 * eq->mQ);
+        double a0 = 1 + alpha / a;
+        eq->mB0 = (float)((1 + alpha * a) / a0);
+        eq->mB1 = (float)((-2 * cos(w0)) / a0);
+        eq->mB2 = (float)((1 - alpha * a) / a0);
+        eq->mA1 = eq->mB1;
+        eq->mA2 = (float)((1 - alpha / a) / a0);
+    }
+
+    // the gain recovers by a constant factor per block: x10 per LIMITER_RELEASE_MS
+    double blockMs = 1000.0 * EFFECT_CHAIN_BLOCK_FRAMES / sampleRate;
+    mLimiterRelease = (float)pow(10.0, blockMs / LIMITER_RELEASE_MS);
+}
+
+void AudioEffectChain::process(const int16_t *in, int16_t *out, size_t frames,
+                               uint32_t sampleRate, uint32_t channelCount)
+{
+    if (in != out) {
+        memcpy(out, in, frames * channelCount * sizeof(int16_t));
+    }
+    if (!mEnabled || channelCount == 0 || channelCount > EFFECT_CHAIN_MAX_CHANNELS ||
+            sampleRate == 0) {
+        return;
+    }
+
+    AutoMutex lock(mLock);
+    if (sampleRate != mSampleRate || channelCount != mChannelCount || mBuffer == NULL) {
+        configure_l(sampleRate, channelCount);
+        if (mBuffer == NULL) {
+            return;
+        }
+    }
+    processBuiltins_l(out, frames);
+    processEffects_l(out, frames);
+}
+
+void AudioEffectChain::processEffects_l(int16_t *buffer, size_t frames)
+{
+    for (size_t i = 0; i < mEffects.size(); i++) {
+        effect_handle_t effect = mEffects[i];
+        audio_buffer_t audioBuffer;
+        audioBuffer.frameCount = frames;
+        audioBuffer.s16 = buffer;
+        // -ENODATA only means that the effect is idle
+        (*effect)->process(effect, &audioBuffer, &audioBuffer);
+    }
+}
+
+void AudioEffectChain::processBuiltins_l(int16_t *buffer, size_t frames)
+{
+    bool eq = false;
+    for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+        eq = eq || mEq[band].mGainDb != 0;
+    }
+    if (!mDcBlock && !eq && mGainDb == 0 && mLimiterThreshold == 0) {
+        return;
+    }
+
+    const uint32_t channels = mChannelCount;
+    while (frames != 0) {
+        size_t count = (frames < EFFECT_CHAIN_BLOCK_FRAMES) ? frames : EFFECT_CHAIN_BLOCK_FRAMES;
+        size_t samples = count * channels;
+        pcm16ToFloat(buffer, mBuffer, samples);
+
+        // the recursive filters run one channel at a time
+        for (uint32_t c = 0; c < channels; c++) {
+            if (mDcBlock) {
+                float x1 = mDcX1[c];
+                float y1 = mDcY1[c];
+                for (size_t i = c; i < samples; i += channels) {
+                    float x = mBuffer[i];
+                    y1 = x - x1 + mDcCoef * y1;
+                    x1 = x;
+                    mBuffer[i] = y1;
+                }
+                mDcX1[c] = x1;
+                mDcY1[c] = y1;
+            }
+            for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+                Biquad *bq = &mEq[band];
+                if (bq->mGainDb == 0) {
+                    continue;
+                }
+                // transposed direct form II
+                float z1 = bq->mZ1[c];
+                float z2 = bq->mZ2[c];
+                for (size_t i = c; i < samples; i += channels) {
+                    float x = mBuffer[i];
+                    float y = bq->mB0 * x + z1;
+                    z1 = bq->mB1 * x - bq->mA1 * y + z2;
+                    z2 = bq->mB2 * x - bq->mA2 * y;
+                    mBuffer[i] = y;
+                }
+                bq->mZ1[c] = z1;
+                bq->mZ2[c] = z2;
+            }
+        }
+
+        // gain and limiter are applied together, ramping over the block to the gain
+        // reduction needed by its peak
+        float startGain = mGain * mLimiterGain;
+        float endGain = startGain;
+        if (mLimiterThreshold != 0) {
+            float peak = peakAbs(mBuffer, samples) * mGain;
+            float target = (peak > mLimiterThreshold) ? mLimiterThreshold / peak : 1.0f;
+            if (target < mLimiterGain) {
+                mLimiterGain = target;
+            } else {
+                mLimiterGain *= mLimiterRelease;
+                if (mLimiterGain > target) {
+                    mLimiterGain = target;
+                }
+            }
+            endGain = mGain * mLimiterGain;
+        }
+        if (startGain != 1.0f || endGain != 1.0f) {
+            applyGainRamp(mBuffer, count, channels, startGain, (endGain - startGain) / count);
+        }
+
+        floatToPcm16(mBuffer, buffer, samples);
+        buffer += samples;
+        frames -= count;
+    }
+}
+
+status_t AudioEffectChain::dump(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    AutoMutex lock(mLock);
+    snprintf(buffer, SIZE, "AudioEffectChain %p %s\n", this,
+             (mDirection == OUTPUT) ? "output" : "input");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tframework effects: %u\n", (unsigned int)mEffects.size());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tDC blocker: %s gain: %.1f dB limiter: %.1f dBFS (%.1f dB)\n",
+             mDcBlock ? "on" : "off", mGainDb, mLimiterDb, 20 * log10f(mLimiterGain));
+    result.append(buffer);
+    for (int band = 0; band < EFFECT_CHAIN_EQ_BANDS; band++) {
+        if (mEq[band].mGainDb == 0) {
+            continue;
+        }
+        snprintf(buffer, SIZE, "\tEQ band %d: %.0f Hz Q %.2f %.1f dB\n", band,
+                 mEq[band].mFrequency, mEq[band].mQ, mEq[band].mGainDb);
+        result.append(buffer);
+    }
+    write(fd, result.string(), result.size());
+    return NO_ERROR;
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
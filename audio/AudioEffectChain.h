@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_EFFECT_CHAIN_H
+#define ANDROID_AUDIO_EFFECT_CHAIN_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <utils/String8.h>
+#include <hardware/audio_effect.h>
+
+#include <hardware_legacy/AudioSystemLegacy.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::AutoMutex;
+    using android::Vector;
+    using android::String8;
+
+// ----------------------------------------------------------------------------
+
+// Stream parameters configuring the built-in effects
+// gain in dB
+#define AUDIO_PARAMETER_FX_GAIN "fx_gain"
+// 1 enables the DC blocker
+#define AUDIO_PARAMETER_FX_DC_BLOCK "fx_dc_block"
+// limiter threshold in dBFS, 0 disables the limiter
+#define AUDIO_PARAMETER_FX_LIMITER "fx_limiter"
+// fx_eq0 to fx_eq3: "frequency,q,gain" of a peaking EQ band, gain in dB. A gain of 0
+// disables the band.
+#define AUDIO_PARAMETER_FX_EQ "fx_eq"
+#define AUDIO_PARAMETER_FX_PREFIX "fx_"
+
+#define EFFECT_CHAIN_EQ_BANDS 4
+#define EFFECT_CHAIN_MAX_CHANNELS 2
+// frames processed per pass through the float buffer
+#define EFFECT_CHAIN_BLOCK_FRAMES 256
+
+// Effects applied by the HAL shim to the 16 bit PCM written to or read from a legacy stream:
+// built-in DC blocker, peaking EQ, gain and limiter configured with stream parameters and,
+// on input streams only, the pre processing effects attached by the framework
+// (add_audio_effect()), which run last on the cleaned up capture. AudioFlinger runs the
+// effects of output sessions itself.
+class AudioEffectChain
+{
+public:
+    enum direction {
+        OUTPUT,
+        INPUT
+    };
+
+                        AudioEffectChain(direction dir);
+                        ~AudioEffectChain();
+
+            // returns INVALID_OPERATION on output chains or if the effect is already added
+            status_t    addEffect(effect_handle_t effect);
+            // returns BAD_VALUE if the effect is not in the chain
+            status_t    removeEffect(effect_handle_t effect);
+
+            // applies the built-in effect parameters and returns the other key value pairs
+            String8     setParameters(const String8& keyValuePairs);
+            bool        isEmpty() const { return !mEnabled; }
+
+            // processes interleaved mono or stereo frames. in and out may be the same buffer.
+            void        process(const int16_t *in, int16_t *out, size_t frames,
+                                uint32_t sampleRate, uint32_t channelCount);
+            status_t    dump(int fd);
+
+private:
+                        AudioEffectChain(const AudioEffectChain&);
+            AudioEffectChain& operator=(const AudioEffectChain&);
+
+    struct Biquad {
+        float           mFrequency;
+        float           mQ;
+        float           mGainDb;
+        float           mB0, mB1, mB2, mA1, mA2;
+        float           mZ1[EFFECT_CHAIN_MAX_CHANNELS];
+        float           mZ2[EFFECT_CHAIN_MAX_CHANNELS];
+    };
+
+            void        configure_l(uint32_t sampleRate, uint32_t channelCount);
+            void        updateEnabled_l();
+            void        processEffects_l(int16_t *buffer, size_t frames);
+            void        processBuiltins_l(int16_t *buffer, size_t frames);
+
+    const direction     mDirection;
+    Mutex               mLock;
+    // process() checks it without lock to skip empty chains
+    volatile bool       mEnabled;
+    Vector<effect_handle_t> mEffects;
+    uint32_t            mSampleRate;
+    uint32_t            mChannelCount;
+    float               *mBuffer;       // EFFECT_CHAIN_BLOCK_FRAMES frames
+
+    bool                mDcBlock;
+    float               mDcCoef;
+    float               mDcX1[EFFECT_CHAIN_MAX_CHANNELS];
+    float               mDcY1[EFFECT_CHAIN_MAX_CHANNELS];
+    Biquad              mEq[EFFECT_CHAIN_EQ_BANDS];
+    float               mGainDb;
+    float               mGain;
+    float               mLimiterDb;
+    float               mLimiterThreshold;   // 0 when disabled
+    float               mLimiterGain;        // current gain reduction
+    float               mLimiterRelease;     // gain recovery per block
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_EFFECT_CHAIN_H
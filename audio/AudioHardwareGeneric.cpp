@@ -20,7 +20,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <sched.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -28,6 +31,14 @@
 #define LOG_TAG "AudioHardware"
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
+#include <cutils/properties.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "AudioHardwareGeneric.h"
 #include <media/AudioRecord.h>
@@ -40,24 +51,117 @@ namespace android_audio_legacy {
 
 static char const * const kAudioDeviceName = "/dev/eac";
 
+// set to 1 to open the device O_NONBLOCK
+#define GENERIC_NONBLOCKING_PROPERTY "ro.audio.generic_nonblocking"
+
+// Waits with poll() until fd is ready for events or until the deadline (systemTime()) is
+// reached. Returns NO_ERROR, TIMED_OUT or a negative errno.
+static status_t waitForDevice(int fd, short events, nsecs_t deadline)
+{
+    for (;;) {
+        nsecs_t now = systemTime();
+        if (now >= deadline) {
+            return TIMED_OUT;
+        }
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = events;
+        pfd.revents = 0;
+        // round up so that the deadline is not missed by less than a millisecond
+        int timeoutMs = (int)((deadline - now + 999999) / 1000000);
+        int ret = ::poll(&pfd, 1, timeoutMs);
+        if (ret > 0) {
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                return -EIO;
+            }
+            return NO_ERROR;
+        }
+        if (ret == 0) {
+            return TIMED_OUT;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+// adds src to dst with saturation
+static void mixSaturate(int16_t *dst, const int16_t *src, size_t count)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 8 <= count; i += 8) {
+        vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(a, b));
+    }
+#endif
+    for (; i < count; i++) {
+        int32_t sum = (int32_t)dst[i] + src[i];
+        if (sum > 32767) {
+            sum = 32767;
+        } else if (sum < -32768) {
+            sum = -32768;
+        }
+        dst[i] = (int16_t)sum;
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 AudioHardwareGeneric::AudioHardwareGeneric()
-    : mOutput(0), mInput(0),  mFd(-1), mMicMute(false)
+    : mInput(0),  mFd(-1), mMicMute(false), mNonBlocking(false),
+      mMixBuffer(NULL), mStreamBuffer(NULL), mExit(false), mPartialWrites(0),
+      mWriteTimeouts(0)
 {
-    mFd = ::open(kAudioDeviceName, O_RDWR);
+    char value[PROPERTY_VALUE_MAX];
+    property_get(GENERIC_NONBLOCKING_PROPERTY, value, "0");
+    mNonBlocking = atoi(value) != 0;
+    mFd = ::open(kAudioDeviceName, mNonBlocking ? O_RDWR | O_NONBLOCK : O_RDWR);
+    if (mFd < 0) {
+        return;
+    }
+    mMixBuffer = (int16_t *)malloc(GENERIC_OUTPUT_PERIOD_SIZE);
+    mStreamBuffer = (int16_t *)malloc(GENERIC_OUTPUT_PERIOD_SIZE);
+    if (mMixBuffer == NULL || mStreamBuffer == NULL) {
+        return;
+    }
+    mMixer = new MixerThread(this);
+    if (mMixer->run("GenericAudioMixer", ANDROID_PRIORITY_URGENT_AUDIO) != NO_ERROR) {
+        ALOGW("AudioHardwareGeneric() could not start mixer thread");
+        mMixer.clear();
+    }
 }
 
 AudioHardwareGeneric::~AudioHardwareGeneric()
 {
-    if (mFd >= 0) ::close(mFd);
-    closeOutputStream((AudioStreamOut *)mOutput);
+    if (mMixer != 0) {
+        mMixer->requestExit();
+        {
+            AutoMutex lock(mMixLock);
+            mExit = true;
+            mMixCond.signal();
+            mSpaceCond.broadcast();
+        }
+        mMixer->requestExitAndWait();
+        mMixer.clear();
+    }
+    while (mOutputs.size() != 0) {
+        closeOutputStream((AudioStreamOut *)mOutputs[0]);
+    }
     closeInputStream((AudioStreamIn *)mInput);
+    if (mFd >= 0) ::close(mFd);
+    free(mMixBuffer);
+    free(mStreamBuffer);
 }
 
 status_t AudioHardwareGeneric::initCheck()
 {
-    if (mFd >= 0) {
+    if (mFd >= 0 && mMixer != 0) {
         if (::access(kAudioDeviceName, O_RDWR) == NO_ERROR)
             return NO_ERROR;
     }
@@ -69,10 +173,10 @@ AudioStreamOut* AudioHardwareGeneric::openOutputStream(
 {
     AutoMutex lock(mLock);
 
-    // only one output stream allowed
-    if (mOutput) {
+    // output streams need the mixer to drain their ring
+    if (mMixer == 0) {
         if (status) {
-            *status = INVALID_OPERATION;
+            *status = NO_INIT;
         }
         return 0;
     }
@@ -83,19 +187,38 @@ AudioStreamOut* AudioHardwareGeneric::openOutputStream(
     if (status) {
         *status = lStatus;
     }
-    if (lStatus == NO_ERROR) {
-        mOutput = out;
-    } else {
+    if (lStatus != NO_ERROR) {
         delete out;
+        return 0;
     }
-    return mOutput;
+    AutoMutex mixLock(mMixLock);
+    mOutputs.add(out);
+    return out;
 }
 
 void AudioHardwareGeneric::closeOutputStream(AudioStreamOut* out) {
-    if (mOutput && out == mOutput) {
-        delete mOutput;
-        mOutput = 0;
+    AudioStreamOutGeneric *genericOut = (AudioStreamOutGeneric *)out;
+    {
+        AutoMutex lock(mLock);
+        AutoMutex mixLock(mMixLock);
+        if (mOutputs.indexOf(genericOut) < 0) {
+            return;
+        }
+        mOutputs.remove(genericOut);
+    }
+    delete genericOut;
+}
+
+size_t AudioHardwareGeneric::getInputBufferSize(uint32_t sampleRate, int format,
+                                                int channelCount)
+{
+    if (channelCount <= 0 ||
+            !AudioStreamInGeneric::isSupported(sampleRate, format, channelCount)) {
+        ALOGW("getInputBufferSize bad configuration: rate %u format %d channel count %d",
+              sampleRate, format, channelCount);
+        return 0;
     }
+    return AudioStreamInGeneric::bufferSize(sampleRate, channelCount);
 }
 
 AudioStreamIn* AudioHardwareGeneric::openInputStream(
@@ -169,7 +292,11 @@ status_t AudioHardwareGeneric::dumpInternals(int fd, const Vector<String16>& arg
     char buffer[SIZE];
     String8 result;
     result.append("AudioHardwareGeneric::dumpInternals\n");
-    snprintf(buffer, SIZE, "\tmFd: %d mMicMute: %s\n",  mFd, mMicMute? "true": "false");
+    snprintf(buffer, SIZE, "\tmFd: %d mMicMute: %s mNonBlocking: %s\n",
+             mFd, mMicMute? "true": "false", mNonBlocking? "true": "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\toutputs: %u partial writes: %u timeouts: %u\n",
+             (unsigned int)mOutputs.size(), mPartialWrites, mWriteTimeouts);
     result.append(buffer);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
@@ -177,18 +304,117 @@ status_t AudioHardwareGeneric::dumpInternals(int fd, const Vector<String16>& arg
 
 status_t AudioHardwareGeneric::dump(int fd, const Vector<String16>& args)
 {
+    AutoMutex lock(mLock);
     dumpInternals(fd, args);
     if (mInput) {
         mInput->dump(fd, args);
     }
-    if (mOutput) {
-        mOutput->dump(fd, args);
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        mOutputs[i]->dump(fd, args);
+    }
+    return NO_ERROR;
+}
+
+bool AudioHardwareGeneric::mixPeriod()
+{
+    {
+        AutoMutex lock(mMixLock);
+        for (;;) {
+            if (mExit) {
+                return false;
+            }
+            bool active = false;
+            for (size_t i = 0; i < mOutputs.size() && !active; i++) {
+                active = mOutputs[i]->mActive || mOutputs[i]->mRing.availableToRead() != 0;
+            }
+            if (active) {
+                break;
+            }
+            // all outputs are in standby and drained: let the device run dry
+            mSpaceCond.broadcast();
+            mMixCond.wait(mMixLock);
+        }
+
+        // an output without enough queued audio is mixed as silence after what it has, so that
+        // the device keeps running at its own pace
+        memset(mMixBuffer, 0, GENERIC_OUTPUT_PERIOD_SIZE);
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            AudioStreamOutGeneric *out = mOutputs[i];
+            size_t frameSize = out->frameSize();
+            size_t count = out->mRing.availableToRead();
+            if (count > GENERIC_OUTPUT_PERIOD_SIZE) {
+                count = GENERIC_OUTPUT_PERIOD_SIZE;
+            }
+            count = out->mRing.read(mStreamBuffer, count - count % frameSize);
+            if (count < GENERIC_OUTPUT_PERIOD_SIZE && out->mActive && !out->mStarved) {
+                // count a starvation once, not once per period until the next write
+                out->mStarved = true;
+                out->mUnderruns++;
+                ALOGV("mixPeriod() underrun on output %p", out);
+            }
+            mixSaturate(mMixBuffer, mStreamBuffer, count / sizeof(int16_t));
+        }
+        mSpaceCond.broadcast();
+    }
+
+    if (writeDevice(mMixBuffer, GENERIC_OUTPUT_PERIOD_SIZE) != NO_ERROR) {
+        // do not spin on a broken device
+        usleep(GENERIC_DEVICE_LATENCY_MS * 1000);
+    }
+    return true;
+}
+
+// Writes one period to the device. In non-blocking mode, the period must be accepted within
+// two period durations: data the device does not take by then is dropped, so that a stalled
+// device does not stall the outputs.
+status_t AudioHardwareGeneric::writeDevice(const void* buffer, size_t bytes)
+{
+    // 16 bit stereo at 44.1kHz, as all output streams
+    const nsecs_t periodNs = (nsecs_t)(bytes / 4) * 1000000000LL / 44100;
+    const nsecs_t deadline = systemTime() + 2 * periodNs;
+    const uint8_t *p = (const uint8_t *)buffer;
+    size_t written = 0;
+
+    while (written < bytes) {
+        ssize_t ret = ::write(mFd, p + written, bytes - written);
+        if (ret > 0) {
+            if ((size_t)ret < bytes - written) {
+                mPartialWrites++;
+            }
+            written += ret;
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (!mNonBlocking || ret == 0 || errno != EAGAIN) {
+            ALOGE("write() failed: %s", ret == 0 ? "no progress" : strerror(errno));
+            return ret == 0 ? -EIO : -errno;
+        }
+        status_t status = waitForDevice(mFd, POLLOUT, deadline);
+        if (status == TIMED_OUT) {
+            ALOGW_IF(mWriteTimeouts == 0, "device not ready, dropping %u bytes",
+                     (unsigned int)(bytes - written));
+            mWriteTimeouts++;
+            break;
+        }
+        if (status != NO_ERROR) {
+            ALOGE("poll() failed: %s", strerror(-status));
+            return status;
+        }
     }
     return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
 
+AudioStreamOutGeneric::AudioStreamOutGeneric()
+    : mAudioHardware(0), mFd(-1), mDevice(0),
+      mRing(GENERIC_OUTPUT_PERIOD_SIZE * GENERIC_OUTPUT_PERIODS), mActive(false),
+      mStarved(false), mUnderruns(0)
+{
+}
+
 status_t AudioStreamOutGeneric::set(
         AudioHardwareGeneric *hw,
         int fd,
@@ -220,6 +446,10 @@ status_t AudioStreamOutGeneric::set(
     if (pChannels) *pChannels = lChannels;
     if (pRate) *pRate = lRate;
 
+    if (!mRing.initCheck()) {
+        return NO_MEMORY;
+    }
+
     mAudioHardware = hw;
     mFd = fd;
     mDevice = devices;
@@ -230,15 +460,46 @@ AudioStreamOutGeneric::~AudioStreamOutGeneric()
 {
 }
 
+uint32_t AudioStreamOutGeneric::latency() const
+{
+    return GENERIC_DEVICE_LATENCY_MS +
+            (uint32_t)((mRing.capacity() / frameSize()) * 1000 / sampleRate());
+}
+
 ssize_t AudioStreamOutGeneric::write(const void* buffer, size_t bytes)
 {
-    Mutex::Autolock _l(mLock);
-    return ssize_t(::write(mFd, buffer, bytes));
+    AudioHardwareGeneric *hw = mAudioHardware;
+    const uint8_t *data = (const uint8_t *)buffer;
+    size_t written = 0;
+
+    while (written < bytes) {
+        size_t count = mRing.write(data + written, bytes - written);
+        written += count;
+        AutoMutex lock(hw->mMixLock);
+        mActive = true;
+        mStarved = false;
+        if (count != 0) {
+            hw->mMixCond.signal();
+        }
+        if (written == bytes || hw->mExit) {
+            break;
+        }
+        // the ring is full: the caller is paced by the mixer, itself paced by the device
+        if (mRing.availableToWrite() == 0) {
+            hw->mSpaceCond.wait(hw->mMixLock);
+        }
+    }
+    return written;
 }
 
 status_t AudioStreamOutGeneric::standby()
 {
-    // Implement: audio hardware to standby mode
+    AudioHardwareGeneric *hw = mAudioHardware;
+    AutoMutex lock(hw->mMixLock);
+    while (!hw->mExit && mRing.availableToRead() != 0) {
+        hw->mSpaceCond.wait(hw->mMixLock);
+    }
+    mActive = false;
     return NO_ERROR;
 }
 
@@ -263,6 +524,9 @@ status_t AudioStreamOutGeneric::dump(int fd, const Vector<String16>& args)
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmFd: %d\n", mFd);
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tqueued: %u bytes underruns: %u\n",
+             (unsigned int)mRing.availableToRead(), mUnderruns);
+    result.append(buffer);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -308,6 +572,38 @@ status_t AudioStreamOutGeneric::getRenderPosition(uint32_t *dspFrames)
 // ----------------------------------------------------------------------------
 
 // record functions
+
+// rates the resampler converts GENERIC_INPUT_DEVICE_RATE to with few enough filter phases
+static const uint32_t kGenericInputRates[] = {
+    8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000
+};
+
+bool AudioStreamInGeneric::isSupported(uint32_t rate, int format, uint32_t channelCount)
+{
+    if (format != AudioSystem::PCM_16_BIT || (channelCount != 1 && channelCount != 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(kGenericInputRates) / sizeof(kGenericInputRates[0]); i++) {
+        if (rate == kGenericInputRates[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t AudioStreamInGeneric::bufferSize(uint32_t rate, uint32_t channelCount)
+{
+    return (size_t)(GENERIC_INPUT_PERIOD_FRAMES * rate / GENERIC_INPUT_DEVICE_RATE) *
+            channelCount * sizeof(int16_t);
+}
+
+AudioStreamInGeneric::AudioStreamInGeneric()
+    : mAudioHardware(0), mFd(-1), mDevice(0), mSampleRate(GENERIC_INPUT_DEVICE_RATE),
+      mChannels(AudioSystem::CHANNEL_IN_MONO), mRing(NULL), mDeviceBuffer(NULL),
+      mConvertBuffer(NULL), mPartialReads(0), mReadTimeouts(0)
+{
+}
+
 status_t AudioStreamInGeneric::set(
         AudioHardwareGeneric *hw,
         int fd,
@@ -320,36 +616,171 @@ status_t AudioStreamInGeneric::set(
     if (pFormat == 0 || pChannels == 0 || pRate == 0) return BAD_VALUE;
     ALOGV("AudioStreamInGeneric::set(%p, %d, %d, %d, %u)", hw, fd, *pFormat, *pChannels, *pRate);
     // check values
-    if ((*pFormat != format()) ||
-        (*pChannels != channels()) ||
-        (*pRate != sampleRate())) {
+    if ((*pChannels != AudioSystem::CHANNEL_IN_MONO &&
+                *pChannels != AudioSystem::CHANNEL_IN_STEREO) ||
+        !isSupported(*pRate, *pFormat, AudioSystem::popCount(*pChannels))) {
         ALOGE("Error opening input channel");
         *pFormat = format();
-        *pChannels = channels();
-        *pRate = sampleRate();
+        *pChannels = AudioSystem::CHANNEL_IN_MONO;
+        *pRate = GENERIC_INPUT_DEVICE_RATE;
         return BAD_VALUE;
     }
 
+    if (*pRate != GENERIC_INPUT_DEVICE_RATE || *pChannels != AudioSystem::CHANNEL_IN_MONO) {
+        status_t status = mConverter.configure(AUDIO_FORMAT_PCM_16_BIT, 1,
+                                               GENERIC_INPUT_DEVICE_RATE,
+                                               AudioSystem::popCount(*pChannels), *pRate);
+        if (status != NO_ERROR) {
+            ALOGE("Error opening input channel: cannot convert to %u Hz", *pRate);
+            if (status == BAD_VALUE) {
+                *pChannels = AudioSystem::CHANNEL_IN_MONO;
+                *pRate = GENERIC_INPUT_DEVICE_RATE;
+            }
+            return status;
+        }
+        const size_t deviceFrames = GENERIC_INPUT_PERIOD_FRAMES * GENERIC_INPUT_READ_PERIODS;
+        size_t convertSize = mConverter.maxOutFrames(deviceFrames) * mConverter.outFrameSize();
+        mDeviceBuffer = (int16_t *)malloc(deviceFrames * sizeof(int16_t));
+        mConvertBuffer = (int16_t *)malloc(convertSize);
+        // read() only fills the ring once it is empty: one converted device read always fits
+        mRing = new AudioRingBuffer(convertSize);
+        if (mDeviceBuffer == NULL || mConvertBuffer == NULL || !mRing->initCheck()) {
+            return NO_MEMORY;
+        }
+    }
+
     mAudioHardware = hw;
     mFd = fd;
     mDevice = devices;
+    mSampleRate = *pRate;
+    mChannels = *pChannels;
     return NO_ERROR;
 }
 
 AudioStreamInGeneric::~AudioStreamInGeneric()
 {
+    delete mRing;
+    free(mDeviceBuffer);
+    free(mConvertBuffer);
+}
+
+size_t AudioStreamInGeneric::bufferSize() const
+{
+    return bufferSize(mSampleRate, AudioSystem::popCount(mChannels));
 }
 
 ssize_t AudioStreamInGeneric::read(void* buffer, ssize_t bytes)
 {
-    AutoMutex lock(mLock);
-    if (mFd < 0) {
-        ALOGE("Attempt to read from unopened device");
-        return NO_INIT;
+    {
+        AutoMutex lock(mLock);
+        if (mFd < 0) {
+            ALOGE("Attempt to read from unopened device");
+            return NO_INIT;
+        }
+    }
+    if (mRing == NULL) {
+        return readDevice(buffer, bytes);
+    }
+
+    // read whole device periods, as many as the client asks for up to
+    // GENERIC_INPUT_READ_PERIODS at once, and keep what it does not take for the next read
+    uint8_t *p = (uint8_t *)buffer;
+    size_t done = 0;
+    for (;;) {
+        done += mRing->read(p + done, bytes - done);
+        if (done == (size_t)bytes) {
+            break;
+        }
+        uint64_t wanted = (bytes - done) / mConverter.outFrameSize();
+        size_t periods = (size_t)((wanted * GENERIC_INPUT_DEVICE_RATE / mSampleRate +
+                                   GENERIC_INPUT_PERIOD_FRAMES - 1) / GENERIC_INPUT_PERIOD_FRAMES);
+        if (periods == 0) {
+            periods = 1;
+        } else if (periods > GENERIC_INPUT_READ_PERIODS) {
+            periods = GENERIC_INPUT_READ_PERIODS;
+        }
+        ssize_t ret = readDevice(mDeviceBuffer,
+                                 periods * GENERIC_INPUT_PERIOD_FRAMES * sizeof(int16_t));
+        if (ret <= 0) {
+            return done ? (ssize_t)done : ret;
+        }
+        size_t frames = mConverter.convert(mDeviceBuffer, ret / sizeof(int16_t),
+                                           mConvertBuffer);
+        mRing->write(mConvertBuffer, frames * mConverter.outFrameSize());
+    }
+    return bytes;
+}
+
+status_t AudioStreamInGeneric::standby()
+{
+    // read() and standby() are called by the same thread
+    if (mRing != NULL) {
+        mRing->reset();
+        mConverter.reset();
     }
+    return NO_ERROR;
+}
+
+ssize_t AudioStreamInGeneric::readDevice(void* buffer, size_t bytes)
+{
+    if (mAudioHardware->isNonBlocking()) {
+        return readNonBlocking(buffer, bytes);
+    }
+    AutoMutex lock(mLock);
     return ::read(mFd, buffer, bytes);
 }
 
+// Reads all the periods available at once. mLock is only held during each read() call so
+// that standby(), parameter calls and dumps never wait for the device. Each period must be
+// available within two period durations of the time it is due: data missing at the deadline
+// is replaced by silence.
+ssize_t AudioStreamInGeneric::readNonBlocking(void* buffer, size_t bytes)
+{
+    const size_t period = GENERIC_INPUT_PERIOD_FRAMES * sizeof(int16_t);
+    const nsecs_t periodNs =
+            (nsecs_t)GENERIC_INPUT_PERIOD_FRAMES * 1000000000LL / GENERIC_INPUT_DEVICE_RATE;
+    const nsecs_t start = systemTime();
+    uint8_t *p = (uint8_t *)buffer;
+    size_t done = 0;
+
+    while (done < bytes) {
+        size_t chunk = bytes - done;
+        ssize_t ret;
+        {
+            AutoMutex lock(mLock);
+            ret = ::read(mFd, p + done, chunk);
+        }
+        if (ret > 0) {
+            if ((size_t)ret < chunk) {
+                mPartialReads++;
+            }
+            done += ret;
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && errno != EAGAIN) {
+            ALOGE("read() failed: %s", strerror(errno));
+            return done ? (ssize_t)done : -errno;
+        }
+        nsecs_t deadline = start + (nsecs_t)(done / period + 2) * periodNs;
+        status_t status = waitForDevice(mFd, POLLIN, deadline);
+        if (status == TIMED_OUT) {
+            ALOGW_IF(mReadTimeouts == 0, "device not ready, inserting %u bytes of silence",
+                     (unsigned int)(bytes - done));
+            mReadTimeouts++;
+            memset(p + done, 0, bytes - done);
+            break;
+        }
+        if (status != NO_ERROR) {
+            ALOGE("poll() failed: %s", strerror(-status));
+            return done ? (ssize_t)done : status;
+        }
+    }
+    return bytes;
+}
+
 status_t AudioStreamInGeneric::dump(int fd, const Vector<String16>& args)
 {
     const size_t SIZE = 256;
@@ -371,6 +802,11 @@ status_t AudioStreamInGeneric::dump(int fd, const Vector<String16>& args)
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmFd: %d\n", mFd);
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tdevice rate: %d converting: %s\n", GENERIC_INPUT_DEVICE_RATE,
+             mRing != NULL ? "true" : "false");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tpartial reads: %u timeouts: %u\n", mPartialReads, mReadTimeouts);
+    result.append(buffer);
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
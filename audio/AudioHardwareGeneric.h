@@ -22,21 +22,43 @@
 #include <sys/types.h>
 
 #include <utils/threads.h>
+#include <utils/SortedVector.h>
 
 #include <hardware_legacy/AudioSystemLegacy.h>
 #include <hardware_legacy/AudioHardwareBase.h>
 
+#include "AudioRingBuffer.h"
+#include "AudioStreamConverter.h"
+
 namespace android_audio_legacy {
     using android::Mutex;
     using android::AutoMutex;
+    using android::Condition;
+    using android::Thread;
+    using android::sp;
+    using android::SortedVector;
 
 // ----------------------------------------------------------------------------
 
+// bytes mixed and written to the device at a time
+#define GENERIC_OUTPUT_PERIOD_SIZE 4096
+// capacity of the ring of each output stream, in periods
+#define GENERIC_OUTPUT_PERIODS 2
+#define GENERIC_DEVICE_LATENCY_MS 20
+// capture format of the device: 16 bit mono at this rate
+#define GENERIC_INPUT_DEVICE_RATE 8000
+// device period (20 ms), the unit of the buffer sizes and of the read deadlines
+#define GENERIC_INPUT_PERIOD_FRAMES 160
+// largest number of device periods read by one read() system call
+#define GENERIC_INPUT_READ_PERIODS 4
+
 class AudioHardwareGeneric;
 
+// Output streams do not write to the device: their audio is queued in a ring that the mixer
+// thread of AudioHardwareGeneric sums with the other outputs, one period at a time.
 class AudioStreamOutGeneric : public AudioStreamOut {
 public:
-                        AudioStreamOutGeneric() : mAudioHardware(0), mFd(-1) {}
+                        AudioStreamOutGeneric();
     virtual             ~AudioStreamOutGeneric();
 
     virtual status_t    set(
@@ -48,12 +70,14 @@ public:
             uint32_t *pRate);
 
     virtual uint32_t    sampleRate() const { return 44100; }
-    virtual size_t      bufferSize() const { return 4096; }
+    virtual size_t      bufferSize() const { return GENERIC_OUTPUT_PERIOD_SIZE; }
     virtual uint32_t    channels() const { return AudioSystem::CHANNEL_OUT_STEREO; }
     virtual int         format() const { return AudioSystem::PCM_16_BIT; }
-    virtual uint32_t    latency() const { return 20; }
+    // device latency plus the duration of the ring
+    virtual uint32_t    latency() const;
     virtual status_t    setVolume(float left, float right) { return INVALID_OPERATION; }
     virtual ssize_t     write(const void* buffer, size_t bytes);
+    // waits for the queued audio to be mixed
     virtual status_t    standby();
     virtual status_t    dump(int fd, const Vector<String16>& args);
     virtual status_t    setParameters(const String8& keyValuePairs);
@@ -61,15 +85,24 @@ public:
     virtual status_t    getRenderPosition(uint32_t *dspFrames);
 
 private:
+    friend class AudioHardwareGeneric;
+
     AudioHardwareGeneric *mAudioHardware;
-    Mutex   mLock;
     int     mFd;
     uint32_t mDevice;
+    AudioRingBuffer mRing;
+    // the following are protected by the mixer lock of mAudioHardware
+    bool    mActive;        // audio written since the last standby
+    bool    mStarved;       // ring found empty since the last write()
+    uint32_t mUnderruns;
 };
 
+// Input streams capture at the standard rates from GENERIC_INPUT_DEVICE_RATE to 48000 Hz in
+// mono or stereo: the device periods are converted to the client format into a ring which
+// read() drains.
 class AudioStreamInGeneric : public AudioStreamIn {
 public:
-                        AudioStreamInGeneric() : mAudioHardware(0), mFd(-1) {}
+                        AudioStreamInGeneric();
     virtual             ~AudioStreamInGeneric();
 
     virtual status_t    set(
@@ -81,23 +114,43 @@ public:
             uint32_t *pRate,
             AudioSystem::audio_in_acoustics acoustics);
 
-    virtual uint32_t    sampleRate() const { return 8000; }
-    virtual size_t      bufferSize() const { return 320; }
-    virtual uint32_t    channels() const { return AudioSystem::CHANNEL_IN_MONO; }
+    // true if the client format can be converted from the device format
+    static  bool        isSupported(uint32_t rate, int format, uint32_t channelCount);
+    // one device period at the client rate
+    static  size_t      bufferSize(uint32_t rate, uint32_t channelCount);
+
+    virtual uint32_t    sampleRate() const { return mSampleRate; }
+    virtual size_t      bufferSize() const;
+    virtual uint32_t    channels() const { return mChannels; }
     virtual int         format() const { return AudioSystem::PCM_16_BIT; }
     virtual status_t    setGain(float gain) { return INVALID_OPERATION; }
     virtual ssize_t     read(void* buffer, ssize_t bytes);
     virtual status_t    dump(int fd, const Vector<String16>& args);
-    virtual status_t    standby() { return NO_ERROR; }
+    virtual status_t    standby();
     virtual status_t    setParameters(const String8& keyValuePairs);
     virtual String8     getParameters(const String8& keys);
     virtual unsigned int  getInputFramesLost() const { return 0; }
+    virtual status_t    addAudioEffect(effect_handle_t effect) { return INVALID_OPERATION; }
+    virtual status_t    removeAudioEffect(effect_handle_t effect) { return INVALID_OPERATION; }
 
 private:
+            // reads device frames
+            ssize_t     readDevice(void* buffer, size_t bytes);
+            ssize_t     readNonBlocking(void* buffer, size_t bytes);
+
     AudioHardwareGeneric *mAudioHardware;
     Mutex   mLock;
     int     mFd;
     uint32_t mDevice;
+    uint32_t mSampleRate;
+    uint32_t mChannels;
+    // the following are only used when the client format is not the device format
+    AudioPcmConverter mConverter;
+    AudioRingBuffer *mRing;         // converted frames not read yet
+    int16_t *mDeviceBuffer;         // GENERIC_INPUT_READ_PERIODS device periods
+    int16_t *mConvertBuffer;        // mDeviceBuffer converted
+    uint32_t mPartialReads;
+    uint32_t mReadTimeouts;
 };
 
 
@@ -131,20 +184,53 @@ public:
             status_t *status,
             AudioSystem::audio_in_acoustics acoustics);
     virtual    void        closeInputStream(AudioStreamIn* in);
+    virtual    size_t      getInputBufferSize(uint32_t sampleRate, int format, int channelCount);
 
             void            closeOutputStream(AudioStreamOutGeneric* out);
             void            closeInputStream(AudioStreamInGeneric* in);
+
+            // true if the device is opened O_NONBLOCK: the mixer and the input stream then
+            // transfer one period at a time and wait for the device with poll()
+            bool            isNonBlocking() const { return mNonBlocking; }
 protected:
     virtual status_t        dump(int fd, const Vector<String16>& args);
 
 private:
+    friend class AudioStreamOutGeneric;
+
+    class MixerThread : public Thread {
+    public:
+                            MixerThread(AudioHardwareGeneric *hw) : Thread(false), mHw(hw) {}
+    private:
+        virtual bool        threadLoop() { return mHw->mixPeriod(); }
+        AudioHardwareGeneric *mHw;
+    };
+
     status_t                dumpInternals(int fd, const Vector<String16>& args);
+    // mixes one period of the output streams and writes it to the device. Returns false to
+    // stop the mixer thread.
+            bool            mixPeriod();
+            status_t        writeDevice(const void* buffer, size_t bytes);
 
     Mutex                   mLock;
-    AudioStreamOutGeneric   *mOutput;
+    SortedVector<AudioStreamOutGeneric *> mOutputs;
     AudioStreamInGeneric    *mInput;
     int                     mFd;
     bool                    mMicMute;
+    bool                    mNonBlocking;
+
+    sp<MixerThread>         mMixer;
+    int16_t                 *mMixBuffer;    // one period, used by the mixer thread
+    int16_t                 *mStreamBuffer;
+    // mMixLock protects mOutputs and the stream states seen by the mixer, and the sleeps:
+    // audio goes through the stream rings without lock. Locked after mLock.
+    Mutex                   mMixLock;
+    Condition               mMixCond;       // audio queued or exit requested
+    Condition               mSpaceCond;     // a period was mixed or the rings are drained
+    bool                    mExit;
+    // written by the mixer thread only
+    uint32_t                mPartialWrites;
+    uint32_t                mWriteTimeouts;
 };
 
 // ----------------------------------------------------------------------------
@@ -58,6 +58,8 @@ public:
     virtual status_t    setParameters(const String8& keyValuePairs) { return NO_ERROR;}
     virtual String8     getParameters(const String8& keys);
     virtual unsigned int  getInputFramesLost() const { return 0; }
+    virtual status_t    addAudioEffect(effect_handle_t effect) { return INVALID_OPERATION; }
+    virtual status_t    removeAudioEffect(effect_handle_t effect) { return INVALID_OPERATION; }
 };
 
 class AudioHardwareStub : public  AudioHardwareBase
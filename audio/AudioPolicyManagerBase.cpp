@@ -28,11 +28,33 @@
 // active inputs in getActiveInput()
 #define APM_AUDIO_IN_DEVICE_VIRTUAL_ALL  AUDIO_DEVICE_IN_REMOTE_SUBMIX
 
+// File where the dynamic parameters of connected devices are kept across restarts
+#define AUDIO_POLICY_CAPABILITIES_FILE "/data/misc/audio/audio_policy_capabilities"
+// Key read from the HAL to tell apart devices connected without address, such as HDMI sinks.
+// The reply should identify the sink, e.g. with a hash of its EDID.
+#ifndef AUDIO_PARAMETER_DEVICE_SINK_ID
+#define AUDIO_PARAMETER_DEVICE_SINK_ID "sink_id"
+#endif
+// File where the connection, forced usage and volume state is kept across mediaserver restarts
+#define AUDIO_POLICY_STATE_FILE "/data/misc/audio/audio_policy_state"
+// Changes at each boot: the state saved during a previous boot is not restored
+#define BOOT_ID_FILE "/proc/sys/kernel/random/boot_id"
+
+// When set to true, music and TTS are played on the deep buffer output when the screen is off
+// or no latency sensitive stream is active
+#define DEEP_BUFFER_MEDIA_PROPERTY "ro.audio.deep_buffer_media"
+// System property carrying the screen state ("on" or "off"), see setSystemProperty()
+#define SCREEN_STATE_PROPERTY "screen_state"
+
 #include <utils/Log.h>
+#include <utils/threads.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
 #include <hardware_legacy/AudioPolicyManagerBase.h>
 #include <hardware/audio_effect.h>
 #include <hardware/audio.h>
 #include <math.h>
+#include <stdio.h>
 #include <hardware_legacy/audio_policy_conf.h>
 
 namespace android_audio_legacy {
@@ -46,7 +68,12 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
                                                   AudioSystem::device_connection_state state,
                                                   const char *device_address)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_SET_DEVICE_CONNECTION_STATE);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
+    applyCapabilitiesChecks();
+    checkRestoredDevices();
     SortedVector <audio_io_handle_t> outputs;
+    SortedVector <audio_io_handle_t> directProbes;
 
     ALOGV("setDeviceConnectionState() device: %x, state %d, address %s", device, state, device_address);
 
@@ -74,20 +101,35 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             return BAD_VALUE;
         }
 
-        // save a copy of the opened output descriptors before any output is opened or closed
+        // remember the opened outputs before any output is opened or closed
         // by checkOutputsForDevice(). This will be needed by checkOutputForAllStrategies()
-        mPreviousOutputs = mOutputs;
+        snapshotOutputs();
         switch (state)
         {
         // handle output device connection
-        case AudioSystem::DEVICE_STATE_AVAILABLE:
+        case AudioSystem::DEVICE_STATE_AVAILABLE: {
             if (mAvailableOutputDevices & device) {
+                // the framework sends again the connections made before mediaserver restarted:
+                // nothing to do for a device restored by restorePolicyState() with the same
+                // address. A restored device with another address is replaced.
+                if (mUnconfirmedDevices & device) {
+                    String8 restoredAddress = deviceAddress(device);
+                    mUnconfirmedDevices = (audio_devices_t)(mUnconfirmedDevices & ~device);
+                    if (strcmp(restoredAddress.string(), device_address) == 0) {
+                        ALOGV("setDeviceConnectionState() restored device %x confirmed", device);
+                        return NO_ERROR;
+                    }
+                    setDeviceConnectionState(device, AudioSystem::DEVICE_STATE_UNAVAILABLE,
+                                             restoredAddress.string());
+                    return setDeviceConnectionState(device, state, device_address);
+                }
                 ALOGW("setDeviceConnectionState() device already connected: %x", device);
                 return INVALID_OPERATION;
             }
             ALOGV("setDeviceConnectionState() connecting device %x", device);
 
-            if (checkOutputsForDevice(device, state, outputs) != NO_ERROR) {
+            if (checkOutputsForDevice(device, state, outputs, String8(device_address),
+                                      &directProbes) != NO_ERROR) {
                 return INVALID_OPERATION;
             }
             ALOGV("setDeviceConnectionState() checkOutputsForDevice() returned %d outputs",
@@ -95,32 +137,32 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             // register new device as available
             mAvailableOutputDevices = (audio_devices_t)(mAvailableOutputDevices | device);
 
-            if (!outputs.isEmpty()) {
-                String8 paramStr;
-                if (mHasA2dp && audio_is_a2dp_device(device)) {
-                    // handle A2DP device connection
-                    AudioParameter param;
-                    param.add(String8(AUDIO_PARAMETER_A2DP_SINK_ADDRESS), String8(device_address));
-                    paramStr = param.toString();
-                    mA2dpDeviceAddress = String8(device_address, MAX_DEVICE_ADDRESS_LEN);
-                    mA2dpSuspended = false;
-                } else if (audio_is_bluetooth_sco_device(device)) {
-                    // handle SCO device connection
-                    mScoDeviceAddress = String8(device_address, MAX_DEVICE_ADDRESS_LEN);
-                } else if (mHasUsb && audio_is_usb_device(device)) {
-                    // handle USB device connection
-                    mUsbCardAndDevice = String8(device_address, MAX_DEVICE_ADDRESS_LEN);
-                    paramStr = mUsbCardAndDevice;
-                }
-                // not currently handling multiple simultaneous submixes: ignoring remote submix
-                //   case and address
-                if (!paramStr.isEmpty()) {
-                    for (size_t i = 0; i < outputs.size(); i++) {
-                        mpClientInterface->setParameters(outputs[i], paramStr);
-                    }
+            // the addresses are also recorded when all the outputs for the device are opened
+            // later by getOutput() (capabilities loaded from the cache)
+            String8 paramStr;
+            if (mHasA2dp && audio_is_a2dp_device(device)) {
+                // handle A2DP device connection
+                AudioParameter param;
+                param.add(String8(AUDIO_PARAMETER_A2DP_SINK_ADDRESS), String8(device_address));
+                paramStr = param.toString();
+                mA2dpDeviceAddress = String8(device_address, MAX_DEVICE_ADDRESS_LEN);
+                mA2dpSuspended = false;
+            } else if (audio_is_bluetooth_sco_device(device)) {
+                // handle SCO device connection
+                mScoDeviceAddress = String8(device_address, MAX_DEVICE_ADDRESS_LEN);
+            } else if (mHasUsb && audio_is_usb_device(device)) {
+                // handle USB device connection
+                mUsbCardAndDevice = String8(device_address, MAX_DEVICE_ADDRESS_LEN);
+                paramStr = mUsbCardAndDevice;
+            }
+            // not currently handling multiple simultaneous submixes: ignoring remote submix
+            //   case and address
+            if (!paramStr.isEmpty()) {
+                for (size_t i = 0; i < outputs.size(); i++) {
+                    mpClientInterface->setParameters(outputs[i], paramStr);
                 }
             }
-            break;
+            } break;
         // handle output device disconnection
         case AudioSystem::DEVICE_STATE_UNAVAILABLE: {
             if (!(mAvailableOutputDevices & device)) {
@@ -131,6 +173,7 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             ALOGV("setDeviceConnectionState() disconnecting device %x", device);
             // remove device from available output devices
             mAvailableOutputDevices = (audio_devices_t)(mAvailableOutputDevices & ~device);
+            mUnconfirmedDevices = (audio_devices_t)(mUnconfirmedDevices & ~device);
 
             checkOutputsForDevice(device, state, outputs);
             if (mHasA2dp && audio_is_a2dp_device(device)) {
@@ -158,14 +201,27 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
         // outputs must be closed after checkOutputForAllStrategies() is executed
         if (!outputs.isEmpty()) {
             for (size_t i = 0; i < outputs.size(); i++) {
-                // close unused outputs after device disconnection or direct outputs that have been
-                // opened by checkOutputsForDevice() to query dynamic parameters
-                if ((state == AudioSystem::DEVICE_STATE_UNAVAILABLE) ||
-                        (mOutputs.valueFor(outputs[i])->mFlags & AUDIO_OUTPUT_FLAG_DIRECT)) {
+                // close unused outputs after device disconnection. Direct outputs that have been
+                // opened by checkOutputsForDevice() to query dynamic parameters are kept open in
+                // the idle pool so that the first getOutput() request for the new device does not
+                // pay the cost of opening the stream, but only if the profile can have more than
+                // one stream open: otherwise the probe would block a request for another
+                // configuration. Direct outputs opened before the connection may have been
+                // returned by getOutput() and are left alone.
+                if (state == AudioSystem::DEVICE_STATE_UNAVAILABLE) {
                     closeOutput(outputs[i]);
+                } else if (directProbes.indexOf(outputs[i]) >= 0) {
+                    if (mOutputs.valueFor(outputs[i])->mProfile->mMaxOpenStreams > 1) {
+                        parkDirectOutput(outputs[i]);
+                    } else {
+                        closeOutput(outputs[i]);
+                    }
                 }
             }
         }
+        if (state == AudioSystem::DEVICE_STATE_UNAVAILABLE) {
+            closeIdleDirectOutputs(false);
+        }
 
         updateDevicesAndOutputs();
         for (size_t i = 0; i < mOutputs.size(); i++) {
@@ -182,6 +238,8 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
                    device == AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT) {
             device = AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET;
         } else {
+            mStateDirty = true;
+            savePolicyState(true);
             return NO_ERROR;
         }
     }
@@ -228,6 +286,8 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             }
         }
 
+        mStateDirty = true;
+        savePolicyState(true);
         return NO_ERROR;
     }
 
@@ -238,6 +298,7 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
 AudioSystem::device_connection_state AudioPolicyManagerBase::getDeviceConnectionState(audio_devices_t device,
                                                   const char *device_address)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_DEVICE_CONNECTION_STATE);
     AudioSystem::device_connection_state state = AudioSystem::DEVICE_STATE_UNAVAILABLE;
     String8 address = String8(device_address);
     if (audio_is_output_device(device)) {
@@ -271,6 +332,9 @@ AudioSystem::device_connection_state AudioPolicyManagerBase::getDeviceConnection
 
 void AudioPolicyManagerBase::setPhoneState(int state)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_SET_PHONE_STATE);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
+    checkRestoredDevices();
     ALOGV("setPhoneState() state %d", state);
     audio_devices_t newDevice = AUDIO_DEVICE_NONE;
     if (state < 0 || state >= AudioSystem::NUM_MODES) {
@@ -334,19 +398,19 @@ void AudioPolicyManagerBase::setPhoneState(int state)
     // tail into the earpiece or headset.
     int delayMs = 0;
     if (isStateInCall(state) && oldState == AudioSystem::MODE_RINGTONE) {
-        // delay the device change command by twice the output latency to have some margin
-        // and be sure that audio buffers not yet affected by the mute are out when
-        // we actually apply the route change
-        delayMs = hwOutputDesc->mLatency*2;
+        // delay the device change command until the audio buffers not yet affected by the
+        // mute are out, with some margin, before we actually apply the route change
+        delayMs = outputDrainWaitMs(hwOutputDesc, hwOutputDesc->latency() / 2);
         setStreamMute(AudioSystem::RING, true, mPrimaryOutput);
     }
 
     if (isStateInCall(state)) {
         for (size_t i = 0; i < mOutputs.size(); i++) {
             AudioOutputDescriptor *desc = mOutputs.valueAt(i);
-            //take the biggest latency for all outputs
-            if (delayMs < desc->mLatency*2) {
-                delayMs = desc->mLatency*2;
+            //take the biggest drain time for all outputs
+            uint32_t drainMs = outputDrainWaitMs(desc, desc->latency() / 2);
+            if (delayMs < (int)drainMs) {
+                delayMs = drainMs;
             }
             //mute STRATEGY_MEDIA on all outputs
             if (desc->strategyRefCount(STRATEGY_MEDIA) != 0) {
@@ -381,12 +445,31 @@ void AudioPolicyManagerBase::setPhoneState(int state)
     } else {
         mLimitRingtoneVolume = false;
     }
+
+    // media steered to the deep buffer output must come back if a call starts, and may go
+    // again when it ends
+    if (isStateInCall(state)) {
+        checkMediaDeepBufferPlacement(false);
+    } else if (isStateInCall(oldState)) {
+        checkMediaDeepBufferPlacement(true);
+    }
+
+    mStateDirty = true;
+    savePolicyState(true);
 }
 
 void AudioPolicyManagerBase::setForceUse(AudioSystem::force_use usage, AudioSystem::forced_config config)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_SET_FORCE_USE);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
     ALOGV("setForceUse() usage %d, config %d, mPhoneState %d", usage, config, mPhoneState);
 
+    // the framework sends again the forced usages restored by restorePolicyState()
+    if (isRestoringState() && usage >= 0 && usage < AudioSystem::NUM_FORCE_USE &&
+            mForceUse[usage] == config) {
+        return;
+    }
+
     bool forceVolumeReeval = false;
     switch(usage) {
     case AudioSystem::FOR_COMMUNICATION:
@@ -468,16 +551,29 @@ void AudioPolicyManagerBase::setForceUse(AudioSystem::force_use usage, AudioSyst
         }
     }
 
+    mStateDirty = true;
+    savePolicyState(true);
 }
 
 AudioSystem::forced_config AudioPolicyManagerBase::getForceUse(AudioSystem::force_use usage)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_FORCE_USE);
     return mForceUse[usage];
 }
 
 void AudioPolicyManagerBase::setSystemProperty(const char* property, const char* value)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_SET_SYSTEM_PROPERTY);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
     ALOGV("setSystemProperty() property %s, value %s", property, value);
+
+    if (strcmp(property, SCREEN_STATE_PROPERTY) == 0) {
+        bool screenOn = (strcmp(value, "off") != 0);
+        if (screenOn != mScreenOn) {
+            mScreenOn = screenOn;
+            checkMediaDeepBufferPlacement(!screenOn);
+        }
+    }
 }
 
 AudioPolicyManagerBase::IOProfile *AudioPolicyManagerBase::getProfileForDirectOutput(
@@ -516,6 +612,9 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
                                     uint32_t channelMask,
                                     AudioSystem::output_flags flags)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_OUTPUT);
+    applyCapabilitiesChecks();
+    checkRestoredDevices();
     audio_io_handle_t output = 0;
     uint32_t latency = 0;
     routing_strategy strategy = getStrategy((AudioSystem::stream_type)stream);
@@ -563,30 +662,51 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
 
     if (profile != NULL) {
 
+        AudioOutputDescriptor *outputDesc = takeIdleDirectOutput(profile,
+                                                samplingRate,
+                                                format,
+                                                channelMask,
+                                                (audio_output_flags_t)(flags | AUDIO_OUTPUT_FLAG_DIRECT));
+        if (outputDesc != NULL) {
+            output = outputDesc->mId;
+            verifyCachedCapabilities(profile, output);
+            addOutput(output, outputDesc);
+            if (outputDesc->mDevice != device) {
+                setOutputDevice(output, device, true);
+            }
+            ALOGV("getOutput() returns idle direct output %d", output);
+            return output;
+        }
+
         ALOGV("getOutput() opening direct output device %x", device);
 
-        AudioOutputDescriptor *outputDesc = new AudioOutputDescriptor(profile);
-        outputDesc->mDevice = device;
-        outputDesc->mSamplingRate = samplingRate;
-        outputDesc->mFormat = (audio_format_t)format;
-        outputDesc->mChannelMask = (audio_channel_mask_t)channelMask;
-        outputDesc->mLatency = 0;
-        outputDesc->mFlags = (audio_output_flags_t)(flags | AUDIO_OUTPUT_FLAG_DIRECT);;
-        outputDesc->mRefCount[stream] = 0;
-        outputDesc->mStopTime[stream] = 0;
-        output = mpClientInterface->openOutput(profile->mModule->mHandle,
-                                        &outputDesc->mDevice,
-                                        &outputDesc->mSamplingRate,
-                                        &outputDesc->mFormat,
-                                        &outputDesc->mChannelMask,
-                                        &outputDesc->mLatency,
-                                        outputDesc->mFlags);
-
-        // only accept an output with the requested parameters
-        if (output == 0 ||
-            (samplingRate != 0 && samplingRate != outputDesc->mSamplingRate) ||
-            (format != 0 && format != outputDesc->mFormat) ||
-            (channelMask != 0 && channelMask != outputDesc->mChannelMask)) {
+        // the HAL may not be able to open a stream while an idle output of the same profile
+        // holds the hardware: close them and try once more if the first attempt fails
+        for (bool evicted = false; ; evicted = true) {
+            outputDesc = new AudioOutputDescriptor(profile);
+            outputDesc->mDevice = device;
+            outputDesc->mSamplingRate = samplingRate;
+            outputDesc->mFormat = (audio_format_t)format;
+            outputDesc->mChannelMask = (audio_channel_mask_t)channelMask;
+            outputDesc->mLatency = 0;
+            outputDesc->mFlags = (audio_output_flags_t)(flags | AUDIO_OUTPUT_FLAG_DIRECT);;
+            outputDesc->mRefCount[stream] = 0;
+            outputDesc->mStopTime[stream] = 0;
+            output = mpClientInterface->openOutput(profile->mModule->mHandle,
+                                            &outputDesc->mDevice,
+                                            &outputDesc->mSamplingRate,
+                                            &outputDesc->mFormat,
+                                            &outputDesc->mChannelMask,
+                                            &outputDesc->mLatency,
+                                            outputDesc->mFlags);
+
+            // only accept an output with the requested parameters
+            if (output != 0 &&
+                (samplingRate == 0 || samplingRate == outputDesc->mSamplingRate) &&
+                (format == 0 || format == outputDesc->mFormat) &&
+                (channelMask == 0 || channelMask == outputDesc->mChannelMask)) {
+                break;
+            }
             ALOGV("getOutput() failed opening direct output: output %d samplingRate %d %d,"
                     "format %d %d, channelMask %04x %04x", output, samplingRate,
                     outputDesc->mSamplingRate, format, outputDesc->mFormat, channelMask,
@@ -595,8 +715,12 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
                 mpClientInterface->closeOutput(output);
             }
             delete outputDesc;
-            return 0;
+            if (evicted || evictIdleDirectOutputs(profile) == 0) {
+                verifyCachedCapabilities(profile, 0);
+                return 0;
+            }
         }
+        verifyCachedCapabilities(profile, output);
         addOutput(output, outputDesc);
         ALOGV("getOutput() returns direct output %d", output);
         return output;
@@ -610,8 +734,22 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
     // when startOutput() will be called
     SortedVector<audio_io_handle_t> outputs = getOutputsForDevice(device, mOutputs);
 
+    bool steered = false;
+    if ((stream == AudioSystem::MUSIC || stream == AudioSystem::TTS) &&
+            !(flags & (AUDIO_OUTPUT_FLAG_FAST | AUDIO_OUTPUT_FLAG_DEEP_BUFFER)) &&
+            mediaPrefersDeepBuffer()) {
+        flags = (AudioSystem::output_flags)(flags | AUDIO_OUTPUT_FLAG_DEEP_BUFFER);
+        steered = true;
+    }
+
     output = selectOutput(outputs, flags);
 
+    if (steered && output != 0 &&
+            (mOutputs.valueFor(output)->mFlags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER)) {
+        ALOGV("getOutput() stream %d steered to deep buffer output %d", stream, output);
+        mMediaSteeredToDeepBuffer = true;
+    }
+
     ALOGW_IF((output ==0), "getOutput() could not find output for stream %d, samplingRate %d,"
             "format %d, channels %x, flags %x", stream, samplingRate, format, channelMask, flags);
 
@@ -626,7 +764,9 @@ audio_io_handle_t AudioPolicyManagerBase::selectOutput(const SortedVector<audio_
     // select one output among several that provide a path to a particular device or set of
     // devices (the list was previously build by getOutputsForDevice()).
     // The priority is as follows:
-    // 1: the output with the highest number of requested policy flags
+    // 1: the output with the highest number of requested policy flags. If several outputs
+    //    share the same number of requested flags, the one with the shortest estimated time
+    //    to play (see outputTimeToPlay()) and then the primary output
     // 2: the primary output
     // 3: the first output in the list
 
@@ -640,17 +780,26 @@ audio_io_handle_t AudioPolicyManagerBase::selectOutput(const SortedVector<audio_
     int maxCommonFlags = 0;
     audio_io_handle_t outputFlags = 0;
     audio_io_handle_t outputPrimary = 0;
+    uint32_t minTimeToPlay = 0;
 
     for (size_t i = 0; i < outputs.size(); i++) {
         AudioOutputDescriptor *outputDesc = mOutputs.valueFor(outputs[i]);
         if (!outputDesc->isDuplicated()) {
+            bool isPrimary = (outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_PRIMARY) != 0;
             int commonFlags = (int)AudioSystem::popCount(outputDesc->mProfile->mFlags & flags);
-            if (commonFlags > maxCommonFlags) {
-                outputFlags = outputs[i];
-                maxCommonFlags = commonFlags;
-                ALOGV("selectOutput() commonFlags for output %d, %04x", outputs[i], commonFlags);
+            if (commonFlags != 0 && commonFlags >= maxCommonFlags) {
+                uint32_t timeToPlay = outputTimeToPlay(outputDesc);
+                if (commonFlags > maxCommonFlags ||
+                        timeToPlay < minTimeToPlay ||
+                        (timeToPlay == minTimeToPlay && isPrimary)) {
+                    outputFlags = outputs[i];
+                    maxCommonFlags = commonFlags;
+                    minTimeToPlay = timeToPlay;
+                    ALOGV("selectOutput() commonFlags for output %d, %04x time to play %d ms",
+                          outputs[i], commonFlags, timeToPlay);
+                }
             }
-            if (outputDesc->mProfile->mFlags & AUDIO_OUTPUT_FLAG_PRIMARY) {
+            if (isPrimary) {
                 outputPrimary = outputs[i];
             }
         }
@@ -666,10 +815,78 @@ audio_io_handle_t AudioPolicyManagerBase::selectOutput(const SortedVector<audio_
     return outputs[0];
 }
 
+void AudioPolicyManagerBase::sleepMs(uint32_t delayMs)
+{
+    // muted audio must reach the HAL before waiting for it to drain
+    mTransactionClient.flush();
+    mStats.increment(AudioPolicyStats::COUNTER_SLEEPS);
+    mStats.increment(AudioPolicyStats::COUNTER_SLEEP_MS, delayMs);
+    mClock->sleepUs(delayMs * 1000);
+}
+
+int32_t AudioPolicyManagerBase::queryDrainTimeMs(AudioOutputDescriptor *outputDesc)
+{
+    if (outputDesc->isDuplicated()) {
+        int32_t drainMs1 = queryDrainTimeMs(outputDesc->mOutput1);
+        int32_t drainMs2 = queryDrainTimeMs(outputDesc->mOutput2);
+        if (drainMs1 < 0 || drainMs2 < 0) {
+            return -1;
+        }
+        return (drainMs1 > drainMs2) ? drainMs1 : drainMs2;
+    }
+    if (!outputDesc->mDrainTimeSupported) {
+        return -1;
+    }
+    // the mute and routing functions query the same outputs several times in a row
+    nsecs_t now = mClock->now();
+    int32_t elapsedMs = (int32_t)ns2ms(now - outputDesc->mDrainTimeQueried);
+    if (outputDesc->mDrainTimeQueried != 0 && elapsedMs < OUTPUT_DRAIN_TIME_CACHE_MS) {
+        return (outputDesc->mDrainTimeMs > elapsedMs) ? outputDesc->mDrainTimeMs - elapsedMs : 0;
+    }
+
+    AudioParameter reply = AudioParameter(mpClientInterface->getParameters(outputDesc->mId,
+                                                String8(AUDIO_PARAMETER_STREAM_DRAIN_MS)));
+    int drainMs;
+    if (reply.getInt(String8(AUDIO_PARAMETER_STREAM_DRAIN_MS), drainMs) != NO_ERROR ||
+            drainMs < 0) {
+        ALOGV("queryDrainTimeMs() output %d does not report its drain time", outputDesc->mId);
+        outputDesc->mDrainTimeSupported = false;
+        return -1;
+    }
+    outputDesc->mDrainTimeMs = drainMs;
+    outputDesc->mDrainTimeQueried = now;
+    return drainMs;
+}
+
+uint32_t AudioPolicyManagerBase::outputDrainWaitMs(AudioOutputDescriptor *outputDesc,
+                                                   uint32_t marginMs)
+{
+    uint32_t maxWaitMs = outputDesc->latency() * 2;
+    int32_t drainMs = queryDrainTimeMs(outputDesc);
+    if (drainMs < 0 || (uint32_t)drainMs + marginMs > maxWaitMs) {
+        return maxWaitMs;
+    }
+    return drainMs + marginMs;
+}
+
+uint32_t AudioPolicyManagerBase::outputTimeToPlay(AudioOutputDescriptor *outputDesc)
+{
+    // an output in standby must be restarted before the first buffer reaches the device: this
+    // also avoids waking up an idle hardware path when an active one can take the stream
+    uint32_t timeToPlay = outputDesc->latency();
+    if (!outputDesc->isActive(OUTPUT_STANDBY_DELAY_MS, mClock->now())) {
+        timeToPlay += OUTPUT_WAKEUP_TIME_MS;
+    }
+    timeToPlay += outputDesc->refCount() * OUTPUT_ACTIVE_STREAM_TIME_MS;
+    return timeToPlay;
+}
+
 status_t AudioPolicyManagerBase::startOutput(audio_io_handle_t output,
                                              AudioSystem::stream_type stream,
                                              int session)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_START_OUTPUT);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
     ALOGV("startOutput() output %d, stream %d, session %d", output, stream, session);
     ssize_t index = mOutputs.indexOfKey(output);
     if (index < 0) {
@@ -704,8 +921,11 @@ status_t AudioPolicyManagerBase::startOutput(audio_io_handle_t output,
                 }
                 // wait for audio on other active outputs to be presented when starting
                 // a notification so that audio focus effect can propagate.
-                if (shouldWait && (desc->refCount() != 0) && (waitMs < desc->latency())) {
-                    waitMs = desc->latency();
+                if (shouldWait && (desc->refCount() != 0)) {
+                    uint32_t drainMs = outputDrainWaitMs(desc, desc->latency() / 2);
+                    if (waitMs < drainMs) {
+                        waitMs = drainMs;
+                    }
                 }
             }
         }
@@ -716,6 +936,8 @@ status_t AudioPolicyManagerBase::startOutput(audio_io_handle_t output,
             handleIncallSonification(stream, true, false);
         }
 
+        checkMediaDeepBufferPlacement(false);
+
         // apply volume rules for current stream and device if necessary
         checkAndSetVolume(stream,
                           mStreams[stream].getVolumeIndex(newDevice),
@@ -726,7 +948,7 @@ status_t AudioPolicyManagerBase::startOutput(audio_io_handle_t output,
         // routing
         handleNotificationRoutingForStream(stream);
         if (waitMs > muteWaitMs) {
-            usleep((waitMs - muteWaitMs) * 2 * 1000);
+            sleepMs(waitMs - muteWaitMs);
         }
     }
     return NO_ERROR;
@@ -737,6 +959,8 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
                                             AudioSystem::stream_type stream,
                                             int session)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_STOP_OUTPUT);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
     ALOGV("stopOutput() output %d, stream %d, session %d", output, stream, session);
     ssize_t index = mOutputs.indexOfKey(output);
     if (index < 0) {
@@ -756,14 +980,16 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
         outputDesc->changeRefCount(stream, -1);
         // store time at which the stream was stopped - see isStreamActive()
         if (outputDesc->mRefCount[stream] == 0) {
-            outputDesc->mStopTime[stream] = systemTime();
+            outputDesc->mStopTime[stream] = mClock->now();
             audio_devices_t newDevice = getNewDevice(output, false /*fromCache*/);
-            // delay the device switch by twice the latency because stopOutput() is executed when
-            // the track stop() command is received and at that time the audio track buffer can
-            // still contain data that needs to be drained. The latency only covers the audio HAL
-            // and kernel buffers. Also the latency does not always include additional delay in the
-            // audio path (audio DSP, CODEC ...)
-            setOutputDevice(output, newDevice, false, outputDesc->mLatency*2);
+            // delay the device switch until the audio buffered in the HAL is played, plus one
+            // latency because stopOutput() is executed when the track stop() command is received
+            // and at that time the audio track buffer can still contain data that needs to be
+            // drained. The HAL drain time does not always include additional delay in the
+            // audio path (audio DSP, CODEC ...): never wait less than twice the latency if it is
+            // not reported.
+            uint32_t delayMs = outputDrainWaitMs(outputDesc, outputDesc->latency());
+            setOutputDevice(output, newDevice, false, delayMs);
 
             // force restoring the device selection on other active outputs if it differs from the
             // one being selected for this output
@@ -777,7 +1003,7 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
                     setOutputDevice(curOutput,
                                     getNewDevice(curOutput, false /*fromCache*/),
                                     true,
-                                    outputDesc->mLatency*2);
+                                    delayMs);
                 }
             }
             // update the outputs if stopping one with a stream that can affect notification routing
@@ -792,6 +1018,7 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
 
 void AudioPolicyManagerBase::releaseOutput(audio_io_handle_t output)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_RELEASE_OUTPUT);
     ALOGV("releaseOutput() %d", output);
     ssize_t index = mOutputs.indexOfKey(output);
     if (index < 0) {
@@ -805,19 +1032,27 @@ void AudioPolicyManagerBase::releaseOutput(audio_io_handle_t output)
         AudioOutputDescriptor *outputDesc = mOutputs.valueAt(index);
         if (outputDesc->refCount() == 0) {
             mpClientInterface->closeOutput(output);
-            delete mOutputs.valueAt(index);
-            mOutputs.removeItem(output);
+            removeOutput(output);
+            delete outputDesc;
             mTestOutputs[testIndex] = 0;
         }
         return;
     }
 #endif //AUDIO_POLICY_TEST
 
-    if (mOutputs.valueAt(index)->mFlags & AudioSystem::OUTPUT_FLAG_DIRECT) {
-        mpClientInterface->closeOutput(output);
-        delete mOutputs.valueAt(index);
-        mOutputs.removeItem(output);
-        mPreviousOutputs = mOutputs;
+    AudioOutputDescriptor *outputDesc = mOutputs.valueAt(index);
+    if (outputDesc->mFlags & AudioSystem::OUTPUT_FLAG_DIRECT) {
+        // keep the output open for a later request with the same configuration if it can still
+        // be routed to an available device
+        if (outputDesc->refCount() == 0 &&
+                (outputDesc->mProfile->mSupportedDevices & mAvailableOutputDevices)) {
+            parkDirectOutput(output);
+        } else {
+            mpClientInterface->closeOutput(output);
+            removeOutput(output);
+            delete outputDesc;
+        }
+        snapshotOutputs();
     }
 
 }
@@ -828,6 +1063,7 @@ audio_io_handle_t AudioPolicyManagerBase::getInput(int inputSource,
                                     uint32_t channelMask,
                                     AudioSystem::audio_in_acoustics acoustics)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_INPUT);
     audio_io_handle_t input = 0;
     audio_devices_t device = getDeviceForInputSource(inputSource);
 
@@ -903,6 +1139,8 @@ audio_io_handle_t AudioPolicyManagerBase::getInput(int inputSource,
 
 status_t AudioPolicyManagerBase::startInput(audio_io_handle_t input)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_START_INPUT);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
     ALOGV("startInput() input %d", input);
     ssize_t index = mInputs.indexOfKey(input);
     if (index < 0) {
@@ -936,6 +1174,8 @@ status_t AudioPolicyManagerBase::startInput(audio_io_handle_t input)
 
 status_t AudioPolicyManagerBase::stopInput(audio_io_handle_t input)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_STOP_INPUT);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
     ALOGV("stopInput() input %d", input);
     ssize_t index = mInputs.indexOfKey(input);
     if (index < 0) {
@@ -958,6 +1198,7 @@ status_t AudioPolicyManagerBase::stopInput(audio_io_handle_t input)
 
 void AudioPolicyManagerBase::releaseInput(audio_io_handle_t input)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_RELEASE_INPUT);
     ALOGV("releaseInput() %d", input);
     ssize_t index = mInputs.indexOfKey(input);
     if (index < 0) {
@@ -974,19 +1215,27 @@ void AudioPolicyManagerBase::initStreamVolume(AudioSystem::stream_type stream,
                                             int indexMin,
                                             int indexMax)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_INIT_STREAM_VOLUME);
     ALOGV("initStreamVolume() stream %d, min %d, max %d", stream , indexMin, indexMax);
     if (indexMin < 0 || indexMin >= indexMax) {
         ALOGW("initStreamVolume() invalid index limits for stream %d, min %d, max %d", stream , indexMin, indexMax);
         return;
     }
+    if (mStreams[stream].mIndexMin == indexMin && mStreams[stream].mIndexMax == indexMax) {
+        return;
+    }
     mStreams[stream].mIndexMin = indexMin;
     mStreams[stream].mIndexMax = indexMax;
+    mStateDirty = true;
+    savePolicyState(false);
 }
 
 status_t AudioPolicyManagerBase::setStreamVolumeIndex(AudioSystem::stream_type stream,
                                                       int index,
                                                       audio_devices_t device)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_SET_STREAM_VOLUME_INDEX);
+    AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
 
     if ((index < mStreams[stream].mIndexMin) || (index > mStreams[stream].mIndexMax)) {
         return BAD_VALUE;
@@ -1001,12 +1250,25 @@ status_t AudioPolicyManagerBase::setStreamVolumeIndex(AudioSystem::stream_type s
     ALOGV("setStreamVolumeIndex() stream %d, device %04x, index %d",
           stream, device, index);
 
+    // the framework sends again the volumes restored by restorePolicyState(): they are
+    // already applied
+    if (isRestoringState()) {
+        ssize_t curIndex = mStreams[stream].mIndexCur.indexOfKey(device);
+        if (curIndex >= 0 && mStreams[stream].mIndexCur.valueAt(curIndex) == index) {
+            return NO_ERROR;
+        }
+    }
+
     // if device is AUDIO_DEVICE_OUT_DEFAULT set default value and
     // clear all device specific values
     if (device == AUDIO_DEVICE_OUT_DEFAULT) {
         mStreams[stream].mIndexCur.clear();
     }
     mStreams[stream].mIndexCur.add(device, index);
+    // volume changes come in bursts while the user moves the slider: the write is throttled
+    // and the last index is written by a later call or when the policy manager is destroyed
+    mStateDirty = true;
+    savePolicyState(false);
 
     // compute and apply stream volume on all outputs according to connected device
     status_t status = NO_ERROR;
@@ -1030,6 +1292,7 @@ status_t AudioPolicyManagerBase::getStreamVolumeIndex(AudioSystem::stream_type s
                                                       int *index,
                                                       audio_devices_t device)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_STREAM_VOLUME_INDEX);
     if (index == NULL) {
         return BAD_VALUE;
     }
@@ -1054,6 +1317,7 @@ status_t AudioPolicyManagerBase::getStreamVolumeIndex(AudioSystem::stream_type s
 
 audio_io_handle_t AudioPolicyManagerBase::getOutputForEffect(const effect_descriptor_t *desc)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_OUTPUT_FOR_EFFECT);
     ALOGV("getOutputForEffect()");
     // apply simple rule where global effects are attached to the same output as MUSIC streams
 
@@ -1076,6 +1340,7 @@ status_t AudioPolicyManagerBase::registerEffect(const effect_descriptor_t *desc,
                                 int session,
                                 int id)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_REGISTER_EFFECT);
     ssize_t index = mOutputs.indexOfKey(io);
     if (index < 0) {
         index = mInputs.indexOfKey(io);
@@ -1109,6 +1374,7 @@ status_t AudioPolicyManagerBase::registerEffect(const effect_descriptor_t *desc,
 
 status_t AudioPolicyManagerBase::unregisterEffect(int id)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_UNREGISTER_EFFECT);
     ssize_t index = mEffects.indexOfKey(id);
     if (index < 0) {
         ALOGW("unregisterEffect() unknown effect ID %d", id);
@@ -1136,6 +1402,7 @@ status_t AudioPolicyManagerBase::unregisterEffect(int id)
 
 status_t AudioPolicyManagerBase::setEffectEnabled(int id, bool enabled)
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_SET_EFFECT_ENABLED);
     ssize_t index = mEffects.indexOfKey(id);
     if (index < 0) {
         ALOGW("unregisterEffect() unknown effect ID %d", id);
@@ -1176,7 +1443,13 @@ status_t AudioPolicyManagerBase::setEffectEnabled(EffectDescriptor *pDesc, bool
 
 bool AudioPolicyManagerBase::isStreamActive(int stream, uint32_t inPastMs) const
 {
-    nsecs_t sysTime = systemTime();
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_IS_STREAM_ACTIVE);
+    nsecs_t sysTime = mClock->now();
+    // all outputs have a slot in the stream state table unless more than MAX_OUTPUT_SLOTS are
+    // open
+    if (mStreamTable.slotCount() == mOutputs.size()) {
+        return mStreamTable.isStreamActive(stream, inPastMs, sysTime);
+    }
     for (size_t i = 0; i < mOutputs.size(); i++) {
         if (mOutputs.valueAt(i)->mRefCount[stream] != 0 ||
             ns2ms(sysTime - mOutputs.valueAt(i)->mStopTime[stream]) < inPastMs) {
@@ -1188,6 +1461,7 @@ bool AudioPolicyManagerBase::isStreamActive(int stream, uint32_t inPastMs) const
 
 bool AudioPolicyManagerBase::isSourceActive(audio_source_t source) const
 {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_IS_SOURCE_ACTIVE);
     for (size_t i = 0; i < mInputs.size(); i++) {
         const AudioInputDescriptor * inputDescriptor = mInputs.valueAt(i);
         if ((inputDescriptor->mInputSource == (int) source)
@@ -1233,6 +1507,12 @@ status_t AudioPolicyManagerBase::dump(int fd)
     result.append(buffer);
     snprintf(buffer, SIZE, " Force use for system %d\n", mForceUse[AudioSystem::FOR_SYSTEM]);
     result.append(buffer);
+    snprintf(buffer, SIZE, " Deep buffer media: %s, screen %s\n",
+             mDeepBufferPowerMode ? (mMediaSteeredToDeepBuffer ? "steered" : "enabled") : "disabled",
+             mScreenOn ? "on" : "off");
+    result.append(buffer);
+    snprintf(buffer, SIZE, " Coalesced HAL commands: %u\n", mTransactionClient.coalescedCount());
+    result.append(buffer);
     write(fd, result.string(), result.size());
 
 
@@ -1252,6 +1532,26 @@ status_t AudioPolicyManagerBase::dump(int fd)
         mOutputs.valueAt(i)->dump(fd);
     }
 
+    snprintf(buffer, SIZE, "\nIdle direct outputs dump:\n");
+    write(fd, buffer, strlen(buffer));
+    for (size_t i = 0; i < mIdleDirectOutputs.size(); i++) {
+        snprintf(buffer, SIZE, "- Output %d dump:\n", mIdleDirectOutputs[i]->mId);
+        write(fd, buffer, strlen(buffer));
+        mIdleDirectOutputs[i]->dump(fd);
+    }
+
+    snprintf(buffer, SIZE, "\nDevice capabilities cache:\n");
+    write(fd, buffer, strlen(buffer));
+    for (size_t i = 0; i < mCapabilitiesCache.size(); i++) {
+        const DeviceCapabilities& caps = mCapabilitiesCache.valueAt(i);
+        String8 entry;
+        entry.appendFormat("- %s%s\n  %s\n  %s\n  %s\n", mCapabilitiesCache.keyAt(i).string(),
+                           caps.mVerified ? "" : " (not verified)",
+                           caps.mSupSamplingRates.string(), caps.mSupFormats.string(),
+                           caps.mSupChannels.string());
+        write(fd, entry.string(), entry.size());
+    }
+
     snprintf(buffer, SIZE, "\nInputs dump:\n");
     write(fd, buffer, strlen(buffer));
     for (size_t i = 0; i < mInputs.size(); i++) {
@@ -1283,27 +1583,57 @@ status_t AudioPolicyManagerBase::dump(int fd)
         mEffects.valueAt(i)->dump(fd);
     }
 
+    mStats.dump(fd);
+    // same values on one line for tools parsing the dump: the audio_policy HAL has no
+    // get_parameters() and passes no dump arguments, dumpsys is the only way out.
+    String8 statistics("\nStatistics: ");
+    statistics.append(getStatistics());
+    statistics.append("\n");
+    write(fd, statistics.string(), statistics.size());
+    mRoutingTrace.dump(fd);
 
     return NO_ERROR;
 }
 
+String8 AudioPolicyManagerBase::getStatistics() const
+{
+    return mStats.toString();
+}
+
 // ----------------------------------------------------------------------------
 // AudioPolicyManagerBase
 // ----------------------------------------------------------------------------
 
-AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface)
+// time source used when none is given to the constructor
+static AudioPolicySystemClock sSystemClock;
+
+AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface,
+                                               AudioPolicyClock *clock)
     :
 #ifdef AUDIO_POLICY_TEST
     Thread(false),
 #endif //AUDIO_POLICY_TEST
+    mStatsClient(clientInterface, &mStats),
+    mTransactionClient(&mStatsClient),
+    mWorker(clientInterface),
     mPrimaryOutput((audio_io_handle_t)0),
+    mOutputsGeneration(0), mPreviousOutputsGeneration(0), mRetiredOutputCount(0),
     mAvailableOutputDevices(AUDIO_DEVICE_NONE),
     mPhoneState(AudioSystem::MODE_NORMAL),
     mLimitRingtoneVolume(false), mLastVoiceVolume(-1.0f),
     mTotalEffectsCpuLoad(0), mTotalEffectsMemory(0),
-    mA2dpSuspended(false), mHasA2dp(false), mHasUsb(false), mHasRemoteSubmix(false)
+    mA2dpSuspended(false), mHasA2dp(false), mHasUsb(false), mHasRemoteSubmix(false),
+    mCapabilitiesUseCount(0),
+    mStateDirty(false), mRestoringState(false), mStateSaveTime(0), mRestoreTime(0),
+    mUnconfirmedDevices(AUDIO_DEVICE_NONE),
+    mDeepBufferPowerMode(false), mScreenOn(true), mMediaSteeredToDeepBuffer(false)
 {
-    mpClientInterface = clientInterface;
+    mpClientInterface = &mTransactionClient;
+    mClock = (clock != NULL) ? clock : &sSystemClock;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get(DEEP_BUFFER_MEDIA_PROPERTY, value, "0");
+    mDeepBufferPowerMode = (strcmp(value, "1") == 0) || (strcasecmp(value, "true") == 0);
 
     for (int i = 0; i < AudioSystem::NUM_FORCE_USE; i++) {
         mForceUse[i] = AudioSystem::FORCE_NONE;
@@ -1321,6 +1651,7 @@ AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clien
             defaultAudioPolicyConfig();
         }
     }
+    loadCapabilitiesCache();
 
     // open all output streams needed to access attached devices
     for (size_t i = 0; i < mHwModules.size(); i++) {
@@ -1377,6 +1708,10 @@ AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clien
     ALOGE_IF((mPrimaryOutput == 0), "Failed to open primary output");
 
     updateDevicesAndOutputs();
+#ifdef AUDIO_POLICY_PERSIST_STATE
+    mBootId = currentBootId();
+#endif //AUDIO_POLICY_PERSIST_STATE
+    restorePolicyState();
 
 #ifdef AUDIO_POLICY_TEST
     if (mPrimaryOutput != 0) {
@@ -1408,10 +1743,12 @@ AudioPolicyManagerBase::~AudioPolicyManagerBase()
 #ifdef AUDIO_POLICY_TEST
     exit();
 #endif //AUDIO_POLICY_TEST
+   savePolicyState(true);
    for (size_t i = 0; i < mOutputs.size(); i++) {
         mpClientInterface->closeOutput(mOutputs.keyAt(i));
         delete mOutputs.valueAt(i);
    }
+   closeIdleDirectOutputs(true);
    for (size_t i = 0; i < mInputs.size(); i++) {
         mpClientInterface->closeInput(mInputs.keyAt(i));
         delete mInputs.valueAt(i);
@@ -1527,8 +1864,9 @@ bool AudioPolicyManagerBase::threadLoop()
 
                 audio_module_handle_t moduleHandle = outputDesc->mModule->mHandle;
 
-                delete mOutputs.valueFor(mPrimaryOutput);
-                mOutputs.removeItem(mPrimaryOutput);
+                AudioOutputDescriptor *primaryDesc = mOutputs.valueFor(mPrimaryOutput);
+                removeOutput(mPrimaryOutput);
+                delete primaryDesc;
 
                 AudioOutputDescriptor *outputDesc = new AudioOutputDescriptor(NULL);
                 outputDesc->mDevice = AUDIO_DEVICE_OUT_SPEAKER;
@@ -1581,13 +1919,47 @@ int AudioPolicyManagerBase::testOutputIndex(audio_io_handle_t output)
 void AudioPolicyManagerBase::addOutput(audio_io_handle_t id, AudioOutputDescriptor *outputDesc)
 {
     outputDesc->mId = id;
+    outputDesc->mOpenGeneration = ++mOutputsGeneration;
     mOutputs.add(id, outputDesc);
+    outputDesc->attach(&mStreamTable);
+}
+
+void AudioPolicyManagerBase::removeOutput(audio_io_handle_t id)
+{
+    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(id);
+    if (outputDesc == NULL) {
+        return;
+    }
+    // keep what getPreviousOutputsForDevice() needs from outputs listed in the previous outputs
+    if (outputDesc->mOpenGeneration <= mPreviousOutputsGeneration) {
+        if (mRetiredOutputCount == MAX_OUTPUT_SLOTS) {
+            ALOGW("removeOutput() too many outputs closed, forgetting output %d",
+                  mRetiredOutputs[0].mId);
+            memmove(&mRetiredOutputs[0], &mRetiredOutputs[1],
+                    (MAX_OUTPUT_SLOTS - 1) * sizeof(RetiredOutput));
+            mRetiredOutputCount--;
+        }
+        mRetiredOutputs[mRetiredOutputCount].mId = id;
+        mRetiredOutputs[mRetiredOutputCount].mSupportedDevices = outputDesc->supportedDevices();
+        mRetiredOutputCount++;
+    }
+    outputDesc->detach();
+    mOutputs.removeItem(id);
+    mOutputsGeneration++;
+}
+
+void AudioPolicyManagerBase::snapshotOutputs()
+{
+    mPreviousOutputsGeneration = mOutputsGeneration;
+    mRetiredOutputCount = 0;
 }
 
 
 status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                                                        AudioSystem::device_connection_state state,
-                                                       SortedVector<audio_io_handle_t>& outputs)
+                                                       SortedVector<audio_io_handle_t>& outputs,
+                                                       const String8& address,
+                                                       SortedVector<audio_io_handle_t> *directProbes)
 {
     AudioOutputDescriptor *desc;
 
@@ -1621,6 +1993,9 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
             return BAD_VALUE;
         }
 
+        // devices connected without address are told apart by an identifier read from the HAL
+        String8 deviceId = capabilitiesDeviceId(device, address);
+
         // open outputs for matching profiles if needed. Direct outputs are also opened to
         // query for dynamic parameters and will be closed later by setDeviceConnectionState()
         for (ssize_t profile_index = 0; profile_index < (ssize_t)profiles.size(); profile_index++) {
@@ -1638,6 +2013,12 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                 continue;
             }
 
+            // no output is opened if the dynamic parameters are already known: they are checked
+            // in the background when getOutput() first opens an output from this profile
+            if (loadCachedCapabilities(profile, device, deviceId)) {
+                continue;
+            }
+
             ALOGV("opening output for device %08x", device);
             desc = new AudioOutputDescriptor(profile);
             desc->mDevice = device;
@@ -1658,48 +2039,25 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
 #endif
             if (output != 0) {
                 if (desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) {
-                    String8 reply;
-                    char *value;
-                    if (profile->mSamplingRates[0] == 0) {
-                        reply = mpClientInterface->getParameters(output,
-                                                String8(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES));
-                        ALOGV("checkOutputsForDevice() direct output sup sampling rates %s",
-                                  reply.string());
-                        value = strpbrk((char *)reply.string(), "=");
-                        if (value != NULL) {
-                            loadSamplingRates(value, profile);
-                        }
-                    }
-                    if (profile->mFormats[0] == 0) {
-                        reply = mpClientInterface->getParameters(output,
-                                                       String8(AUDIO_PARAMETER_STREAM_SUP_FORMATS));
-                        ALOGV("checkOutputsForDevice() direct output sup formats %s",
-                                  reply.string());
-                        value = strpbrk((char *)reply.string(), "=");
-                        if (value != NULL) {
-                            loadFormats(value, profile);
-                        }
-                    }
-                    if (profile->mChannelMasks[0] == 0) {
-                        reply = mpClientInterface->getParameters(output,
-                                                      String8(AUDIO_PARAMETER_STREAM_SUP_CHANNELS));
-                        ALOGV("checkOutputsForDevice() direct output sup channel masks %s",
-                                  reply.string());
-                        value = strpbrk((char *)reply.string(), "=");
-                        if (value != NULL) {
-                            loadOutChannels(value + 1, profile);
-                        }
-                    }
-                    if (((profile->mSamplingRates[0] == 0) &&
-                             (profile->mSamplingRates.size() < 2)) ||
-                         ((profile->mFormats[0] == 0) &&
-                             (profile->mFormats.size() < 2)) ||
-                         ((profile->mFormats[0] == 0) &&
-                             (profile->mChannelMasks.size() < 2))) {
+                    String8 samplingRates;
+                    String8 formats;
+                    String8 channels;
+                    queryDynamicParameters(profile, output, &samplingRates, &formats, &channels);
+                    if (!loadDynamicParameters(profile, samplingRates, formats, channels)) {
                         ALOGW("checkOutputsForDevice() direct output missing param");
+                        mpClientInterface->closeOutput(output);
                         output = 0;
                     } else {
+                        // a device that cannot be told apart from another one of the same
+                        // type is not cached
+                        if (profile->isDynamic() && !deviceId.isEmpty()) {
+                            storeCapabilities(capabilitiesKey(profile, device, deviceId),
+                                              samplingRates, formats, channels, true);
+                        }
                         addOutput(output, desc);
+                        if (directProbes != NULL) {
+                            directProbes->add(output);
+                        }
                     }
                 } else {
                     audio_io_handle_t duplicatedOutput = 0;
@@ -1728,7 +2086,7 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                         ALOGW("checkOutputsForDevice() could not open dup output for %d and %d",
                                 mPrimaryOutput, output);
                         mpClientInterface->closeOutput(output);
-                        mOutputs.removeItem(output);
+                        removeOutput(output);
                         output = 0;
                     }
                 }
@@ -1770,18 +2128,9 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                         (profile->mFlags & AUDIO_OUTPUT_FLAG_DIRECT)) {
                     ALOGV("checkOutputsForDevice(): clearing direct output profile %d on module %d",
                           j, i);
-                    if (profile->mSamplingRates[0] == 0) {
-                        profile->mSamplingRates.clear();
-                        profile->mSamplingRates.add(0);
-                    }
-                    if (profile->mFormats[0] == 0) {
-                        profile->mFormats.clear();
-                        profile->mFormats.add((audio_format_t)0);
-                    }
-                    if (profile->mChannelMasks[0] == 0) {
-                        profile->mChannelMasks.clear();
-                        profile->mChannelMasks.add((audio_channel_mask_t)0);
-                    }
+                    resetDynamicParameters(profile);
+                    mUnverifiedProfiles.removeItem(profile);
+                    mCheckedProfiles.removeItem(profile);
                 }
             }
         }
@@ -1789,6 +2138,533 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
     return NO_ERROR;
 }
 
+void AudioPolicyManagerBase::queryDynamicParameters(const IOProfile *profile,
+                                                    audio_io_handle_t output,
+                                                    String8 *samplingRates,
+                                                    String8 *formats,
+                                                    String8 *channels)
+{
+    if (profile->mSamplingRates[0] == 0) {
+        *samplingRates = mpClientInterface->getParameters(output,
+                                        String8(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES));
+    }
+    if (profile->mFormats[0] == 0) {
+        *formats = mpClientInterface->getParameters(output,
+                                        String8(AUDIO_PARAMETER_STREAM_SUP_FORMATS));
+    }
+    if (profile->mChannelMasks[0] == 0) {
+        *channels = mpClientInterface->getParameters(output,
+                                        String8(AUDIO_PARAMETER_STREAM_SUP_CHANNELS));
+    }
+}
+
+bool AudioPolicyManagerBase::loadDynamicParameters(IOProfile *profile,
+                                                   const String8& samplingRates,
+                                                   const String8& formats,
+                                                   const String8& channels)
+{
+    // the load functions tokenize the string they parse: work on private copies of the replies
+    char *value;
+    if (profile->mSamplingRates[0] == 0) {
+        String8 reply(samplingRates.string());
+        ALOGV("loadDynamicParameters() direct output sup sampling rates %s", reply.string());
+        value = strpbrk((char *)reply.string(), "=");
+        if (value != NULL) {
+            loadSamplingRates(value, profile);
+        }
+    }
+    if (profile->mFormats[0] == 0) {
+        String8 reply(formats.string());
+        ALOGV("loadDynamicParameters() direct output sup formats %s", reply.string());
+        value = strpbrk((char *)reply.string(), "=");
+        if (value != NULL) {
+            loadFormats(value, profile);
+        }
+    }
+    if (profile->mChannelMasks[0] == 0) {
+        String8 reply(channels.string());
+        ALOGV("loadDynamicParameters() direct output sup channel masks %s", reply.string());
+        value = strpbrk((char *)reply.string(), "=");
+        if (value != NULL) {
+            loadOutChannels(value + 1, profile);
+        }
+    }
+    if (((profile->mSamplingRates[0] == 0) &&
+             (profile->mSamplingRates.size() < 2)) ||
+         ((profile->mFormats[0] == 0) &&
+             (profile->mFormats.size() < 2)) ||
+         ((profile->mFormats[0] == 0) &&
+             (profile->mChannelMasks.size() < 2))) {
+        return false;
+    }
+    return true;
+}
+
+void AudioPolicyManagerBase::resetDynamicParameters(IOProfile *profile)
+{
+    if (profile->mSamplingRates[0] == 0) {
+        profile->mSamplingRates.clear();
+        profile->mSamplingRates.add(0);
+    }
+    if (profile->mFormats[0] == 0) {
+        profile->mFormats.clear();
+        profile->mFormats.add((audio_format_t)0);
+    }
+    if (profile->mChannelMasks[0] == 0) {
+        profile->mChannelMasks.clear();
+        profile->mChannelMasks.add((audio_channel_mask_t)0);
+    }
+}
+
+String8 AudioPolicyManagerBase::capabilitiesDeviceId(audio_devices_t device,
+                                                     const String8& address)
+{
+    if (!address.isEmpty() || !(device & AUDIO_DEVICE_OUT_AUX_DIGITAL)) {
+        return address;
+    }
+    String8 reply = mpClientInterface->getParameters(0,
+                                                     String8(AUDIO_PARAMETER_DEVICE_SINK_ID));
+    const char *value = strchr(reply.string(), '=');
+    if (value == NULL || value[1] == '\0') {
+        ALOGV("capabilitiesDeviceId() no sink id for device %08x", device);
+        return String8("");
+    }
+    // the identifier ends up in the cache file: keep it short and free of separators
+    uint32_t hash = 2166136261u;
+    for (value++; *value != '\0' && *value != ';'; value++) {
+        hash = (hash ^ (uint8_t)*value) * 16777619u;
+    }
+    char id[16];
+    snprintf(id, sizeof(id), "sink:%08x", hash);
+    return String8(id);
+}
+
+String8 AudioPolicyManagerBase::capabilitiesKey(const IOProfile *profile,
+                                                audio_devices_t device,
+                                                const String8& address)
+{
+    // the profile is identified by a hash of its module name, its position in the module and
+    // its static attributes so that entries saved with a different configuration file are
+    // not reused
+    uint32_t hash = 2166136261u;
+    const char *name = profile->mModule->mName;
+    while (*name != '\0') {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+    const Vector <IOProfile *>& profiles = profile->mModule->mOutputProfiles;
+    uint32_t attributes[3] = { 0, profile->mSupportedDevices, profile->mFlags };
+    for (size_t i = 0; i < profiles.size(); i++) {
+        if (profiles[i] == profile) {
+            attributes[0] = i;
+            break;
+        }
+    }
+    for (size_t i = 0; i < sizeof(attributes); i++) {
+        hash = (hash ^ ((uint8_t *)attributes)[i]) * 16777619u;
+    }
+
+    char key[MAX_DEVICE_ADDRESS_LEN + 32];
+    snprintf(key, sizeof(key), "%08x|%s|%08x", device, address.string(), hash);
+    return String8(key);
+}
+
+bool AudioPolicyManagerBase::loadCachedCapabilities(IOProfile *profile,
+                                                    audio_devices_t device,
+                                                    const String8& deviceId)
+{
+    if (!(profile->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) || !profile->isDynamic() ||
+            deviceId.isEmpty()) {
+        return false;
+    }
+    String8 key = capabilitiesKey(profile, device, deviceId);
+    ssize_t index = mCapabilitiesCache.indexOfKey(key);
+    if (index < 0) {
+        return false;
+    }
+    DeviceCapabilities& caps = mCapabilitiesCache.editValueAt(index);
+    if (!loadDynamicParameters(profile, caps.mSupSamplingRates, caps.mSupFormats,
+                               caps.mSupChannels)) {
+        ALOGW("loadCachedCapabilities() invalid entry %s", key.string());
+        resetDynamicParameters(profile);
+        mCapabilitiesCache.removeItemsAt(index);
+        return false;
+    }
+    ALOGV("loadCachedCapabilities() loaded %s", key.string());
+    caps.mLastUsed = ++mCapabilitiesUseCount;
+    // the device may have changed since the entry was saved (e.g. other firmware on the same
+    // USB card): check again the first time getOutput() uses an output of this profile
+    mUnverifiedProfiles.add(profile, key);
+    return true;
+}
+
+void AudioPolicyManagerBase::storeCapabilities(const String8& key,
+                                               const String8& samplingRates,
+                                               const String8& formats,
+                                               const String8& channels,
+                                               bool verified)
+{
+    ssize_t index = mCapabilitiesCache.indexOfKey(key);
+    if (index < 0) {
+        if (mCapabilitiesCache.size() >= MAX_CACHED_DEVICE_CAPABILITIES) {
+            size_t oldest = 0;
+            for (size_t i = 1; i < mCapabilitiesCache.size(); i++) {
+                if (mCapabilitiesCache.valueAt(i).mLastUsed <
+                        mCapabilitiesCache.valueAt(oldest).mLastUsed) {
+                    oldest = i;
+                }
+            }
+            ALOGV("storeCapabilities() evicting %s", mCapabilitiesCache.keyAt(oldest).string());
+            mCapabilitiesCache.removeItemsAt(oldest);
+        }
+        index = mCapabilitiesCache.add(key, DeviceCapabilities());
+    }
+    DeviceCapabilities& caps = mCapabilitiesCache.editValueAt(index);
+    bool changed = (caps.mSupSamplingRates != samplingRates) ||
+                   (caps.mSupFormats != formats) ||
+                   (caps.mSupChannels != channels);
+    caps.mSupSamplingRates = samplingRates;
+    caps.mSupFormats = formats;
+    caps.mSupChannels = channels;
+    caps.mLastUsed = ++mCapabilitiesUseCount;
+    caps.mVerified = verified;
+    if (changed) {
+        saveCapabilitiesCache();
+    }
+}
+
+void AudioPolicyManagerBase::verifyCachedCapabilities(IOProfile *profile, audio_io_handle_t output)
+{
+    ssize_t index = mUnverifiedProfiles.indexOfKey(profile);
+    if (index < 0) {
+        return;
+    }
+    String8 key = mUnverifiedProfiles.valueAt(index);
+    mUnverifiedProfiles.removeItemsAt(index);
+
+    if (output == 0) {
+        // the cached parameters may be the reason why the output could not be opened
+        ALOGW("verifyCachedCapabilities() discarding %s", key.string());
+        mCapabilitiesCache.removeItem(key);
+        saveCapabilitiesCache();
+        return;
+    }
+
+    // the replies are compared with the cache by applyCapabilitiesChecks()
+    AudioPolicyWorker::Query query;
+    query.mOutput = output;
+    query.mTag = key;
+    query.mKeys.add(String8(profile->mSamplingRates[0] == 0 ?
+                                AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES : ""));
+    query.mKeys.add(String8(profile->mFormats[0] == 0 ?
+                                AUDIO_PARAMETER_STREAM_SUP_FORMATS : ""));
+    query.mKeys.add(String8(profile->mChannelMasks[0] == 0 ?
+                                AUDIO_PARAMETER_STREAM_SUP_CHANNELS : ""));
+    mCheckedProfiles.add(profile, key);
+    mWorker.query(query);
+}
+
+void AudioPolicyManagerBase::applyCapabilitiesChecks()
+{
+    if (!mWorker.hasReplies()) {
+        return;
+    }
+    Vector <AudioPolicyWorker::Query> replies;
+    mWorker.takeReplies(&replies);
+    for (size_t i = 0; i < replies.size(); i++) {
+        const AudioPolicyWorker::Query& reply = replies[i];
+        const String8& key = reply.mTag;
+        // ignore the reply if the device was disconnected in the meantime
+        IOProfile *profile = NULL;
+        for (size_t j = 0; j < mCheckedProfiles.size(); j++) {
+            if (mCheckedProfiles.valueAt(j) == key) {
+                profile = const_cast<IOProfile *>(mCheckedProfiles.keyAt(j));
+                mCheckedProfiles.removeItemsAt(j);
+                break;
+            }
+        }
+        if (profile == NULL) {
+            continue;
+        }
+        // an empty reply means the output was closed before it could be read: check again
+        // the next time an output is opened from this profile
+        bool answered = true;
+        for (size_t j = 0; j < reply.mKeys.size(); j++) {
+            if (!reply.mKeys[j].isEmpty() && strchr(reply.mReplies[j].string(), '=') == NULL) {
+                answered = false;
+            }
+        }
+        if (!answered) {
+            ALOGV("applyCapabilitiesChecks() cannot verify %s", key.string());
+            mUnverifiedProfiles.add(profile, key);
+            continue;
+        }
+
+        const String8& samplingRates = reply.mReplies[0];
+        const String8& formats = reply.mReplies[1];
+        const String8& channels = reply.mReplies[2];
+        ssize_t index = mCapabilitiesCache.indexOfKey(key);
+        if (index >= 0) {
+            DeviceCapabilities& caps = mCapabilitiesCache.editValueAt(index);
+            if (caps.mSupSamplingRates == samplingRates &&
+                    caps.mSupFormats == formats &&
+                    caps.mSupChannels == channels) {
+                caps.mVerified = true;
+                continue;
+            }
+        }
+        ALOGV("applyCapabilitiesChecks() parameters changed for %s", key.string());
+        resetDynamicParameters(profile);
+        if (loadDynamicParameters(profile, samplingRates, formats, channels)) {
+            storeCapabilities(key, samplingRates, formats, channels, true);
+        } else {
+            mCapabilitiesCache.removeItem(key);
+            saveCapabilitiesCache();
+        }
+    }
+}
+
+void AudioPolicyManagerBase::loadCapabilitiesCache()
+{
+#ifdef AUDIO_POLICY_PERSIST_CAPABILITIES
+    FILE *file = fopen(AUDIO_POLICY_CAPABILITIES_FILE, "r");
+    if (file == NULL) {
+        return;
+    }
+    // one entry per line: key, sampling rates, formats and channels replies separated by tabs
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL &&
+            mCapabilitiesCache.size() < MAX_CACHED_DEVICE_CAPABILITIES) {
+        line[strcspn(line, "\n")] = '\0';
+        char *fields[4];
+        char *next = line;
+        size_t n;
+        for (n = 0; n < 4 && next != NULL; n++) {
+            fields[n] = strsep(&next, "\t");
+        }
+        if (n != 4 || fields[0][0] == '\0') {
+            continue;
+        }
+        DeviceCapabilities caps;
+        caps.mSupSamplingRates = String8(fields[1]);
+        caps.mSupFormats = String8(fields[2]);
+        caps.mSupChannels = String8(fields[3]);
+        mCapabilitiesCache.add(String8(fields[0]), caps);
+    }
+    fclose(file);
+    ALOGV("loadCapabilitiesCache() loaded %d entries", mCapabilitiesCache.size());
+#endif //AUDIO_POLICY_PERSIST_CAPABILITIES
+}
+
+void AudioPolicyManagerBase::saveCapabilitiesCache()
+{
+#ifdef AUDIO_POLICY_PERSIST_CAPABILITIES
+    String8 data;
+    for (size_t i = 0; i < mCapabilitiesCache.size(); i++) {
+        const DeviceCapabilities& caps = mCapabilitiesCache.valueAt(i);
+        data.appendFormat("%s\t%s\t%s\t%s\n", mCapabilitiesCache.keyAt(i).string(),
+                          caps.mSupSamplingRates.string(), caps.mSupFormats.string(),
+                          caps.mSupChannels.string());
+    }
+    mWorker.writeFile(String8(AUDIO_POLICY_CAPABILITIES_FILE), data);
+#endif //AUDIO_POLICY_PERSIST_CAPABILITIES
+}
+
+String8 AudioPolicyManagerBase::currentBootId()
+{
+    char id[64] = "";
+    FILE *file = fopen(BOOT_ID_FILE, "r");
+    if (file != NULL) {
+        if (fgets(id, sizeof(id), file) == NULL) {
+            id[0] = '\0';
+        }
+        fclose(file);
+    }
+    id[strcspn(id, "\n")] = '\0';
+    return String8(id);
+}
+
+void AudioPolicyManagerBase::restorePolicyState()
+{
+#ifdef AUDIO_POLICY_PERSIST_STATE
+    FILE *file = fopen(AUDIO_POLICY_STATE_FILE, "r");
+    if (file == NULL) {
+        return;
+    }
+    // one entry per line, fields separated by tabs. The boot id comes first.
+    char line[256];
+    bool valid = false;
+    int phoneState = AudioSystem::MODE_NORMAL;
+    Vector <audio_devices_t> devices;
+    Vector <String8> addresses;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        char *fields[4];
+        char *next = line;
+        size_t n;
+        for (n = 0; n < 4 && next != NULL; n++) {
+            fields[n] = strsep(&next, "\t");
+        }
+        if (!valid) {
+            valid = (n == 2) && (strcmp(fields[0], "boot_id") == 0) &&
+                    !mBootId.isEmpty() && (mBootId == fields[1]);
+            if (!valid) {
+                break;
+            }
+        } else if (n == 3 && strcmp(fields[0], "device") == 0) {
+            audio_devices_t device = (audio_devices_t)strtoul(fields[1], NULL, 16);
+            if (audio_is_output_device(device) && AudioSystem::popCount(device) == 1 &&
+                    strlen(fields[2]) < MAX_DEVICE_ADDRESS_LEN) {
+                devices.add(device);
+                addresses.add(String8(fields[2]));
+            }
+        } else if (n == 2 && strcmp(fields[0], "phone_state") == 0) {
+            int state = atoi(fields[1]);
+            if (state >= 0 && state < AudioSystem::NUM_MODES) {
+                phoneState = state;
+            }
+        } else if (n == 3 && strcmp(fields[0], "force_use") == 0) {
+            int usage = atoi(fields[1]);
+            int config = atoi(fields[2]);
+            if (usage >= 0 && usage < AudioSystem::NUM_FORCE_USE &&
+                    config >= 0 && config < AudioSystem::NUM_FORCE_CONFIG) {
+                mForceUse[usage] = (AudioSystem::forced_config)config;
+            }
+        } else if (n == 4 && strcmp(fields[0], "volume_range") == 0) {
+            int stream = atoi(fields[1]);
+            int indexMin = atoi(fields[2]);
+            int indexMax = atoi(fields[3]);
+            if (stream >= 0 && stream < AudioSystem::NUM_STREAM_TYPES &&
+                    indexMin >= 0 && indexMin < indexMax) {
+                mStreams[stream].mIndexMin = indexMin;
+                mStreams[stream].mIndexMax = indexMax;
+            }
+        } else if (n == 4 && strcmp(fields[0], "volume") == 0) {
+            int stream = atoi(fields[1]);
+            audio_devices_t device = (audio_devices_t)strtoul(fields[2], NULL, 16);
+            int index = atoi(fields[3]);
+            if (stream >= 0 && stream < AudioSystem::NUM_STREAM_TYPES &&
+                    audio_is_output_device(device) &&
+                    index >= mStreams[stream].mIndexMin && index <= mStreams[stream].mIndexMax) {
+                mStreams[stream].mIndexCur.add(device, index);
+            }
+        }
+    }
+    fclose(file);
+    if (!valid) {
+        ALOGV("restorePolicyState() no state saved during this boot");
+        return;
+    }
+
+    ALOGV("restorePolicyState() restoring %d devices, phone state %d, forced usages and volumes",
+          devices.size(), phoneState);
+    mRestoringState = true;
+    {
+        // the routing and volume commands of the whole restore are sent once
+        AudioPolicyTransactionClient::Scope transaction(mTransactionClient);
+        // the devices are connected as if the framework did: a device whose outputs cannot
+        // be opened any more is not restored
+        for (size_t i = 0; i < devices.size(); i++) {
+            if (setDeviceConnectionState(devices[i], AudioSystem::DEVICE_STATE_AVAILABLE,
+                                         addresses[i].string()) == NO_ERROR) {
+                mUnconfirmedDevices = (audio_devices_t)(mUnconfirmedDevices | devices[i]);
+            } else {
+                ALOGW("restorePolicyState() could not restore device %08x", devices[i]);
+            }
+        }
+        if (phoneState != AudioSystem::MODE_NORMAL) {
+            setPhoneState(phoneState);
+        }
+        updateDevicesAndOutputs();
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            audio_io_handle_t output = mOutputs.keyAt(i);
+            audio_devices_t newDevice = getNewDevice(output, true /*fromCache*/);
+            setOutputDevice(output, newDevice, true);
+            if (newDevice != AUDIO_DEVICE_NONE) {
+                applyStreamVolumes(output, newDevice, 0, true);
+            }
+        }
+    }
+    mRestoringState = false;
+    mStateDirty = false;
+    mRestoreTime = mClock->now();
+#endif //AUDIO_POLICY_PERSIST_STATE
+}
+
+bool AudioPolicyManagerBase::isRestoringState() const
+{
+    return mRestoreTime != 0 &&
+            mClock->now() - mRestoreTime < ms2ns(POLICY_STATE_CONFIRM_TIMEOUT_MS);
+}
+
+void AudioPolicyManagerBase::checkRestoredDevices()
+{
+    if (mUnconfirmedDevices == AUDIO_DEVICE_NONE || mRestoringState || isRestoringState()) {
+        return;
+    }
+    // the framework did not connect the device again: it went away while mediaserver was down
+    while (mUnconfirmedDevices != AUDIO_DEVICE_NONE) {
+        audio_devices_t device = (audio_devices_t)(mUnconfirmedDevices & -mUnconfirmedDevices);
+        mUnconfirmedDevices = (audio_devices_t)(mUnconfirmedDevices & ~device);
+        ALOGW("checkRestoredDevices() restored device %08x not confirmed, disconnecting", device);
+        setDeviceConnectionState(device, AudioSystem::DEVICE_STATE_UNAVAILABLE,
+                                 deviceAddress(device).string());
+    }
+}
+
+String8 AudioPolicyManagerBase::deviceAddress(audio_devices_t device) const
+{
+    if (audio_is_a2dp_device(device)) {
+        return String8(mA2dpDeviceAddress.string());
+    }
+    if (audio_is_bluetooth_sco_device(device)) {
+        return String8(mScoDeviceAddress.string());
+    }
+    if (audio_is_usb_device(device)) {
+        return String8(mUsbCardAndDevice.string());
+    }
+    return String8("");
+}
+
+void AudioPolicyManagerBase::savePolicyState(bool force)
+{
+#ifdef AUDIO_POLICY_PERSIST_STATE
+    if (!mStateDirty || mRestoringState || mBootId.isEmpty()) {
+        return;
+    }
+    nsecs_t now = mClock->now();
+    if (!force && mStateSaveTime != 0 &&
+            now - mStateSaveTime < ms2ns(POLICY_STATE_SAVE_INTERVAL_MS)) {
+        return;
+    }
+    // only the text is built here: mWorker writes the file
+    String8 data;
+    data.appendFormat("boot_id\t%s\n", mBootId.string());
+    // devices always present are connected by the constructor
+    audio_devices_t devices = (audio_devices_t)(mAvailableOutputDevices & ~mAttachedOutputDevices);
+    while (devices != AUDIO_DEVICE_NONE) {
+        audio_devices_t device = (audio_devices_t)(devices & -devices);
+        devices = (audio_devices_t)(devices & ~device);
+        data.appendFormat("device\t%08x\t%s\n", device, deviceAddress(device).string());
+    }
+    data.appendFormat("phone_state\t%d\n", mPhoneState);
+    for (int i = 0; i < AudioSystem::NUM_FORCE_USE; i++) {
+        data.appendFormat("force_use\t%d\t%d\n", i, mForceUse[i]);
+    }
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        const StreamDescriptor& streamDesc = mStreams[i];
+        data.appendFormat("volume_range\t%d\t%d\t%d\n", i, streamDesc.mIndexMin,
+                          streamDesc.mIndexMax);
+        for (size_t j = 0; j < streamDesc.mIndexCur.size(); j++) {
+            data.appendFormat("volume\t%d\t%08x\t%d\n", i, streamDesc.mIndexCur.keyAt(j),
+                              streamDesc.mIndexCur.valueAt(j));
+        }
+    }
+    mWorker.writeFile(String8(AUDIO_POLICY_STATE_FILE), data);
+    mStateDirty = false;
+    mStateSaveTime = now;
+#endif //AUDIO_POLICY_PERSIST_STATE
+}
+
 void AudioPolicyManagerBase::closeOutput(audio_io_handle_t output)
 {
     ALOGV("closeOutput(%d)", output);
@@ -1823,8 +2699,8 @@ void AudioPolicyManagerBase::closeOutput(audio_io_handle_t output)
             ALOGV("closeOutput() closing also duplicated output %d", duplicatedOutput);
 
             mpClientInterface->closeOutput(duplicatedOutput);
-            delete mOutputs.valueFor(duplicatedOutput);
-            mOutputs.removeItem(duplicatedOutput);
+            removeOutput(duplicatedOutput);
+            delete dupOutputDesc;
         }
     }
 
@@ -1833,12 +2709,100 @@ void AudioPolicyManagerBase::closeOutput(audio_io_handle_t output)
     mpClientInterface->setParameters(output, param.toString());
 
     mpClientInterface->closeOutput(output);
-    delete mOutputs.valueFor(output);
-    mOutputs.removeItem(output);
+    removeOutput(output);
+    delete outputDesc;
+}
+
+void AudioPolicyManagerBase::parkDirectOutput(audio_io_handle_t output)
+{
+    ALOGV("parkDirectOutput(%d)", output);
+
+    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(output);
+    if (outputDesc == NULL) {
+        ALOGW("parkDirectOutput() unknown output %d", output);
+        return;
+    }
+    removeOutput(output);
+
+    // the output is idle: forget its usage history so that it is reused in a clean state
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        outputDesc->mRefCount[i] = 0;
+        outputDesc->mStopTime[i] = 0;
+    }
+
+    if (mIdleDirectOutputs.size() >= MAX_IDLE_DIRECT_OUTPUTS) {
+        AudioOutputDescriptor *oldestDesc = mIdleDirectOutputs[0];
+        ALOGV("parkDirectOutput() idle pool full, closing output %d", oldestDesc->mId);
+        mpClientInterface->closeOutput(oldestDesc->mId);
+        delete oldestDesc;
+        mIdleDirectOutputs.removeAt(0);
+    }
+    mIdleDirectOutputs.add(outputDesc);
+}
+
+AudioPolicyManagerBase::AudioOutputDescriptor *AudioPolicyManagerBase::takeIdleDirectOutput(
+                                                                const IOProfile *profile,
+                                                                uint32_t samplingRate,
+                                                                uint32_t format,
+                                                                uint32_t channelMask,
+                                                                audio_output_flags_t flags)
+{
+    // most recently parked outputs first: they are the most likely to match the next request
+    for (size_t i = mIdleDirectOutputs.size(); i > 0; i--) {
+        AudioOutputDescriptor *outputDesc = mIdleDirectOutputs[i - 1];
+        // the output may have been opened with more flags than requested, e.g. by a probe
+        // with all the flags of the profile: same rule as IOProfile::isCompatibleProfile()
+        if (outputDesc->mProfile != profile || (outputDesc->mFlags & flags) != flags) {
+            continue;
+        }
+        // same rule as for a newly opened direct output: only accept the requested parameters
+        if ((samplingRate != 0 && samplingRate != outputDesc->mSamplingRate) ||
+                (format != 0 && format != outputDesc->mFormat) ||
+                (channelMask != 0 && channelMask != outputDesc->mChannelMask)) {
+            continue;
+        }
+        ALOGV("takeIdleDirectOutput() reusing output %d", outputDesc->mId);
+        mIdleDirectOutputs.removeAt(i - 1);
+        return outputDesc;
+    }
+    return NULL;
+}
+
+void AudioPolicyManagerBase::closeIdleDirectOutputs(bool all)
+{
+    for (size_t i = 0; i < mIdleDirectOutputs.size(); ) {
+        AudioOutputDescriptor *outputDesc = mIdleDirectOutputs[i];
+        if (!all && (outputDesc->mProfile->mSupportedDevices & mAvailableOutputDevices)) {
+            i++;
+            continue;
+        }
+        ALOGV("closeIdleDirectOutputs() closing output %d", outputDesc->mId);
+        mpClientInterface->closeOutput(outputDesc->mId);
+        delete outputDesc;
+        mIdleDirectOutputs.removeAt(i);
+    }
+}
+
+size_t AudioPolicyManagerBase::evictIdleDirectOutputs(const IOProfile *profile)
+{
+    size_t closed = 0;
+    for (size_t i = 0; i < mIdleDirectOutputs.size(); ) {
+        AudioOutputDescriptor *outputDesc = mIdleDirectOutputs[i];
+        if (outputDesc->mProfile != profile) {
+            i++;
+            continue;
+        }
+        ALOGV("evictIdleDirectOutputs() closing output %d", outputDesc->mId);
+        mpClientInterface->closeOutput(outputDesc->mId);
+        delete outputDesc;
+        mIdleDirectOutputs.removeAt(i);
+        closed++;
+    }
+    return closed;
 }
 
 SortedVector<audio_io_handle_t> AudioPolicyManagerBase::getOutputsForDevice(audio_devices_t device,
-                        DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> openOutputs)
+                        const DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *>& openOutputs)
 {
     SortedVector<audio_io_handle_t> outputs;
 
@@ -1854,6 +2818,26 @@ SortedVector<audio_io_handle_t> AudioPolicyManagerBase::getOutputsForDevice(audi
     return outputs;
 }
 
+SortedVector<audio_io_handle_t> AudioPolicyManagerBase::getPreviousOutputsForDevice(
+                                                                    audio_devices_t device)
+{
+    SortedVector<audio_io_handle_t> outputs;
+
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        AudioOutputDescriptor *desc = mOutputs.valueAt(i);
+        if (desc->mOpenGeneration <= mPreviousOutputsGeneration &&
+                (device & desc->supportedDevices()) == device) {
+            outputs.add(mOutputs.keyAt(i));
+        }
+    }
+    for (size_t i = 0; i < mRetiredOutputCount; i++) {
+        if ((device & mRetiredOutputs[i].mSupportedDevices) == device) {
+            outputs.add(mRetiredOutputs[i].mId);
+        }
+    }
+    return outputs;
+}
+
 bool AudioPolicyManagerBase::vectorsEqual(SortedVector<audio_io_handle_t>& outputs1,
                                    SortedVector<audio_io_handle_t>& outputs2)
 {
@@ -1872,16 +2856,20 @@ void AudioPolicyManagerBase::checkOutputForStrategy(routing_strategy strategy)
 {
     audio_devices_t oldDevice = getDeviceForStrategy(strategy, true /*fromCache*/);
     audio_devices_t newDevice = getDeviceForStrategy(strategy, false /*fromCache*/);
-    SortedVector<audio_io_handle_t> srcOutputs = getOutputsForDevice(oldDevice, mPreviousOutputs);
+    SortedVector<audio_io_handle_t> srcOutputs = getPreviousOutputsForDevice(oldDevice);
     SortedVector<audio_io_handle_t> dstOutputs = getOutputsForDevice(newDevice, mOutputs);
 
     if (!vectorsEqual(srcOutputs,dstOutputs)) {
         ALOGV("checkOutputForStrategy() strategy %d, moving from output %d to output %d",
               strategy, srcOutputs[0], dstOutputs[0]);
+        traceRouting(ROUTING_EVENT_MOVE_STRATEGY, ROUTING_REASON_NONE, strategy,
+                     srcOutputs.isEmpty() ? 0 : srcOutputs[0], oldDevice, newDevice,
+                     MUTE_TIME_MS, 0, dstOutputs.isEmpty() ? 0 : dstOutputs[0]);
         // mute strategy while moving tracks from one output to another
         for (size_t i = 0; i < srcOutputs.size(); i++) {
             AudioOutputDescriptor *desc = mOutputs.valueFor(srcOutputs[i]);
-            if (desc->strategyRefCount(strategy) != 0) {
+            // outputs closed since the snapshot have no track left to mute
+            if (desc != NULL && desc->strategyRefCount(strategy) != 0) {
                 setStrategyMute(strategy, true, srcOutputs[i]);
                 setStrategyMute(strategy, false, srcOutputs[i], MUTE_TIME_MS, newDevice);
             }
@@ -2041,10 +3029,12 @@ audio_devices_t AudioPolicyManagerBase::getNewDevice(audio_io_handle_t output, b
 }
 
 uint32_t AudioPolicyManagerBase::getStrategyForStream(AudioSystem::stream_type stream) {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_STRATEGY_FOR_STREAM);
     return (uint32_t)getStrategy(stream);
 }
 
 audio_devices_t AudioPolicyManagerBase::getDevicesForStream(AudioSystem::stream_type stream) {
+    AudioPolicyStats::CallTimer timer(mStats, AudioPolicyStats::API_GET_DEVICES_FOR_STREAM);
     audio_devices_t devices;
     // By checking the range of stream before calling getStrategy, we avoid
     // getStrategy's behavior for invalid streams.  getStrategy would do a ALOGE
@@ -2306,7 +3296,7 @@ void AudioPolicyManagerBase::updateDevicesAndOutputs()
     for (int i = 0; i < NUM_STRATEGIES; i++) {
         mDeviceForStrategy[i] = getDeviceForStrategy((routing_strategy)i, false /*fromCache*/);
     }
-    mPreviousOutputs = mOutputs;
+    snapshotOutputs();
 }
 
 uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor *outputDesc,
@@ -2341,6 +3331,11 @@ uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor
             outputDesc->mStrategyMutedByDevice[i] = false;
         }
         if (doMute || tempMute) {
+            traceRouting(ROUTING_EVENT_MUTE_STRATEGY,
+                         doMute ? (mute ? ROUTING_REASON_INCOMPATIBLE_DEVICE :
+                                          ROUTING_REASON_COMPATIBLE_DEVICE) :
+                                  ROUTING_REASON_DEVICE_SWITCH,
+                         i, outputDesc->mId, prevDevice, device, mute ? 0 : delayMs);
             for (size_t j = 0; j < mOutputs.size(); j++) {
                 AudioOutputDescriptor *desc = mOutputs.valueAt(j);
                 if ((desc->supportedDevices() & outputDesc->supportedDevices())
@@ -2352,14 +3347,15 @@ uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor
                       mute ? "muting" : "unmuting", i, curDevice, curOutput);
                 setStrategyMute((routing_strategy)i, mute, curOutput, mute ? 0 : delayMs);
                 if (desc->strategyRefCount((routing_strategy)i) != 0) {
+                    uint32_t drainMs = outputDrainWaitMs(desc, desc->latency() / 2);
                     if (tempMute) {
                         setStrategyMute((routing_strategy)i, true, curOutput);
                         setStrategyMute((routing_strategy)i, false, curOutput,
-                                            desc->latency() * 2, device);
+                                            drainMs, device);
                     }
                     if (tempMute || mute) {
-                        if (muteWaitMs < desc->latency()) {
-                            muteWaitMs = desc->latency();
+                        if (muteWaitMs < drainMs) {
+                            muteWaitMs = drainMs;
                         }
                     }
                 }
@@ -2367,15 +3363,14 @@ uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor
         }
     }
 
-    // FIXME: should not need to double latency if volume could be applied immediately by the
-    // audioflinger mixer. We must account for the delay between now and the next time
-    // the audioflinger thread for this output will process a buffer (which corresponds to
-    // one buffer size, usually 1/2 or 1/4 of the latency).
-    muteWaitMs *= 2;
+    // outputDrainWaitMs() accounts for the delay between now and the next time the
+    // audioflinger thread for this output will process a buffer (which corresponds to one
+    // buffer size, usually 1/2 or 1/4 of the latency) as the volume is not applied
+    // immediately by the audioflinger mixer.
     // wait for the PCM output buffers to empty before proceeding with the rest of the command
     if (muteWaitMs > delayMs) {
         muteWaitMs -= delayMs;
-        usleep(muteWaitMs * 1000);
+        sleepMs(muteWaitMs);
         return muteWaitMs;
     }
     return 0;
@@ -2414,8 +3409,13 @@ uint32_t AudioPolicyManagerBase::setOutputDevice(audio_io_handle_t output,
     // Doing this check here allows the caller to call setOutputDevice() without conditions
     if ((device == AUDIO_DEVICE_NONE || device == prevDevice) && !force) {
         ALOGV("setOutputDevice() setting same device %04x or null device for output %d", device, output);
+        traceRouting(ROUTING_EVENT_SET_OUTPUT_DEVICE, ROUTING_REASON_UNCHANGED, 0, output,
+                     prevDevice, device, delayMs, muteWaitMs);
         return muteWaitMs;
     }
+    traceRouting(ROUTING_EVENT_SET_OUTPUT_DEVICE,
+                 (device == prevDevice) ? ROUTING_REASON_FORCED : ROUTING_REASON_DEVICE_CHANGED,
+                 0, output, prevDevice, device, delayMs, muteWaitMs);
 
     ALOGV("setOutputDevice() changing device");
     // do the routing
@@ -2819,6 +3819,11 @@ status_t AudioPolicyManagerBase::checkAndSetVolume(int stream,
     // - the force flag is set
     if (volume != mOutputs.valueFor(output)->mCurVolume[stream] ||
             force) {
+        traceRouting(ROUTING_EVENT_SET_VOLUME,
+                     (volume != mOutputs.valueFor(output)->mCurVolume[stream]) ?
+                             ROUTING_REASON_VOLUME_CHANGED : ROUTING_REASON_VOLUME_FORCED,
+                     stream, output, mOutputs.valueFor(output)->device(), device, delayMs, 0,
+                     (int32_t)(volume * 1000));
         mOutputs.valueFor(output)->mCurVolume[stream] = volume;
         ALOGVV("checkAndSetVolume() for output %d stream %d, volume %f, delay %d", output, stream, volume, delayMs);
         // Force VOICE_CALL to track BLUETOOTH_SCO stream volume when bluetooth audio is
@@ -2972,6 +3977,69 @@ bool AudioPolicyManagerBase::isStateInCall(int state) {
             (state == AudioSystem::MODE_IN_COMMUNICATION));
 }
 
+bool AudioPolicyManagerBase::isLatencySensitiveStreamActive()
+{
+    // voice and DTMF must follow user interaction without delay. Short sonification sounds are
+    // not considered here: they would move media back and forth on every key press.
+    return isInCall() ||
+            isStreamActive(AudioSystem::VOICE_CALL) ||
+            isStreamActive(AudioSystem::BLUETOOTH_SCO) ||
+            isStreamActive(AudioSystem::DTMF);
+}
+
+bool AudioPolicyManagerBase::mediaPrefersDeepBuffer()
+{
+    // never during a call, even with the screen off (e.g. proximity sensor)
+    return mDeepBufferPowerMode && !isInCall() &&
+            (!mScreenOn || !isLatencySensitiveStreamActive());
+}
+
+void AudioPolicyManagerBase::checkMediaDeepBufferPlacement(bool toDeepBuffer)
+{
+    if (!mDeepBufferPowerMode || toDeepBuffer != mediaPrefersDeepBuffer()) {
+        return;
+    }
+    if (!isStreamActive(AudioSystem::MUSIC) && !isStreamActive(AudioSystem::TTS)) {
+        // tracks created from now on are placed by getOutput()
+        mMediaSteeredToDeepBuffer = false;
+        return;
+    }
+
+    bool move = false;
+    if (toDeepBuffer) {
+        // only if media is playing on an output other than the deep buffer output that
+        // would be selected for it
+        audio_devices_t device = getDeviceForStrategy(STRATEGY_MEDIA, true /*fromCache*/);
+        SortedVector<audio_io_handle_t> outputs = getOutputsForDevice(device, mOutputs);
+        bool hasDeepBuffer = false;
+        for (size_t i = 0; i < outputs.size(); i++) {
+            if (mOutputs.valueFor(outputs[i])->mFlags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) {
+                hasDeepBuffer = true;
+            }
+        }
+        for (size_t i = 0; hasDeepBuffer && i < outputs.size(); i++) {
+            AudioOutputDescriptor *desc = mOutputs.valueFor(outputs[i]);
+            if (!(desc->mFlags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) &&
+                    (desc->mRefCount[AudioSystem::MUSIC] != 0 ||
+                     desc->mRefCount[AudioSystem::TTS] != 0)) {
+                move = true;
+            }
+        }
+    } else {
+        // only media moved by the power mode must come back: tracks that asked for a deep
+        // buffer output are left where they are
+        move = mMediaSteeredToDeepBuffer;
+        mMediaSteeredToDeepBuffer = false;
+    }
+    if (move) {
+        ALOGV("checkMediaDeepBufferPlacement() moving media %s deep buffer output",
+              toDeepBuffer ? "to" : "from");
+        // tracks are invalidated and call getOutput() again
+        mpClientInterface->setStreamOutput(AudioSystem::MUSIC, 0);
+        mpClientInterface->setStreamOutput(AudioSystem::TTS, 0);
+    }
+}
+
 bool AudioPolicyManagerBase::needsDirectOuput(audio_stream_type_t stream,
                                               uint32_t samplingRate,
                                               audio_format_t format,
@@ -2993,6 +4061,50 @@ uint32_t AudioPolicyManagerBase::getMaxEffectsMemory()
     return MAX_EFFECTS_MEMORY;
 }
 
+// --- OutputStreamTable class implementation
+
+AudioPolicyManagerBase::OutputStreamTable::OutputStreamTable()
+    : mUsedSlots(0)
+{
+    for (int i = 0; i < MAX_OUTPUT_SLOTS; i++) {
+        releaseSlot(i);
+    }
+}
+
+int AudioPolicyManagerBase::OutputStreamTable::allocateSlot()
+{
+    if (mUsedSlots == 0xFFFFFFFF) {
+        return -1;
+    }
+    int slot = __builtin_ctz(~mUsedSlots);
+    mUsedSlots |= 1u << slot;
+    return slot;
+}
+
+void AudioPolicyManagerBase::OutputStreamTable::releaseSlot(int slot)
+{
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        mRefCount[i][slot] = 0;
+        mStopTime[i][slot] = 0;
+    }
+    mUsedSlots &= ~(1u << slot);
+}
+
+bool AudioPolicyManagerBase::OutputStreamTable::isStreamActive(int stream, uint32_t inPastMs,
+                                                               nsecs_t sysTime) const
+{
+    // no early exit: the loop is short and branch free so that the compiler can vectorize it
+    const uint32_t *refCount = mRefCount[stream];
+    const nsecs_t *stopTime = mStopTime[stream];
+    nsecs_t window = ms2ns((nsecs_t)inPastMs);
+    uint32_t active = 0;
+    for (int i = 0; i < MAX_OUTPUT_SLOTS; i++) {
+        active |= ((refCount[i] != 0) | (sysTime - stopTime[i] < window)) &
+                  (mUsedSlots >> i);
+    }
+    return (active & 1) != 0;
+}
+
 // --- AudioOutputDescriptor class implementation
 
 AudioPolicyManagerBase::AudioOutputDescriptor::AudioOutputDescriptor(
@@ -3000,8 +4112,12 @@ AudioPolicyManagerBase::AudioOutputDescriptor::AudioOutputDescriptor(
     : mId(0), mSamplingRate(0), mFormat((audio_format_t)0),
       mChannelMask((audio_channel_mask_t)0), mLatency(0),
     mFlags((audio_output_flags_t)0), mDevice(AUDIO_DEVICE_NONE),
-    mOutput1(0), mOutput2(0), mProfile(profile)
+    mOutput1(0), mOutput2(0), mProfile(profile),
+    mDrainTimeSupported(true), mDrainTimeMs(0), mDrainTimeQueried(0), mOpenGeneration(0),
+    mTable(NULL), mSlot(-1)
 {
+    mRefCount.set(mLocalRefCount, 1);
+    mStopTime.set(mLocalStopTime, 1);
     // clear usage count for all stream types
     for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
         mRefCount[i] = 0;
@@ -3050,6 +4166,47 @@ bool AudioPolicyManagerBase::AudioOutputDescriptor::sharesHwModuleWith(
     }
 }
 
+AudioPolicyManagerBase::AudioOutputDescriptor::~AudioOutputDescriptor()
+{
+    detach();
+}
+
+void AudioPolicyManagerBase::AudioOutputDescriptor::attach(OutputStreamTable *table)
+{
+    if (mTable != NULL) {
+        return;
+    }
+    int slot = table->allocateSlot();
+    if (slot < 0) {
+        ALOGW("attach() no stream state slot left for output %d", mId);
+        return;
+    }
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        table->mRefCount[i][slot] = mLocalRefCount[i];
+        table->mStopTime[i][slot] = mLocalStopTime[i];
+    }
+    mRefCount.set(&table->mRefCount[0][slot], MAX_OUTPUT_SLOTS);
+    mStopTime.set(&table->mStopTime[0][slot], MAX_OUTPUT_SLOTS);
+    mTable = table;
+    mSlot = slot;
+}
+
+void AudioPolicyManagerBase::AudioOutputDescriptor::detach()
+{
+    if (mTable == NULL) {
+        return;
+    }
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        mLocalRefCount[i] = mRefCount[i];
+        mLocalStopTime[i] = mStopTime[i];
+    }
+    mRefCount.set(mLocalRefCount, 1);
+    mStopTime.set(mLocalStopTime, 1);
+    mTable->releaseSlot(mSlot);
+    mTable = NULL;
+    mSlot = -1;
+}
+
 void AudioPolicyManagerBase::AudioOutputDescriptor::changeRefCount(AudioSystem::stream_type stream, int delta)
 {
     // forward usage count change to attached outputs
@@ -3075,6 +4232,18 @@ uint32_t AudioPolicyManagerBase::AudioOutputDescriptor::refCount()
     return refcount;
 }
 
+bool AudioPolicyManagerBase::AudioOutputDescriptor::isActive(uint32_t inPastMs,
+                                                             nsecs_t sysTime) const
+{
+    for (int i = 0; i < (int)AudioSystem::NUM_STREAM_TYPES; i++) {
+        if (mRefCount[i] != 0 ||
+            ns2ms(sysTime - mStopTime[i]) < inPastMs) {
+            return true;
+        }
+    }
+    return false;
+}
+
 uint32_t AudioPolicyManagerBase::AudioOutputDescriptor::strategyRefCount(routing_strategy strategy)
 {
     uint32_t refCount = 0;
@@ -3109,6 +4278,12 @@ status_t AudioPolicyManagerBase::AudioOutputDescriptor::dump(int fd)
     result.append(buffer);
     snprintf(buffer, SIZE, " Latency: %d\n", mLatency);
     result.append(buffer);
+    if (mDrainTimeSupported) {
+        snprintf(buffer, SIZE, " Last drain time: %d ms\n", mDrainTimeMs);
+    } else {
+        snprintf(buffer, SIZE, " Last drain time: not reported\n");
+    }
+    result.append(buffer);
     snprintf(buffer, SIZE, " Flags %08x\n", mFlags);
     result.append(buffer);
     snprintf(buffer, SIZE, " Devices %08x\n", device());
@@ -3263,7 +4438,7 @@ void AudioPolicyManagerBase::HwModule::dump(int fd)
 }
 
 AudioPolicyManagerBase::IOProfile::IOProfile(HwModule *module)
-    : mFlags((audio_output_flags_t)0), mModule(module)
+    : mFlags((audio_output_flags_t)0), mMaxOpenStreams(1), mModule(module)
 {
 }
 
@@ -3324,6 +4499,11 @@ bool AudioPolicyManagerBase::IOProfile::isCompatibleProfile(audio_devices_t devi
     return true;
 }
 
+bool AudioPolicyManagerBase::IOProfile::isDynamic() const
+{
+    return (mSamplingRates[0] == 0) || (mFormats[0] == 0) || (mChannelMasks[0] == 0);
+}
+
 void AudioPolicyManagerBase::IOProfile::dump(int fd)
 {
     const size_t SIZE = 256;
@@ -3358,6 +4538,8 @@ void AudioPolicyManagerBase::IOProfile::dump(int fd)
     result.append(buffer);
     snprintf(buffer, SIZE, "    - flags: %04x\n", mFlags);
     result.append(buffer);
+    snprintf(buffer, SIZE, "    - max open streams: %u\n", mMaxOpenStreams);
+    result.append(buffer);
 
     write(fd, result.string(), result.size());
 }
@@ -3686,6 +4868,13 @@ status_t AudioPolicyManagerBase::loadOutput(cnode *root, HwModule *module)
             profile->mSupportedDevices = parseDeviceNames((char *)node->value);
         } else if (strcmp(node->name, FLAGS_TAG) == 0) {
             profile->mFlags = parseFlagNames((char *)node->value);
+        } else if (strcmp(node->name, MAX_OPEN_STREAMS_TAG) == 0) {
+            int maxOpenStreams = atoi((char *)node->value);
+            ALOGW_IF(maxOpenStreams <= 0, "loadOutput() invalid max open streams %s",
+                     (char *)node->value);
+            if (maxOpenStreams > 0) {
+                profile->mMaxOpenStreams = maxOpenStreams;
+            }
         }
         node = node->next;
     }
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyRoutingTrace"
+//#define LOG_NDEBUG 0
+
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+
+#include <hardware_legacy/AudioPolicyRoutingTrace.h>
+#include <hardware_legacy/AudioPolicyStats.h>
+
+namespace android_audio_legacy {
+
+AudioPolicyRoutingTrace * volatile AudioPolicyRoutingTrace::sCurrent = NULL;
+
+AudioPolicyRoutingTrace::AudioPolicyRoutingTrace()
+    : mNext(0)
+{
+    memset((void *)mEvents, 0, sizeof(mEvents));
+    sCurrent = this;
+}
+
+AudioPolicyRoutingTrace::~AudioPolicyRoutingTrace()
+{
+    if (sCurrent == this) {
+        sCurrent = NULL;
+    }
+}
+
+const char *AudioPolicyRoutingTrace::typeName(uint32_t type)
+{
+    static const char * const sNames[ROUTING_EVENT_TYPE_CNT] = {
+        "set_output_device",
+        "move_strategy",
+        "mute_strategy",
+        "set_volume"
+    };
+    if (type >= ROUTING_EVENT_TYPE_CNT) {
+        return "unknown";
+    }
+    return sNames[type];
+}
+
+const char *AudioPolicyRoutingTrace::reasonName(uint32_t reason)
+{
+    static const char * const sNames[ROUTING_REASON_CNT] = {
+        "",
+        "device changed",
+        "forced",
+        "unchanged",
+        "incompatible device",
+        "compatible device",
+        "device switch",
+        "volume changed",
+        "volume forced"
+    };
+    if (reason >= ROUTING_REASON_CNT) {
+        return "unknown";
+    }
+    return sNames[reason];
+}
+
+void AudioPolicyRoutingTrace::record(nsecs_t time, routing_event_type type,
+                                     routing_event_reason reason, uint8_t detail, uint8_t call,
+                                     audio_io_handle_t output, audio_devices_t prevDevice,
+                                     audio_devices_t device, uint32_t delayMs,
+                                     uint32_t muteWaitMs, int32_t value)
+{
+    int32_t index = android_atomic_inc(&mNext);
+    routing_event *event = &mEvents[index & (AUDIO_POLICY_ROUTING_EVENTS - 1)];
+    android_atomic_release_store(0, &event->mSequence);
+    // the release store only orders the writes before it: the event must not be seen
+    // modified before it is seen invalid
+    android_memory_barrier();
+    event->mTime = time;
+    event->mType = (uint8_t)type;
+    event->mReason = (uint8_t)reason;
+    event->mDetail = detail;
+    event->mCall = call;
+    event->mOutput = output;
+    event->mPrevDevice = prevDevice;
+    event->mDevice = device;
+    event->mDelayMs = (delayMs > UINT16_MAX) ? UINT16_MAX : (uint16_t)delayMs;
+    event->mMuteWaitMs = (muteWaitMs > UINT16_MAX) ? UINT16_MAX : (uint16_t)muteWaitMs;
+    event->mValue = value;
+    android_atomic_release_store(index + 1, &event->mSequence);
+}
+
+// Formatting helpers usable from a signal handler: no locale, no allocation, no stdio.
+
+static char *appendString(char *p, const char *end, const char *s)
+{
+    while (*s != '\0' && p < end) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char *appendDec(char *p, const char *end, int64_t value, int minDigits = 1)
+{
+    char digits[24];
+    int n = 0;
+    bool negative = value < 0;
+    uint64_t v = negative ? (uint64_t)-value : (uint64_t)value;
+    do {
+        digits[n++] = '0' + (char)(v % 10);
+        v /= 10;
+    } while (v != 0 || n < minDigits);
+    if (negative && p < end) {
+        *p++ = '-';
+    }
+    while (n > 0 && p < end) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static char *appendHex(char *p, const char *end, uint32_t value)
+{
+    static const char sHex[] = "0123456789abcdef";
+    for (int shift = 28; shift >= 0 && p < end; shift -= 4) {
+        *p++ = sHex[(value >> shift) & 0xf];
+    }
+    return p;
+}
+
+void AudioPolicyRoutingTrace::dump(int fd) const
+{
+    char buffer[256];
+    const char *end = buffer + sizeof(buffer) - 1;
+    int32_t next = android_atomic_acquire_load(&mNext);
+    int32_t count = (next < AUDIO_POLICY_ROUTING_EVENTS) ? next : AUDIO_POLICY_ROUTING_EVENTS;
+
+    char *p = appendString(buffer, end, "\nRouting trace: ");
+    p = appendDec(p, end, next);
+    p = appendString(p, end, " events, last ");
+    p = appendDec(p, end, count);
+    p = appendString(p, end, ":\n");
+    write(fd, buffer, p - buffer);
+
+    for (int32_t i = next - count; i < next; i++) {
+        const routing_event *src = &mEvents[i & (AUDIO_POLICY_ROUTING_EVENTS - 1)];
+        if (android_atomic_acquire_load(&src->mSequence) != i + 1) {
+            continue;
+        }
+        routing_event event;
+        memcpy(&event, (const void *)src, sizeof(event));
+        // the copy must complete before the sequence is checked again
+        android_memory_barrier();
+        // overwritten while being copied
+        if (android_atomic_acquire_load(&src->mSequence) != i + 1) {
+            continue;
+        }
+
+        // time in seconds.milliseconds
+        p = appendString(buffer, end, " ");
+        p = appendDec(p, end, event.mTime / 1000000000);
+        p = appendString(p, end, ".");
+        p = appendDec(p, end, (event.mTime / 1000000) % 1000, 3);
+        p = appendString(p, end, " ");
+        // events caused by the constructor or a vendor thread have no entry point
+        p = appendString(p, end, (event.mCall < AudioPolicyStats::API_CNT) ?
+                AudioPolicyStats::apiName((AudioPolicyStats::api)event.mCall) : "-");
+        p = appendString(p, end, " ");
+        p = appendString(p, end, typeName(event.mType));
+        p = appendString(p, end, " output ");
+        p = appendDec(p, end, event.mOutput);
+        switch (event.mType) {
+        case ROUTING_EVENT_MOVE_STRATEGY:
+            p = appendString(p, end, " to ");
+            p = appendDec(p, end, event.mValue);
+            // fall through
+        case ROUTING_EVENT_MUTE_STRATEGY:
+            p = appendString(p, end, " strategy ");
+            p = appendDec(p, end, event.mDetail);
+            break;
+        case ROUTING_EVENT_SET_VOLUME:
+            p = appendString(p, end, " stream ");
+            p = appendDec(p, end, event.mDetail);
+            p = appendString(p, end, " volume ");
+            p = appendDec(p, end, event.mValue / 1000);
+            p = appendString(p, end, ".");
+            p = appendDec(p, end, event.mValue % 1000, 3);
+            break;
+        default:
+            break;
+        }
+        p = appendString(p, end, " device ");
+        p = appendHex(p, end, event.mPrevDevice);
+        p = appendString(p, end, " -> ");
+        p = appendHex(p, end, event.mDevice);
+        p = appendString(p, end, " delay ");
+        p = appendDec(p, end, event.mDelayMs);
+        p = appendString(p, end, " ms wait ");
+        p = appendDec(p, end, event.mMuteWaitMs);
+        p = appendString(p, end, " ms");
+        if (event.mReason != ROUTING_REASON_NONE) {
+            p = appendString(p, end, " (");
+            p = appendString(p, end, reasonName(event.mReason));
+            p = appendString(p, end, ")");
+        }
+        *p++ = '\n';
+        write(fd, buffer, p - buffer);
+    }
+}
+
+void AudioPolicyRoutingTrace::dumpCurrent(int fd)
+{
+    AudioPolicyRoutingTrace *trace = sCurrent;
+    if (trace != NULL) {
+        trace->dump(fd);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// fatal signal handler
+
+static const int kFatalSignals[] = { SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV };
+#define NUM_FATAL_SIGNALS (sizeof(kFatalSignals) / sizeof(kFatalSignals[0]))
+
+static struct sigaction sPreviousActions[NUM_FATAL_SIGNALS];
+static const char *sFatalTracePath = NULL;
+static volatile int32_t sHandlerInstalled = 0;
+static volatile int32_t sDumping = 0;
+
+static void fatalSignalHandler(int sig, siginfo_t *info, void *context)
+{
+    // only the first thread to crash dumps: the others, or a crash in the dump itself, go
+    // straight to the previous handler
+    if (android_atomic_cmpxchg(0, 1, &sDumping) == 0) {
+        int fd = open(sFatalTracePath, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+        AudioPolicyRoutingTrace::dumpCurrent(fd >= 0 ? fd : STDERR_FILENO);
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_FATAL_SIGNALS; i++) {
+        if (kFatalSignals[i] != sig) {
+            continue;
+        }
+        const struct sigaction& previous = sPreviousActions[i];
+        if ((previous.sa_flags & SA_SIGINFO) && previous.sa_sigaction != NULL) {
+            previous.sa_sigaction(sig, info, context);
+            return;
+        }
+        if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(sig);
+            return;
+        }
+        // restore the default action: a fault happens again when the handler returns and a
+        // signal sent by a thread or process is sent again
+        sigaction(sig, &previous, NULL);
+        if (info == NULL || info->si_code <= 0) {
+            raise(sig);
+        }
+        return;
+    }
+}
+
+void AudioPolicyRoutingTrace::installFatalSignalHandler(const char *path)
+{
+    if (android_atomic_cmpxchg(0, 1, &sHandlerInstalled) != 0) {
+        return;
+    }
+    sFatalTracePath = path;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_sigaction = fatalSignalHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+    for (size_t i = 0; i < NUM_FATAL_SIGNALS; i++) {
+        if (sigaction(kFatalSignals[i], &action, &sPreviousActions[i]) != 0) {
+            ALOGW("installFatalSignalHandler() cannot handle signal %d", kFatalSignals[i]);
+        }
+    }
+}
+
+}; // namespace android_audio_legacy
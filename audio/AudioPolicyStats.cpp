@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyStats"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+#include <media/AudioParameter.h>
+
+#include <hardware_legacy/AudioPolicyStats.h>
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+// AudioPolicyStats
+// ----------------------------------------------------------------------------
+
+// layout of the per thread call state
+static const int CALL_DEPTH_SHIFT = 8;
+static const intptr_t CALL_API_MASK = (1 << CALL_DEPTH_SHIFT) - 1;
+
+AudioPolicyStats::AudioPolicyStats()
+    : mThreadKeyValid(false)
+{
+    memset((void *)mHistograms, 0, sizeof(mHistograms));
+    memset((void *)mMaxUs, 0, sizeof(mMaxUs));
+    memset((void *)mCounters, 0, sizeof(mCounters));
+    if (pthread_key_create(&mThreadKey, NULL) == 0) {
+        mThreadKeyValid = true;
+    } else {
+        ALOGW("AudioPolicyStats() cannot create thread key, entry points are not timed");
+    }
+}
+
+AudioPolicyStats::~AudioPolicyStats()
+{
+    if (mThreadKeyValid) {
+        pthread_key_delete(mThreadKey);
+    }
+}
+
+const char *AudioPolicyStats::apiName(api call)
+{
+    static const char * const sNames[API_CNT] = {
+        "set_device_connection_state",
+        "get_device_connection_state",
+        "set_phone_state",
+        "set_force_use",
+        "get_force_use",
+        "set_system_property",
+        "get_output",
+        "start_output",
+        "stop_output",
+        "release_output",
+        "get_input",
+        "start_input",
+        "stop_input",
+        "release_input",
+        "init_stream_volume",
+        "set_stream_volume_index",
+        "get_stream_volume_index",
+        "get_strategy_for_stream",
+        "get_devices_for_stream",
+        "get_output_for_effect",
+        "register_effect",
+        "unregister_effect",
+        "set_effect_enabled",
+        "is_stream_active",
+        "is_source_active"
+    };
+    if ((uint32_t)call >= API_CNT) {
+        return "unknown";
+    }
+    return sNames[call];
+}
+
+const char *AudioPolicyStats::counterName(counter c)
+{
+    static const char * const sNames[COUNTER_CNT] = {
+        "sleeps",
+        "sleep_ms",
+        "open_output",
+        "close_output",
+        "open_input",
+        "close_input",
+        "routing",
+        "set_parameters",
+        "get_parameters",
+        "set_stream_volume",
+        "invalidate_stream"
+    };
+    if ((uint32_t)c >= COUNTER_CNT) {
+        return "unknown";
+    }
+    return sNames[c];
+}
+
+void AudioPolicyStats::recordCall(api call, nsecs_t duration)
+{
+    if ((uint32_t)call >= API_CNT) {
+        return;
+    }
+    nsecs_t us = ns2us(duration);
+    if (us < 0) {
+        us = 0;
+    } else if (us > INT32_MAX) {
+        us = INT32_MAX;
+    }
+    // index of the highest bit set + 1: 1 us -> 1, 2..3 us -> 2, 4..7 us -> 3...
+    int bucket = (us == 0) ? 0 : 32 - __builtin_clz((uint32_t)us);
+    if (bucket >= HISTOGRAM_BUCKETS) {
+        bucket = HISTOGRAM_BUCKETS - 1;
+    }
+    android_atomic_inc(&mHistograms[call][bucket]);
+
+    int32_t max = mMaxUs[call];
+    while ((int32_t)us > max) {
+        // android_atomic_cmpxchg() returns 0 if the value was swapped
+        if (android_atomic_cmpxchg(max, (int32_t)us, &mMaxUs[call]) == 0) {
+            break;
+        }
+        max = mMaxUs[call];
+    }
+}
+
+void AudioPolicyStats::increment(counter c, int32_t value)
+{
+    if ((uint32_t)c >= COUNTER_CNT) {
+        return;
+    }
+    android_atomic_add(value, &mCounters[c]);
+}
+
+bool AudioPolicyStats::enterCall()
+{
+    if (!mThreadKeyValid) {
+        return false;
+    }
+    intptr_t state = (intptr_t)pthread_getspecific(mThreadKey);
+    pthread_setspecific(mThreadKey, (void *)(state + (1 << CALL_DEPTH_SHIFT)));
+    return (state >> CALL_DEPTH_SHIFT) == 0;
+}
+
+void AudioPolicyStats::exitCall()
+{
+    if (!mThreadKeyValid) {
+        return;
+    }
+    intptr_t state = (intptr_t)pthread_getspecific(mThreadKey);
+    if ((state >> CALL_DEPTH_SHIFT) == 0) {
+        return;
+    }
+    state -= (1 << CALL_DEPTH_SHIFT);
+    if ((state >> CALL_DEPTH_SHIFT) == 0) {
+        state = 0;
+    }
+    pthread_setspecific(mThreadKey, (void *)state);
+}
+
+AudioPolicyStats::api AudioPolicyStats::currentCall() const
+{
+    if (!mThreadKeyValid) {
+        return API_CNT;
+    }
+    intptr_t state = (intptr_t)pthread_getspecific(mThreadKey);
+    if ((state >> CALL_DEPTH_SHIFT) == 0) {
+        return API_CNT;
+    }
+    return (api)(state & CALL_API_MASK);
+}
+
+void AudioPolicyStats::setCurrentCall(api call)
+{
+    if (!mThreadKeyValid) {
+        return;
+    }
+    intptr_t state = (intptr_t)pthread_getspecific(mThreadKey);
+    if ((state >> CALL_DEPTH_SHIFT) == 0) {
+        return;
+    }
+    pthread_setspecific(mThreadKey, (void *)((state & ~CALL_API_MASK) | (call & CALL_API_MASK)));
+}
+
+uint32_t AudioPolicyStats::percentileUs(api call, uint32_t count, int percent) const
+{
+    uint32_t target = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    uint32_t cumulated = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        cumulated += (uint32_t)mHistograms[call][i];
+        if (cumulated >= target) {
+            return (i == 0) ? 1 : (1 << i);
+        }
+    }
+    return (uint32_t)mMaxUs[call];
+}
+
+status_t AudioPolicyStats::dump(int fd) const
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    snprintf(buffer, SIZE, "\nEntry points latency (us, p50/p99 are bucket upper bounds):\n");
+    write(fd, buffer, strlen(buffer));
+    snprintf(buffer, SIZE, " %-28s %10s %8s %8s %8s\n", "call", "count", "p50", "p99", "max");
+    write(fd, buffer, strlen(buffer));
+    for (int i = 0; i < API_CNT; i++) {
+        uint32_t count = 0;
+        for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            count += (uint32_t)mHistograms[i][j];
+        }
+        if (count == 0) {
+            continue;
+        }
+        snprintf(buffer, SIZE, " %-28s %10u %8u %8u %8d\n", apiName((api)i), count,
+                 percentileUs((api)i, count, 50), percentileUs((api)i, count, 99), mMaxUs[i]);
+        write(fd, buffer, strlen(buffer));
+    }
+
+    snprintf(buffer, SIZE, "\nHAL commands and waits:\n");
+    write(fd, buffer, strlen(buffer));
+    for (int i = 0; i < COUNTER_CNT; i++) {
+        snprintf(buffer, SIZE, " %-28s %10d\n", counterName((counter)i), mCounters[i]);
+        write(fd, buffer, strlen(buffer));
+    }
+    return android::NO_ERROR;
+}
+
+String8 AudioPolicyStats::toString() const
+{
+    AudioParameter param;
+    char key[64];
+
+    for (int i = 0; i < API_CNT; i++) {
+        uint32_t count = 0;
+        for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            count += (uint32_t)mHistograms[i][j];
+        }
+        if (count == 0) {
+            continue;
+        }
+        snprintf(key, sizeof(key), "%s.count", apiName((api)i));
+        param.addInt(String8(key), (int)count);
+        snprintf(key, sizeof(key), "%s.max_us", apiName((api)i));
+        param.addInt(String8(key), mMaxUs[i]);
+        // the full histogram as comma separated bucket counts
+        String8 histogram;
+        for (int j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            histogram.appendFormat(j == 0 ? "%d" : ",%d", mHistograms[i][j]);
+        }
+        snprintf(key, sizeof(key), "%s.histogram", apiName((api)i));
+        param.add(String8(key), histogram);
+    }
+    for (int i = 0; i < COUNTER_CNT; i++) {
+        param.addInt(String8(counterName((counter)i)), mCounters[i]);
+    }
+    return param.toString();
+}
+
+// ----------------------------------------------------------------------------
+// AudioPolicyStatsClient
+// ----------------------------------------------------------------------------
+
+audio_module_handle_t AudioPolicyStatsClient::loadHwModule(const char *name)
+{
+    return mClient->loadHwModule(name);
+}
+
+audio_io_handle_t AudioPolicyStatsClient::openOutput(audio_module_handle_t module,
+                                                     audio_devices_t *pDevices,
+                                                     uint32_t *pSamplingRate,
+                                                     audio_format_t *pFormat,
+                                                     audio_channel_mask_t *pChannelMask,
+                                                     uint32_t *pLatencyMs,
+                                                     audio_output_flags_t flags)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_OPEN_OUTPUT);
+    return mClient->openOutput(module, pDevices, pSamplingRate, pFormat, pChannelMask,
+                               pLatencyMs, flags);
+}
+
+audio_io_handle_t AudioPolicyStatsClient::openDuplicateOutput(audio_io_handle_t output1,
+                                                              audio_io_handle_t output2)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_OPEN_OUTPUT);
+    return mClient->openDuplicateOutput(output1, output2);
+}
+
+status_t AudioPolicyStatsClient::closeOutput(audio_io_handle_t output)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_CLOSE_OUTPUT);
+    return mClient->closeOutput(output);
+}
+
+status_t AudioPolicyStatsClient::suspendOutput(audio_io_handle_t output)
+{
+    return mClient->suspendOutput(output);
+}
+
+status_t AudioPolicyStatsClient::restoreOutput(audio_io_handle_t output)
+{
+    return mClient->restoreOutput(output);
+}
+
+audio_io_handle_t AudioPolicyStatsClient::openInput(audio_module_handle_t module,
+                                                    audio_devices_t *pDevices,
+                                                    uint32_t *pSamplingRate,
+                                                    audio_format_t *pFormat,
+                                                    audio_channel_mask_t *pChannelMask)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_OPEN_INPUT);
+    return mClient->openInput(module, pDevices, pSamplingRate, pFormat, pChannelMask);
+}
+
+status_t AudioPolicyStatsClient::closeInput(audio_io_handle_t input)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_CLOSE_INPUT);
+    return mClient->closeInput(input);
+}
+
+status_t AudioPolicyStatsClient::setStreamVolume(AudioSystem::stream_type stream, float volume,
+                                                 audio_io_handle_t output, int delayMs)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_SET_STREAM_VOLUME);
+    return mClient->setStreamVolume(stream, volume, output, delayMs);
+}
+
+status_t AudioPolicyStatsClient::setStreamOutput(AudioSystem::stream_type stream,
+                                                 audio_io_handle_t output)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_INVALIDATE_STREAM);
+    return mClient->setStreamOutput(stream, output);
+}
+
+void AudioPolicyStatsClient::setParameters(audio_io_handle_t ioHandle,
+                                           const String8& keyValuePairs,
+                                           int delayMs)
+{
+    if (strstr(keyValuePairs.string(), AudioParameter::keyRouting) != NULL) {
+        mStats->increment(AudioPolicyStats::COUNTER_ROUTING);
+    } else {
+        mStats->increment(AudioPolicyStats::COUNTER_SET_PARAMETERS);
+    }
+    mClient->setParameters(ioHandle, keyValuePairs, delayMs);
+}
+
+String8 AudioPolicyStatsClient::getParameters(audio_io_handle_t ioHandle, const String8& keys)
+{
+    mStats->increment(AudioPolicyStats::COUNTER_GET_PARAMETERS);
+    return mClient->getParameters(ioHandle, keys);
+}
+
+status_t AudioPolicyStatsClient::startTone(ToneGenerator::tone_type tone,
+                                           AudioSystem::stream_type stream)
+{
+    return mClient->startTone(tone, stream);
+}
+
+status_t AudioPolicyStatsClient::stopTone()
+{
+    return mClient->stopTone();
+}
+
+status_t AudioPolicyStatsClient::setVoiceVolume(float volume, int delayMs)
+{
+    return mClient->setVoiceVolume(volume, delayMs);
+}
+
+status_t AudioPolicyStatsClient::moveEffects(int session,
+                                             audio_io_handle_t srcOutput,
+                                             audio_io_handle_t dstOutput)
+{
+    return mClient->moveEffects(session, srcOutput, dstOutput);
+}
+
+}; // namespace android_audio_legacy
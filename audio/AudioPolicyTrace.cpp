@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyTrace"
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <cutils/atomic.h>
+
+#include "AudioPolicyTrace.h"
+
+namespace android_audio_legacy {
+
+const char *audioPolicyTraceCallName(uint32_t call)
+{
+    static const char * const sNames[AP_TRACE_CALL_CNT] = {
+        "set_device_connection_state",
+        "get_device_connection_state",
+        "set_phone_state",
+        "set_force_use",
+        "get_force_use",
+        "set_can_mute_enforced_audible",
+        "init_check",
+        "get_output",
+        "start_output",
+        "stop_output",
+        "release_output",
+        "get_input",
+        "start_input",
+        "stop_input",
+        "release_input",
+        "init_stream_volume",
+        "set_stream_volume_index",
+        "get_stream_volume_index",
+        "get_strategy_for_stream",
+        "get_devices_for_stream",
+        "get_output_for_effect",
+        "register_effect",
+        "unregister_effect",
+        "set_effect_enabled",
+        "is_stream_active",
+        "is_source_active"
+    };
+    if (call >= AP_TRACE_CALL_CNT) {
+        return "unknown";
+    }
+    return sNames[call];
+}
+
+AudioPolicyTraceRecorder::AudioPolicyTraceRecorder()
+    : mNext(0)
+{
+    mRecords = (audio_policy_trace_record *)calloc(AUDIO_POLICY_TRACE_RECORDS,
+                                                   sizeof(audio_policy_trace_record));
+}
+
+AudioPolicyTraceRecorder::~AudioPolicyTraceRecorder()
+{
+    free(mRecords);
+}
+
+audio_policy_trace_record *AudioPolicyTraceRecorder::begin(audio_policy_trace_call call,
+                                                           int32_t arg0, int32_t arg1,
+                                                           int32_t arg2, int32_t arg3,
+                                                           int32_t arg4, int32_t arg5)
+{
+    if (mRecords == NULL) {
+        return NULL;
+    }
+    uint32_t index = (uint32_t)android_atomic_inc(&mNext) & (AUDIO_POLICY_TRACE_RECORDS - 1);
+    audio_policy_trace_record *record = &mRecords[index];
+    record->call = (uint16_t)call;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+    record->args[3] = arg3;
+    record->args[4] = arg4;
+    record->args[5] = arg5;
+    record->result = 0;
+    record->duration_ns = 0;
+    record->address[0] = '\0';
+    record->timestamp_ns = systemTime(SYSTEM_TIME_MONOTONIC);
+    return record;
+}
+
+void AudioPolicyTraceRecorder::end(audio_policy_trace_record *record, int32_t result)
+{
+    if (record == NULL) {
+        return;
+    }
+    record->result = result;
+    record->duration_ns = (uint32_t)(systemTime(SYSTEM_TIME_MONOTONIC) - record->timestamp_ns);
+}
+
+android::status_t AudioPolicyTraceRecorder::writeToFile(const char *path)
+{
+    if (mRecords == NULL) {
+        return android::NO_MEMORY;
+    }
+    uint32_t next = (uint32_t)android_atomic_acquire_load(&mNext);
+    audio_policy_trace_header header;
+    header.magic = AUDIO_POLICY_TRACE_MAGIC;
+    header.version = AUDIO_POLICY_TRACE_VERSION;
+    header.record_size = sizeof(audio_policy_trace_record);
+    header.count = (next < AUDIO_POLICY_TRACE_RECORDS) ? next : AUDIO_POLICY_TRACE_RECORDS;
+    header.dropped = next - header.count;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+    if (fd < 0) {
+        ALOGW("writeToFile() cannot open %s: %s", path, strerror(errno));
+        return -errno;
+    }
+    android::status_t status = android::NO_ERROR;
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        status = android::UNKNOWN_ERROR;
+    }
+    // oldest record first
+    uint32_t first = next - header.count;
+    for (uint32_t i = 0; i < header.count && status == android::NO_ERROR; i++) {
+        const audio_policy_trace_record *record =
+                &mRecords[(first + i) & (AUDIO_POLICY_TRACE_RECORDS - 1)];
+        if (write(fd, record, sizeof(*record)) != (ssize_t)sizeof(*record)) {
+            status = android::UNKNOWN_ERROR;
+        }
+    }
+    close(fd);
+    ALOGW_IF(status != android::NO_ERROR, "writeToFile() error writing %s", path);
+    return status;
+}
+
+android::status_t AudioPolicyTraceRecorder::dump(int fd)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    uint32_t next = (uint32_t)android_atomic_acquire_load(&mNext);
+    snprintf(buffer, SIZE, "\nAudio policy trace: %u calls recorded, %u in memory\n",
+             next, (next < AUDIO_POLICY_TRACE_RECORDS) ? next : AUDIO_POLICY_TRACE_RECORDS);
+    write(fd, buffer, strlen(buffer));
+    return android::NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYTRACE_H
+#define ANDROID_AUDIOPOLICYTRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+namespace android_audio_legacy {
+
+/////////////////////////////////////////////////
+//      Binary trace of the calls received by the legacy audio policy HAL
+//
+//      The file starts with an audio_policy_trace_header followed by
+//      header.count audio_policy_trace_record, oldest first. All fields are
+//      in host byte order.
+/////////////////////////////////////////////////
+
+#define AUDIO_POLICY_TRACE_MAGIC 0x52545041 // "APTR"
+#define AUDIO_POLICY_TRACE_VERSION 1
+#define AUDIO_POLICY_TRACE_FILE "/data/misc/audio/audio_policy.trace"
+// number of records kept in memory, must be a power of 2
+#define AUDIO_POLICY_TRACE_RECORDS 4096
+#define AUDIO_POLICY_TRACE_MAX_ARGS 6
+#define AUDIO_POLICY_TRACE_ADDRESS_LEN 20
+
+// one value per audio_policy entry point. Arguments are stored in the order of the
+// audio_policy function parameters unless indicated otherwise.
+enum audio_policy_trace_call {
+    AP_TRACE_SET_DEVICE_CONNECTION_STATE,   // device, state + address
+    AP_TRACE_GET_DEVICE_CONNECTION_STATE,   // device + address
+    AP_TRACE_SET_PHONE_STATE,               // state
+    AP_TRACE_SET_FORCE_USE,                 // usage, config
+    AP_TRACE_GET_FORCE_USE,                 // usage
+    AP_TRACE_SET_CAN_MUTE_ENFORCED_AUDIBLE, // can_mute
+    AP_TRACE_INIT_CHECK,
+    AP_TRACE_GET_OUTPUT,                    // stream, sampling rate, format, channel mask, flags
+    AP_TRACE_START_OUTPUT,                  // output, stream, session
+    AP_TRACE_STOP_OUTPUT,                   // output, stream, session
+    AP_TRACE_RELEASE_OUTPUT,                // output
+    AP_TRACE_GET_INPUT,                     // source, sampling rate, format, channel mask, acoustics
+    AP_TRACE_START_INPUT,                   // input
+    AP_TRACE_STOP_INPUT,                    // input
+    AP_TRACE_RELEASE_INPUT,                 // input
+    AP_TRACE_INIT_STREAM_VOLUME,            // stream, index min, index max
+    AP_TRACE_SET_STREAM_VOLUME_INDEX,       // stream, index, device
+    AP_TRACE_GET_STREAM_VOLUME_INDEX,       // stream, index returned, device
+    AP_TRACE_GET_STRATEGY_FOR_STREAM,       // stream
+    AP_TRACE_GET_DEVICES_FOR_STREAM,        // stream
+    AP_TRACE_GET_OUTPUT_FOR_EFFECT,         // descriptor cpu load, memory usage, flags
+    AP_TRACE_REGISTER_EFFECT,               // io, strategy, session, id,
+                                            // descriptor cpu load, memory usage
+    AP_TRACE_UNREGISTER_EFFECT,             // id
+    AP_TRACE_SET_EFFECT_ENABLED,            // id, enabled
+    AP_TRACE_IS_STREAM_ACTIVE,              // stream, in past ms
+    AP_TRACE_IS_SOURCE_ACTIVE,              // source
+
+    AP_TRACE_CALL_CNT
+};
+
+struct audio_policy_trace_header {
+    uint32_t magic;         // AUDIO_POLICY_TRACE_MAGIC
+    uint32_t version;       // AUDIO_POLICY_TRACE_VERSION
+    uint32_t record_size;   // sizeof(audio_policy_trace_record)
+    uint32_t count;         // number of records following the header
+    uint32_t dropped;       // records overwritten before the trace was written
+};
+
+struct audio_policy_trace_record {
+    int64_t timestamp_ns;   // CLOCK_MONOTONIC time of the call
+    uint32_t duration_ns;   // time spent in the policy manager
+    uint16_t call;          // audio_policy_trace_call
+    uint16_t reserved;
+    int32_t args[AUDIO_POLICY_TRACE_MAX_ARGS];
+    int32_t result;         // value returned to the caller, 0 for void functions
+    char address[AUDIO_POLICY_TRACE_ADDRESS_LEN];  // device address, truncated
+};
+
+const char *audioPolicyTraceCallName(uint32_t call);
+
+// Records the calls in a fixed size ring buffer. begin() and end() do not lock nor allocate
+// and can be called concurrently: a record being written while the trace is saved may be
+// saved incomplete.
+class AudioPolicyTraceRecorder
+{
+public:
+                AudioPolicyTraceRecorder();
+                ~AudioPolicyTraceRecorder();
+
+    // claims the next record for a call and timestamps it
+    audio_policy_trace_record *begin(audio_policy_trace_call call,
+                                     int32_t arg0 = 0, int32_t arg1 = 0, int32_t arg2 = 0,
+                                     int32_t arg3 = 0, int32_t arg4 = 0, int32_t arg5 = 0);
+    // stores the result and the time spent since begin()
+    void end(audio_policy_trace_record *record, int32_t result);
+
+    // writes the records currently in the ring to the specified file
+    android::status_t writeToFile(const char *path);
+    android::status_t dump(int fd);
+
+private:
+    audio_policy_trace_record *mRecords;
+    volatile int32_t mNext;     // index of the next record, before wrapping
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYTRACE_H
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyTransaction"
+//#define LOG_NDEBUG 0
+
+#include <utils/Log.h>
+#include <media/AudioParameter.h>
+
+#include <hardware_legacy/AudioPolicyTransaction.h>
+
+namespace android_audio_legacy {
+
+void AudioPolicyTransactionClient::begin()
+{
+    android::Mutex::Autolock _l(mLock);
+    mDepth++;
+}
+
+void AudioPolicyTransactionClient::commit()
+{
+    android::Mutex::Autolock _l(mLock);
+    if (mDepth == 0) {
+        ALOGW("commit() no transaction in progress");
+        return;
+    }
+    if (--mDepth == 0) {
+        flush_l();
+    }
+}
+
+void AudioPolicyTransactionClient::flush()
+{
+    android::Mutex::Autolock _l(mLock);
+    flush_l();
+}
+
+void AudioPolicyTransactionClient::queue_l(const PendingCommand& command)
+{
+    // latest commands first: a command is only superseded if no routing command on the same
+    // output was queued in between, otherwise the new value would be sent before that
+    // routing instead of after it. Voice volume follows the routing of any output.
+    for (size_t i = mPending.size(); i > 0; i--) {
+        PendingCommand& pending = mPending.editItemAt(i - 1);
+        if (pending.mType == command.mType &&
+                pending.mIoHandle == command.mIoHandle &&
+                pending.mStream == command.mStream &&
+                pending.mDelayMs == command.mDelayMs) {
+            ALOGV("queue_l() command type %d io %d stream %d delay %d superseded",
+                  command.mType, command.mIoHandle, command.mStream, command.mDelayMs);
+            pending.mVolume = command.mVolume;
+            pending.mKeyValuePairs = command.mKeyValuePairs;
+            mCoalesced++;
+            return;
+        }
+        if (pending.mType == ROUTING &&
+                (pending.mIoHandle == command.mIoHandle || command.mType == VOICE_VOLUME)) {
+            break;
+        }
+    }
+    mPending.add(command);
+}
+
+void AudioPolicyTransactionClient::flush_l()
+{
+    for (size_t i = 0; i < mPending.size(); i++) {
+        const PendingCommand& command = mPending[i];
+        switch (command.mType) {
+        case ROUTING:
+            mClient->setParameters(command.mIoHandle, command.mKeyValuePairs, command.mDelayMs);
+            break;
+        case STREAM_VOLUME:
+            mClient->setStreamVolume((AudioSystem::stream_type)command.mStream, command.mVolume,
+                                     command.mIoHandle, command.mDelayMs);
+            break;
+        case VOICE_VOLUME:
+            mClient->setVoiceVolume(command.mVolume, command.mDelayMs);
+            break;
+        }
+    }
+    mPending.clear();
+}
+
+audio_module_handle_t AudioPolicyTransactionClient::loadHwModule(const char *name)
+{
+    flush();
+    return mClient->loadHwModule(name);
+}
+
+audio_io_handle_t AudioPolicyTransactionClient::openOutput(audio_module_handle_t module,
+                                                           audio_devices_t *pDevices,
+                                                           uint32_t *pSamplingRate,
+                                                           audio_format_t *pFormat,
+                                                           audio_channel_mask_t *pChannelMask,
+                                                           uint32_t *pLatencyMs,
+                                                           audio_output_flags_t flags)
+{
+    flush();
+    return mClient->openOutput(module, pDevices, pSamplingRate, pFormat, pChannelMask,
+                               pLatencyMs, flags);
+}
+
+audio_io_handle_t AudioPolicyTransactionClient::openDuplicateOutput(audio_io_handle_t output1,
+                                                                    audio_io_handle_t output2)
+{
+    flush();
+    return mClient->openDuplicateOutput(output1, output2);
+}
+
+status_t AudioPolicyTransactionClient::closeOutput(audio_io_handle_t output)
+{
+    flush();
+    return mClient->closeOutput(output);
+}
+
+status_t AudioPolicyTransactionClient::suspendOutput(audio_io_handle_t output)
+{
+    flush();
+    return mClient->suspendOutput(output);
+}
+
+status_t AudioPolicyTransactionClient::restoreOutput(audio_io_handle_t output)
+{
+    flush();
+    return mClient->restoreOutput(output);
+}
+
+audio_io_handle_t AudioPolicyTransactionClient::openInput(audio_module_handle_t module,
+                                                          audio_devices_t *pDevices,
+                                                          uint32_t *pSamplingRate,
+                                                          audio_format_t *pFormat,
+                                                          audio_channel_mask_t *pChannelMask)
+{
+    flush();
+    return mClient->openInput(module, pDevices, pSamplingRate, pFormat, pChannelMask);
+}
+
+status_t AudioPolicyTransactionClient::closeInput(audio_io_handle_t input)
+{
+    flush();
+    return mClient->closeInput(input);
+}
+
+status_t AudioPolicyTransactionClient::setStreamVolume(AudioSystem::stream_type stream,
+                                                       float volume,
+                                                       audio_io_handle_t output,
+                                                       int delayMs)
+{
+    android::Mutex::Autolock _l(mLock);
+    if (mDepth == 0) {
+        return mClient->setStreamVolume(stream, volume, output, delayMs);
+    }
+    PendingCommand command;
+    command.mType = STREAM_VOLUME;
+    command.mIoHandle = output;
+    command.mStream = stream;
+    command.mDelayMs = delayMs;
+    command.mVolume = volume;
+    queue_l(command);
+    return NO_ERROR;
+}
+
+status_t AudioPolicyTransactionClient::setStreamOutput(AudioSystem::stream_type stream,
+                                                       audio_io_handle_t output)
+{
+    // tracks invalidated now must be restarted on the final routing
+    flush();
+    return mClient->setStreamOutput(stream, output);
+}
+
+void AudioPolicyTransactionClient::setParameters(audio_io_handle_t ioHandle,
+                                                 const String8& keyValuePairs,
+                                                 int delayMs)
+{
+    android::Mutex::Autolock _l(mLock);
+    if (mDepth != 0) {
+        AudioParameter param = AudioParameter(keyValuePairs);
+        int device;
+        if (param.size() == 1 &&
+                param.getInt(String8(AudioParameter::keyRouting), device) == NO_ERROR) {
+            PendingCommand command;
+            command.mType = ROUTING;
+            command.mIoHandle = ioHandle;
+            command.mStream = -1;
+            command.mDelayMs = delayMs;
+            command.mVolume = 0;
+            command.mKeyValuePairs = keyValuePairs;
+            queue_l(command);
+            return;
+        }
+        flush_l();
+    }
+    mClient->setParameters(ioHandle, keyValuePairs, delayMs);
+}
+
+String8 AudioPolicyTransactionClient::getParameters(audio_io_handle_t ioHandle,
+                                                    const String8& keys)
+{
+    flush();
+    return mClient->getParameters(ioHandle, keys);
+}
+
+status_t AudioPolicyTransactionClient::startTone(ToneGenerator::tone_type tone,
+                                                 AudioSystem::stream_type stream)
+{
+    flush();
+    return mClient->startTone(tone, stream);
+}
+
+status_t AudioPolicyTransactionClient::stopTone()
+{
+    flush();
+    return mClient->stopTone();
+}
+
+status_t AudioPolicyTransactionClient::setVoiceVolume(float volume, int delayMs)
+{
+    android::Mutex::Autolock _l(mLock);
+    if (mDepth == 0) {
+        return mClient->setVoiceVolume(volume, delayMs);
+    }
+    PendingCommand command;
+    command.mType = VOICE_VOLUME;
+    command.mIoHandle = 0;
+    command.mStream = -1;
+    command.mDelayMs = delayMs;
+    command.mVolume = volume;
+    queue_l(command);
+    return NO_ERROR;
+}
+
+status_t AudioPolicyTransactionClient::moveEffects(int session,
+                                                   audio_io_handle_t srcOutput,
+                                                   audio_io_handle_t dstOutput)
+{
+    flush();
+    return mClient->moveEffects(session, srcOutput, dstOutput);
+}
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioPolicyWorker"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+
+#include <hardware_legacy/AudioPolicyWorker.h>
+
+namespace android_audio_legacy {
+
+AudioPolicyWorker::AudioPolicyWorker(AudioPolicyClientInterface *client)
+    : mClient(client), mStarted(false), mExit(false), mReplyCount(0)
+{
+}
+
+AudioPolicyWorker::~AudioPolicyWorker()
+{
+    if (mThread != 0) {
+        mThread->requestExit();
+        {
+            Mutex::Autolock _l(mLock);
+            mExit = true;
+            mWorkCond.signal();
+        }
+        mThread->requestExitAndWait();
+        mThread.clear();
+    }
+    for (size_t i = 0; i < mWrites.size(); i++) {
+        writeFileNow(mWrites.keyAt(i), mWrites.valueAt(i));
+    }
+}
+
+bool AudioPolicyWorker::startLocked()
+{
+    if (!mStarted) {
+        mStarted = true;
+        mThread = new WorkerThread(this);
+        if (mThread->run("AudioPolicyWorker", ANDROID_PRIORITY_BACKGROUND) != NO_ERROR) {
+            ALOGW("startLocked() could not start worker thread");
+            mThread.clear();
+        }
+    }
+    return mThread != 0;
+}
+
+void AudioPolicyWorker::query(const Query& query)
+{
+    {
+        Mutex::Autolock _l(mLock);
+        if (startLocked()) {
+            mQueries.add(query);
+            mWorkCond.signal();
+            return;
+        }
+    }
+    Query reply(query);
+    readParameters(&reply);
+    Mutex::Autolock _l(mLock);
+    mReplies.add(reply);
+    android_atomic_release_store(mReplies.size(), &mReplyCount);
+}
+
+bool AudioPolicyWorker::hasReplies() const
+{
+    return android_atomic_acquire_load(&mReplyCount) != 0;
+}
+
+void AudioPolicyWorker::takeReplies(Vector <Query> *replies)
+{
+    Mutex::Autolock _l(mLock);
+    replies->appendVector(mReplies);
+    mReplies.clear();
+    android_atomic_release_store(0, &mReplyCount);
+}
+
+void AudioPolicyWorker::writeFile(const String8& path, const String8& data)
+{
+    {
+        Mutex::Autolock _l(mLock);
+        if (startLocked()) {
+            mWrites.replaceValueFor(path, data);
+            mWorkCond.signal();
+            return;
+        }
+    }
+    writeFileNow(path, data);
+}
+
+bool AudioPolicyWorker::processNext()
+{
+    Mutex::Autolock _l(mLock);
+    while (!mExit && mWrites.isEmpty() && mQueries.isEmpty()) {
+        mWorkCond.wait(mLock);
+    }
+    if (mExit) {
+        return false;
+    }
+    if (!mWrites.isEmpty()) {
+        String8 path = mWrites.keyAt(0);
+        String8 data = mWrites.valueAt(0);
+        mWrites.removeItemsAt(0);
+        mLock.unlock();
+        writeFileNow(path, data);
+        mLock.lock();
+    } else {
+        Query query = mQueries[0];
+        mQueries.removeAt(0);
+        mLock.unlock();
+        readParameters(&query);
+        mLock.lock();
+        mReplies.add(query);
+        android_atomic_release_store(mReplies.size(), &mReplyCount);
+    }
+    return true;
+}
+
+void AudioPolicyWorker::readParameters(Query *query)
+{
+    query->mReplies.clear();
+    for (size_t i = 0; i < query->mKeys.size(); i++) {
+        String8 reply;
+        if (!query->mKeys[i].isEmpty()) {
+            reply = mClient->getParameters(query->mOutput, query->mKeys[i]);
+        }
+        query->mReplies.add(reply);
+    }
+    ALOGV("readParameters() %s output %d: %d replies", query->mTag.string(), query->mOutput,
+          query->mReplies.size());
+}
+
+bool AudioPolicyWorker::writeFileNow(const String8& path, const String8& data)
+{
+    String8 tmpPath(path);
+    tmpPath.append(".tmp");
+    FILE *file = fopen(tmpPath.string(), "w");
+    if (file == NULL) {
+        ALOGV("writeFileNow() cannot open %s", tmpPath.string());
+        return false;
+    }
+    size_t written = fwrite(data.string(), 1, data.size(), file);
+    if (fclose(file) != 0 || written != data.size() ||
+            rename(tmpPath.string(), path.string()) != 0) {
+        ALOGW("writeFileNow() could not write %s", path.string());
+        unlink(tmpPath.string());
+        return false;
+    }
+    return true;
+}
+
+};  // namespace android_audio_legacy
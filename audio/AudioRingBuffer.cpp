@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioRingBuffer"
+//#define LOG_NDEBUG 0
+
+#include <stdlib.h>
+#include <string.h>
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+
+#include "AudioRingBuffer.h"
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+AudioRingBuffer::AudioRingBuffer(size_t capacity)
+    : mBuffer(NULL), mCapacity(0), mRear(0), mFront(0)
+{
+    // indexes are 32 bit: the capacity must leave room to tell a full buffer from an empty one
+    if (capacity == 0 || capacity > 0x40000000) {
+        ALOGE("AudioRingBuffer() invalid capacity %u", capacity);
+        return;
+    }
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    mBuffer = (uint8_t *)malloc(size);
+    if (mBuffer != NULL) {
+        mCapacity = size;
+    }
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+    free(mBuffer);
+}
+
+size_t AudioRingBuffer::availableToWrite() const
+{
+    int32_t front = android_atomic_acquire_load(&mFront);
+    return mCapacity - (size_t)(uint32_t)(mRear - front);
+}
+
+size_t AudioRingBuffer::availableToRead() const
+{
+    int32_t rear = android_atomic_acquire_load(&mRear);
+    return (size_t)(uint32_t)(rear - mFront);
+}
+
+size_t AudioRingBuffer::write(const void *data, size_t bytes)
+{
+    size_t avail = availableToWrite();
+    if (bytes > avail) {
+        bytes = avail;
+    }
+    if (bytes == 0) {
+        return 0;
+    }
+    size_t offset = (uint32_t)mRear & (mCapacity - 1);
+    size_t part1 = mCapacity - offset;
+    if (part1 > bytes) {
+        part1 = bytes;
+    }
+    memcpy(mBuffer + offset, data, part1);
+    memcpy(mBuffer, (const uint8_t *)data + part1, bytes - part1);
+    android_atomic_release_store((int32_t)((uint32_t)mRear + bytes), &mRear);
+    return bytes;
+}
+
+size_t AudioRingBuffer::read(void *data, size_t bytes)
+{
+    size_t avail = availableToRead();
+    if (bytes > avail) {
+        bytes = avail;
+    }
+    if (bytes == 0) {
+        return 0;
+    }
+    size_t offset = (uint32_t)mFront & (mCapacity - 1);
+    size_t part1 = mCapacity - offset;
+    if (part1 > bytes) {
+        part1 = bytes;
+    }
+    memcpy(data, mBuffer + offset, part1);
+    memcpy((uint8_t *)data + part1, mBuffer, bytes - part1);
+    android_atomic_release_store((int32_t)((uint32_t)mFront + bytes), &mFront);
+    return bytes;
+}
+
+void AudioRingBuffer::reset()
+{
+    android_atomic_release_store(0, &mRear);
+    android_atomic_release_store(0, &mFront);
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
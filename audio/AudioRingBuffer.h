@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_RING_BUFFER_H
+#define ANDROID_AUDIO_RING_BUFFER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+// Byte FIFO shared by exactly one producer thread and one consumer thread. Neither side takes a
+// lock: each side only writes its own index and reads the other one with acquire semantics,
+// so the data copied before an index is published is visible to the other side.
+// Waiting for data or space is left to the caller.
+class AudioRingBuffer
+{
+public:
+    // the capacity is rounded up to the next power of 2
+                        AudioRingBuffer(size_t capacity);
+                        ~AudioRingBuffer();
+
+            bool        initCheck() const { return mBuffer != NULL; }
+            size_t      capacity() const { return mCapacity; }
+
+    // producer side: copies up to bytes bytes and returns the number of bytes copied
+            size_t      write(const void *data, size_t bytes);
+            size_t      availableToWrite() const;
+
+    // consumer side: copies up to bytes bytes and returns the number of bytes copied
+            size_t      read(void *data, size_t bytes);
+            size_t      availableToRead() const;
+
+    // empties the buffer. Only valid while neither side is using it.
+            void        reset();
+
+private:
+                        AudioRingBuffer(const AudioRingBuffer&);
+            AudioRingBuffer& operator=(const AudioRingBuffer&);
+
+            uint8_t     *mBuffer;
+            size_t      mCapacity;
+    // free running byte counts, wrapped with mCapacity - 1
+    volatile int32_t    mRear;      // written by the producer
+    volatile int32_t    mFront;     // written by the consumer
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_RING_BUFFER_H
@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioStreamConverter"
+//#define LOG_NDEBUG 0
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <system/audio.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "AudioStreamConverter.h"
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+static inline int16_t clamp16(int32_t sample)
+{
+    if ((sample >> 15) ^ (sample >> 31)) {
+        sample = 0x7FFF ^ (sample >> 31);
+    }
+    return sample;
+}
+
+// 32 bit samples to 16 bit samples: arithmetic shift right then saturation
+static void shiftToPcm16(const int32_t *in, int16_t *out, size_t count, int shift)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    int32x4_t vshift = vdupq_n_s32(-shift);
+    for (; i + 8 <= count; i += 8) {
+        int32x4_t a = vshlq_s32(vld1q_s32(in + i), vshift);
+        int32x4_t b = vshlq_s32(vld1q_s32(in + i + 4), vshift);
+        vst1q_s16(out + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+#elif defined(__SSE2__)
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_sra_epi32(_mm_loadu_si128((const __m128i *)(in + i)), vshift);
+        __m128i b = _mm_sra_epi32(_mm_loadu_si128((const __m128i *)(in + i + 4)), vshift);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = clamp16(in[i] >> shift);
+    }
+}
+
+static void pcm8ToPcm16(const uint8_t *in, int16_t *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (int16_t)((in[i] - 0x80) << 8);
+    }
+}
+
+// may be done in place
+static void downmixToMono(const int16_t *in, int16_t *out, size_t frames)
+{
+    for (size_t i = 0; i < frames; i++) {
+        out[i] = (int16_t)(((int32_t)in[2 * i] + in[2 * i + 1]) >> 1);
+    }
+}
+
+static void upmixToStereo(const int16_t *in, int16_t *out, size_t frames)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON__)
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t stereo;
+        stereo.val[0] = vld1q_s16(in + i);
+        stereo.val[1] = stereo.val[0];
+        vst2q_s16(out + 2 * i, stereo);
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= frames; i += 8) {
+        __m128i mono = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(mono, mono));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(mono, mono));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[2 * i] = out[2 * i + 1] = in[i];
+    }
+}
+
+// PCM_CONVERTER_TAPS products of 16 bit samples by Q15 coefficients
+static inline int32_t dotProductBlock(const int16_t *x, const int16_t *coefs)
+{
+#if defined(__ARM_NEON__)
+    int16x8_t x0 = vld1q_s16(x);
+    int16x8_t x1 = vld1q_s16(x + 8);
+    int16x8_t c0 = vld1q_s16(coefs);
+    int16x8_t c1 = vld1q_s16(coefs + 8);
+    int32x4_t acc = vmull_s16(vget_low_s16(x0), vget_low_s16(c0));
+    acc = vmlal_s16(acc, vget_high_s16(x0), vget_high_s16(c0));
+    acc = vmlal_s16(acc, vget_low_s16(x1), vget_low_s16(c1));
+    acc = vmlal_s16(acc, vget_high_s16(x1), vget_high_s16(c1));
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vpadd_s32(sum, sum);
+    return vget_lane_s32(sum, 0);
+#elif defined(__SSE2__)
+    __m128i acc = _mm_add_epi32(
+            _mm_madd_epi16(_mm_loadu_si128((const __m128i *)x),
+                           _mm_loadu_si128((const __m128i *)coefs)),
+            _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(x + 8)),
+                           _mm_loadu_si128((const __m128i *)(coefs + 8))));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+#else
+    int32_t acc = 0;
+    for (int i = 0; i < PCM_CONVERTER_TAPS; i++) {
+        acc += (int32_t)x[i] * coefs[i];
+    }
+    return acc;
+#endif
+}
+
+// taps products, taps being a multiple of PCM_CONVERTER_TAPS
+static inline int32_t dotProduct(const int16_t *x, const int16_t *coefs, uint32_t taps)
+{
+    int32_t acc = 0;
+    for (uint32_t i = 0; i < taps; i += PCM_CONVERTER_TAPS) {
+        acc += dotProductBlock(x + i, coefs + i);
+    }
+    return acc;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioPcmConverter::AudioPcmConverter()
+    : mInFormat(AUDIO_FORMAT_PCM_16_BIT), mInChannelCount(0), mOutChannelCount(0),
+      mResampleChannelCount(0), mInFrameSize(0), mScratch(NULL), mPhaseCount(0), mStep(0),
+      mPhase(0), mTapCount(0), mCoefs(NULL), mHistoryCount(0)
+{
+    mHistory[0] = mHistory[1] = NULL;
+}
+
+AudioPcmConverter::~AudioPcmConverter()
+{
+    release();
+}
+
+bool AudioPcmConverter::isSupported(int format, uint32_t channelCount)
+{
+    return bytesPerSample(format) != 0 && (channelCount == 1 || channelCount == 2);
+}
+
+size_t AudioPcmConverter::bytesPerSample(int format)
+{
+    switch (format) {
+    case AUDIO_FORMAT_PCM_8_BIT:
+        return sizeof(uint8_t);
+    case AUDIO_FORMAT_PCM_16_BIT:
+        return sizeof(int16_t);
+    case AUDIO_FORMAT_PCM_32_BIT:
+    case AUDIO_FORMAT_PCM_8_24_BIT:
+        return sizeof(int32_t);
+    default:
+        return 0;
+    }
+}
+
+void AudioPcmConverter::release()
+{
+    free(mScratch);
+    mScratch = NULL;
+    delete[] mCoefs;
+    mCoefs = NULL;
+    for (int i = 0; i < 2; i++) {
+        free(mHistory[i]);
+        mHistory[i] = NULL;
+    }
+    mPhaseCount = 0;
+}
+
+status_t AudioPcmConverter::configure(int inFormat, uint32_t inChannelCount, uint32_t inRate,
+                                      uint32_t outChannelCount, uint32_t outRate)
+{
+    release();
+    if (!isSupported(inFormat, inChannelCount) || (outChannelCount != 1 && outChannelCount != 2) ||
+            inRate == 0 || outRate == 0) {
+        return BAD_VALUE;
+    }
+    mInFormat = inFormat;
+    mInChannelCount = inChannelCount;
+    mOutChannelCount = outChannelCount;
+    mResampleChannelCount = (inChannelCount < outChannelCount) ? inChannelCount : outChannelCount;
+    mInFrameSize = inChannelCount * bytesPerSample(inFormat);
+
+    mScratch = (int16_t *)malloc(PCM_CONVERTER_CHUNK_FRAMES * inChannelCount * sizeof(int16_t));
+    if (mScratch == NULL) {
+        return NO_MEMORY;
+    }
+    if (inRate == outRate) {
+        return NO_ERROR;
+    }
+    status_t status = initFilter(inRate, outRate);
+    if (status != NO_ERROR) {
+        release();
+        return status;
+    }
+    for (uint32_t i = 0; i < mResampleChannelCount; i++) {
+        mHistory[i] = (int16_t *)malloc((mTapCount - 1 + PCM_CONVERTER_CHUNK_FRAMES) *
+                                        sizeof(int16_t));
+        if (mHistory[i] == NULL) {
+            release();
+            return NO_MEMORY;
+        }
+    }
+    reset();
+    ALOGV("configure() format %#x channels %u -> %u rate %u -> %u, %u phases step %u",
+          inFormat, inChannelCount, outChannelCount, inRate, outRate, mPhaseCount, mStep);
+    return NO_ERROR;
+}
+
+status_t AudioPcmConverter::initFilter(uint32_t inRate, uint32_t outRate)
+{
+    uint32_t div = gcd(inRate, outRate);
+    uint32_t phases = outRate / div;
+    uint32_t step = inRate / div;
+    if (phases > PCM_CONVERTER_MAX_PHASES || step > phases * PCM_CONVERTER_MAX_DECIMATION) {
+        ALOGW("initFilter() unsupported rate conversion %u -> %u", inRate, outRate);
+        return BAD_VALUE;
+    }
+    // the cutoff frequency drops with the decimation ratio: the filter is lengthened by the
+    // same ratio so that its transition band keeps the same width relative to the output rate
+    uint32_t tapCount = PCM_CONVERTER_TAPS * ((step + phases - 1) / phases);
+    mCoefs = new int16_t[phases * tapCount];
+    if (mCoefs == NULL) {
+        return NO_MEMORY;
+    }
+
+    // windowed sinc with its cutoff a bit below the lowest Nyquist frequency, sampled at the
+    // upsampled rate. Each phase is normalized to unity gain so that the output has no ripple
+    // at the phase rate.
+    double cutoff = 0.9 * ((phases < step) ? (double)phases / step : 1.0);
+    for (uint32_t p = 0; p < phases; p++) {
+        double taps[PCM_CONVERTER_TAPS * PCM_CONVERTER_MAX_DECIMATION];
+        double sum = 0;
+        for (uint32_t k = 0; k < tapCount; k++) {
+            // position relative to the filter center, in input samples
+            double t = k + (double)p / phases - tapCount / 2;
+            double x = cutoff * t * M_PI;
+            double sinc = (x == 0) ? 1.0 : sin(x) / x;
+            double w = (t + tapCount / 2) / tapCount;
+            double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+            taps[k] = cutoff * sinc * window;
+            sum += taps[k];
+        }
+        // stored in reverse order so that the dot product runs forward through the history
+        int16_t *coefs = mCoefs + p * tapCount;
+        int32_t total = 0;
+        uint32_t largest = 0;
+        for (uint32_t k = 0; k < tapCount; k++) {
+            int32_t coef = (int32_t)floor(taps[k] / sum * 32768 + 0.5);
+            coefs[tapCount - 1 - k] = clamp16(coef);
+            total += coefs[tapCount - 1 - k];
+            if (taps[k] > taps[largest]) {
+                largest = k;
+            }
+        }
+        coefs[tapCount - 1 - largest] = clamp16(coefs[tapCount - 1 - largest] + 32768 - total);
+    }
+    mTapCount = tapCount;
+    mPhaseCount = phases;
+    mStep = step;
+    return NO_ERROR;
+}
+
+void AudioPcmConverter::reset()
+{
+    if (!isResampling()) {
+        return;
+    }
+    for (uint32_t i = 0; i < mResampleChannelCount; i++) {
+        memset(mHistory[i], 0, (mTapCount - 1) * sizeof(int16_t));
+    }
+    mHistoryCount = mTapCount - 1;
+    mPhase = 0;
+}
+
+size_t AudioPcmConverter::maxOutFrames(size_t inFrames) const
+{
+    if (!isResampling()) {
+        return inFrames;
+    }
+    return (size_t)(((uint64_t)inFrames + 1) * mPhaseCount / mStep) + 1;
+}
+
+size_t AudioPcmConverter::resample(int16_t *out)
+{
+    // the output frame at the current phase needs the input frames pos - taps + 1 to pos
+    size_t pos = mTapCount - 1;
+    size_t frames = 0;
+    while (pos < mHistoryCount) {
+        const int16_t *coefs = mCoefs + mPhase * mTapCount;
+        size_t first = pos - (mTapCount - 1);
+        int16_t left = clamp16((dotProduct(mHistory[0] + first, coefs, mTapCount) +
+                                (1 << 14)) >> 15);
+        if (mResampleChannelCount == 2) {
+            *out++ = left;
+            *out++ = clamp16((dotProduct(mHistory[1] + first, coefs, mTapCount) +
+                              (1 << 14)) >> 15);
+        } else if (mOutChannelCount == 2) {
+            *out++ = left;
+            *out++ = left;
+        } else {
+            *out++ = left;
+        }
+        frames++;
+        mPhase += mStep;
+        while (mPhase >= mPhaseCount) {
+            mPhase -= mPhaseCount;
+            pos++;
+        }
+    }
+    // keep the history of the next output frame. pos overshoots the last frame by less than
+    // PCM_CONVERTER_MAX_DECIMATION frames, which is less than the history length.
+    size_t start = pos - (mTapCount - 1);
+    for (uint32_t i = 0; i < mResampleChannelCount; i++) {
+        memmove(mHistory[i], mHistory[i] + start, (mHistoryCount - start) * sizeof(int16_t));
+    }
+    mHistoryCount -= start;
+    return frames;
+}
+
+size_t AudioPcmConverter::convert(const void *in, size_t inFrames, int16_t *out)
+{
+    const uint8_t *src = (const uint8_t *)in;
+    size_t outFrames = 0;
+
+    while (inFrames != 0) {
+        size_t frames = (inFrames < PCM_CONVERTER_CHUNK_FRAMES) ?
+                inFrames : PCM_CONVERTER_CHUNK_FRAMES;
+        size_t samples = frames * mInChannelCount;
+        const int16_t *pcm = mScratch;
+        switch (mInFormat) {
+        case AUDIO_FORMAT_PCM_16_BIT:
+            pcm = (const int16_t *)src;
+            break;
+        case AUDIO_FORMAT_PCM_8_BIT:
+            pcm8ToPcm16(src, mScratch, samples);
+            break;
+        case AUDIO_FORMAT_PCM_32_BIT:
+            shiftToPcm16((const int32_t *)src, mScratch, samples, 16);
+            break;
+        case AUDIO_FORMAT_PCM_8_24_BIT:
+            shiftToPcm16((const int32_t *)src, mScratch, samples, 8);
+            break;
+        }
+        if (mInChannelCount > mResampleChannelCount) {
+            downmixToMono(pcm, mScratch, frames);
+            pcm = mScratch;
+        }
+
+        int16_t *dst = out + outFrames * mOutChannelCount;
+        if (isResampling()) {
+            int16_t *left = mHistory[0] + mHistoryCount;
+            if (mResampleChannelCount == 2) {
+                int16_t *right = mHistory[1] + mHistoryCount;
+                for (size_t i = 0; i < frames; i++) {
+                    left[i] = pcm[2 * i];
+                    right[i] = pcm[2 * i + 1];
+                }
+            } else {
+                memcpy(left, pcm, frames * sizeof(int16_t));
+            }
+            mHistoryCount += frames;
+            outFrames += resample(dst);
+        } else {
+            if (mOutChannelCount > mResampleChannelCount) {
+                upmixToStereo(pcm, dst, frames);
+            } else {
+                memcpy(dst, pcm, frames * mOutChannelCount * sizeof(int16_t));
+            }
+            outFrames += frames;
+        }
+        src += frames * mInFrameSize;
+        inFrames -= frames;
+    }
+    return outFrames;
+}
+
+// ----------------------------------------------------------------------------
+
+AudioStreamOutConverter::AudioStreamOutConverter(AudioStreamOut *out)
+    : mOut(out), mFormat(out->format()), mChannels(out->channels()),
+      mSampleRate(out->sampleRate()), mBufferFrames(0), mBuffer(NULL), mStandby(true)
+{
+}
+
+AudioStreamOutConverter::~AudioStreamOutConverter()
+{
+    free(mBuffer);
+}
+
+status_t AudioStreamOutConverter::set(int format, uint32_t channels, uint32_t sampleRate)
+{
+    AutoMutex lock(mLock);
+
+    status_t status = mConverter.configure(format, popcount(channels), sampleRate,
+                                           popcount(mOut->channels()), mOut->sampleRate());
+    if (status != NO_ERROR) {
+        ALOGW("set() cannot convert format %#x channels %#x rate %u to %#x %#x %u",
+              format, channels, sampleRate,
+              mOut->format(), mOut->channels(), mOut->sampleRate());
+        return status;
+    }
+
+    // a client buffer lasts as long as a buffer of the legacy stream
+    size_t legacyFrames = mOut->bufferSize() / mOut->frameSize();
+    size_t frames = (size_t)(((uint64_t)legacyFrames * sampleRate + mOut->sampleRate() - 1) /
+                             mOut->sampleRate());
+    frames = (frames + 15) & ~15;
+    int16_t *buffer = (int16_t *)realloc(mBuffer,
+                                         mConverter.maxOutFrames(frames) *
+                                         mConverter.outFrameSize());
+    if (buffer == NULL) {
+        return NO_MEMORY;
+    }
+    mBuffer = buffer;
+    mBufferFrames = frames;
+    mFormat = format;
+    mChannels = channels;
+    mSampleRate = sampleRate;
+    return NO_ERROR;
+}
+
+size_t AudioStreamOutConverter::bufferSize() const
+{
+    return mBufferFrames * mConverter.inFrameSize();
+}
+
+uint32_t AudioStreamOutConverter::latency() const
+{
+    return mOut->latency();
+}
+
+status_t AudioStreamOutConverter::setVolume(float left, float right)
+{
+    return mOut->setVolume(left, right);
+}
+
+ssize_t AudioStreamOutConverter::write(const void* buffer, size_t bytes)
+{
+    AutoMutex lock(mLock);
+
+    if (mBuffer == NULL) {
+        return NO_INIT;
+    }
+    mStandby = false;
+    const uint8_t *src = (const uint8_t *)buffer;
+    size_t frameSize = mConverter.inFrameSize();
+    size_t frames = bytes / frameSize;
+    while (frames != 0) {
+        size_t count = (frames < mBufferFrames) ? frames : mBufferFrames;
+        size_t outFrames = mConverter.convert(src, count, mBuffer);
+        if (outFrames != 0) {
+            ssize_t ret = mOut->write(mBuffer, outFrames * mConverter.outFrameSize());
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        src += count * frameSize;
+        frames -= count;
+    }
+    return bytes;
+}
+
+status_t AudioStreamOutConverter::standby()
+{
+    AutoMutex lock(mLock);
+
+    if (!mStandby) {
+        mConverter.reset();
+        mStandby = true;
+    }
+    return mOut->standby();
+}
+
+status_t AudioStreamOutConverter::dump(int fd, const Vector<String16>& args)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    snprintf(buffer, SIZE, "AudioStreamOutConverter %p\n", this);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tformat: %#x -> %#x\n", mFormat, mOut->format());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tchannels: %#x -> %#x\n", mChannels, mOut->channels());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tsample rate: %u -> %u\n", mSampleRate, mOut->sampleRate());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tbuffer frames: %u\n", (unsigned int)mBufferFrames);
+    result.append(buffer);
+    ::write(fd, result.string(), result.size());
+    return mOut->dump(fd, args);
+}
+
+status_t AudioStreamOutConverter::setParameters(const String8& keyValuePairs)
+{
+    return mOut->setParameters(keyValuePairs);
+}
+
+String8 AudioStreamOutConverter::getParameters(const String8& keys)
+{
+    return mOut->getParameters(keys);
+}
+
+status_t AudioStreamOutConverter::getRenderPosition(uint32_t *dspFrames)
+{
+    uint32_t frames;
+    status_t status = mOut->getRenderPosition(&frames);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    *dspFrames = (uint32_t)((uint64_t)frames * mSampleRate / mOut->sampleRate());
+    return NO_ERROR;
+}
+
+#ifndef ICS_AUDIO_BLOB
+status_t AudioStreamOutConverter::getNextWriteTimestamp(int64_t *timestamp)
+{
+    return mOut->getNextWriteTimestamp(timestamp);
+}
+#endif
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
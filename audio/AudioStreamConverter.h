@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_STREAM_CONVERTER_H
+#define ANDROID_AUDIO_STREAM_CONVERTER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+
+#include <hardware_legacy/AudioHardwareInterface.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::AutoMutex;
+
+// ----------------------------------------------------------------------------
+
+// taps of each phase of the polyphase resampling filter, multiplied by the decimation ratio
+// rounded up when the output rate is lower than the input rate
+#define PCM_CONVERTER_TAPS 16
+// largest number of filter phases, i.e. of output rate / gcd(input rate, output rate)
+#define PCM_CONVERTER_MAX_PHASES 1024
+// largest input rate / output rate ratio
+#define PCM_CONVERTER_MAX_DECIMATION 8
+// frames converted per pass through the intermediate buffers
+#define PCM_CONVERTER_CHUNK_FRAMES 256
+
+// Converts interleaved linear PCM (8 bit, 16 bit, 32 bit or 8.24 fixed point) in mono or
+// stereo to 16 bit PCM in mono or stereo at another sample rate. Stereo to mono conversion
+// is done before resampling and mono to stereo after, so that only the smaller channel count
+// is resampled. Sample rates are converted with a polyphase FIR filter whose phases are
+// computed once for the exact rate ratio.
+class AudioPcmConverter
+{
+public:
+                        AudioPcmConverter();
+                        ~AudioPcmConverter();
+
+    static  bool        isSupported(int format, uint32_t channelCount);
+    static  size_t      bytesPerSample(int format);
+
+    // returns BAD_VALUE if the conversion is not supported, NO_MEMORY if the filter or
+    // intermediate buffers could not be allocated
+            status_t    configure(int inFormat, uint32_t inChannelCount, uint32_t inRate,
+                                  uint32_t outChannelCount, uint32_t outRate);
+            size_t      inFrameSize() const { return mInFrameSize; }
+            size_t      outFrameSize() const { return mOutChannelCount * sizeof(int16_t); }
+            bool        isResampling() const { return mPhaseCount != 0; }
+            // upper bound of the number of frames convert() produces for inFrames frames
+            size_t      maxOutFrames(size_t inFrames) const;
+
+            // converts all inFrames frames and returns the number of frames written to out
+            size_t      convert(const void *in, size_t inFrames, int16_t *out);
+            // clears the resampler history, e.g. when the stream is restarted after standby
+            void        reset();
+
+private:
+                        AudioPcmConverter(const AudioPcmConverter&);
+            AudioPcmConverter& operator=(const AudioPcmConverter&);
+
+            status_t    initFilter(uint32_t inRate, uint32_t outRate);
+            void        release();
+            // resamples the frames appended to mHistory, in mResampleChannelCount channels
+            size_t      resample(int16_t *out);
+
+    int                 mInFormat;
+    uint32_t            mInChannelCount;
+    uint32_t            mOutChannelCount;
+    // channel count after down mixing, before up mixing
+    uint32_t            mResampleChannelCount;
+    size_t              mInFrameSize;
+    int16_t             *mScratch;      // PCM_CONVERTER_CHUNK_FRAMES 16 bit frames
+
+    // polyphase filter: the output sample n is computed from phase (n * mStep) % mPhaseCount
+    uint32_t            mPhaseCount;    // 0 when not resampling
+    uint32_t            mStep;
+    uint32_t            mPhase;
+    uint32_t            mTapCount;      // taps per phase, a multiple of PCM_CONVERTER_TAPS
+    int16_t             *mCoefs;        // Q15, mTapCount per phase in reverse order
+    // one plane per channel: mTapCount - 1 frames of history then the new frames
+    int16_t             *mHistory[2];
+    size_t              mHistoryCount;
+};
+
+// Output stream decorator presenting the format, channels and sample rate requested by the
+// client over a legacy stream which only accepts its own.
+class AudioStreamOutConverter : public AudioStreamOut {
+public:
+    // the wrapped stream is not deleted with the decorator
+                        AudioStreamOutConverter(AudioStreamOut *out);
+    virtual             ~AudioStreamOutConverter();
+
+            // configures the format presented to the client. The stream must be in standby.
+            status_t    set(int format, uint32_t channels, uint32_t sampleRate);
+            AudioStreamOut* finalStream() const { return mOut; }
+
+    virtual uint32_t    sampleRate() const { return mSampleRate; }
+    virtual size_t      bufferSize() const;
+    virtual uint32_t    channels() const { return mChannels; }
+    virtual int         format() const { return mFormat; }
+    virtual uint32_t    latency() const;
+    virtual status_t    setVolume(float left, float right);
+    virtual ssize_t     write(const void* buffer, size_t bytes);
+    virtual status_t    standby();
+    virtual status_t    dump(int fd, const Vector<String16>& args);
+    virtual status_t    setParameters(const String8& keyValuePairs);
+    virtual String8     getParameters(const String8& keys);
+    virtual status_t    getRenderPosition(uint32_t *dspFrames);
+#ifndef ICS_AUDIO_BLOB
+    virtual status_t    getNextWriteTimestamp(int64_t *timestamp);
+#endif
+
+private:
+    AudioStreamOut      *mOut;
+    // set() is called by the shim while the audio thread may call write()
+    Mutex               mLock;
+    AudioPcmConverter   mConverter;
+    int                 mFormat;
+    uint32_t            mChannels;
+    uint32_t            mSampleRate;
+    size_t              mBufferFrames;  // client frames converted per write to mOut
+    int16_t             *mBuffer;       // converted frames
+    bool                mStandby;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_STREAM_CONVERTER_H
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioStreamOutWriteBehind"
+//#define LOG_NDEBUG 0
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+
+#include "AudioStreamOutWriteBehind.h"
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+AudioStreamOutWriteBehind::AudioStreamOutWriteBehind(AudioStreamOut *out)
+    : mOut(out), mRing(out->bufferSize() * WRITE_BEHIND_BUFFER_COUNT), mChunk(NULL),
+      mChunkSize(out->bufferSize()), mChunkDuration(0), mExit(false), mWriting(false),
+      mWriterWaiting(false), mActive(false), mStarved(false), mWriteError(NO_ERROR),
+      mUnderruns(0), mOverruns(0)
+{
+    size_t frameSize = mOut->frameSize();
+    if (frameSize != 0 && mOut->sampleRate() != 0) {
+        mChunkDuration = (nsecs_t)(mChunkSize / frameSize) * 1000000000LL / mOut->sampleRate();
+    }
+    if (!mRing.initCheck() || mChunkSize == 0) {
+        return;
+    }
+    mChunk = (uint8_t *)malloc(mChunkSize);
+    if (mChunk == NULL) {
+        return;
+    }
+    mThread = new WriterThread(this);
+    if (mThread->run("LegacyWriteBehind", ANDROID_PRIORITY_URGENT_AUDIO) != NO_ERROR) {
+        ALOGW("AudioStreamOutWriteBehind() could not start writer thread");
+        mThread.clear();
+    }
+}
+
+AudioStreamOutWriteBehind::~AudioStreamOutWriteBehind()
+{
+    if (mThread != 0) {
+        mThread->requestExit();
+        {
+            AutoMutex lock(mLock);
+            mExit = true;
+            mDataCond.signal();
+            mSpaceCond.broadcast();
+        }
+        mThread->requestExitAndWait();
+        mThread.clear();
+    }
+    free(mChunk);
+}
+
+status_t AudioStreamOutWriteBehind::initCheck() const
+{
+    return (mThread != 0) ? NO_ERROR : NO_INIT;
+}
+
+uint32_t AudioStreamOutWriteBehind::sampleRate() const
+{
+    return mOut->sampleRate();
+}
+
+size_t AudioStreamOutWriteBehind::bufferSize() const
+{
+    return mOut->bufferSize();
+}
+
+uint32_t AudioStreamOutWriteBehind::channels() const
+{
+    return mOut->channels();
+}
+
+int AudioStreamOutWriteBehind::format() const
+{
+    return mOut->format();
+}
+
+uint32_t AudioStreamOutWriteBehind::latency() const
+{
+    size_t frameSize = mOut->frameSize();
+    if (frameSize == 0 || mOut->sampleRate() == 0) {
+        return mOut->latency();
+    }
+    return mOut->latency() +
+            (uint32_t)((mRing.capacity() / frameSize) * 1000 / mOut->sampleRate());
+}
+
+status_t AudioStreamOutWriteBehind::setVolume(float left, float right)
+{
+    return mOut->setVolume(left, right);
+}
+
+ssize_t AudioStreamOutWriteBehind::write(const void* buffer, size_t bytes)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+    size_t written = 0;
+    nsecs_t waitStart = 0;
+
+    {
+        // the writer thread cannot report to its caller: a failed or short write of queued
+        // audio is returned by the next write()
+        AutoMutex lock(mLock);
+        if (mWriteError != NO_ERROR) {
+            status_t status = mWriteError;
+            mWriteError = NO_ERROR;
+            return status;
+        }
+    }
+
+    while (written < bytes) {
+        size_t count = mRing.write(data + written, bytes - written);
+        written += count;
+        AutoMutex lock(mLock);
+        mActive = true;
+        mStarved = false;
+        if (count != 0 && mWriterWaiting) {
+            mDataCond.signal();
+        }
+        if (written == bytes || mExit) {
+            break;
+        }
+        // the ring is full: the caller is paced by the wrapped stream as without write-behind
+        if (mRing.availableToWrite() == 0) {
+            if (waitStart == 0) {
+                waitStart = systemTime();
+            }
+            mSpaceCond.wait(mLock);
+        }
+    }
+    if (waitStart != 0 && systemTime() - waitStart > mChunkDuration) {
+        android_atomic_inc(&mOverruns);
+    }
+    return written;
+}
+
+status_t AudioStreamOutWriteBehind::standby()
+{
+    {
+        AutoMutex lock(mLock);
+        while (!mExit && (mRing.availableToRead() != 0 || mWriting)) {
+            mSpaceCond.wait(mLock);
+        }
+        mActive = false;
+    }
+    return mOut->standby();
+}
+
+status_t AudioStreamOutWriteBehind::dump(int fd, const Vector<String16>& args)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    snprintf(buffer, SIZE, "AudioStreamOutWriteBehind %p\n", this);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tring capacity: %u bytes\n", (unsigned int)mRing.capacity());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tqueued: %u bytes\n", (unsigned int)mRing.availableToRead());
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tunderruns: %d\n", android_atomic_acquire_load(&mUnderruns));
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\toverruns: %d\n", android_atomic_acquire_load(&mOverruns));
+    result.append(buffer);
+    ::write(fd, result.string(), result.size());
+    return mOut->dump(fd, args);
+}
+
+status_t AudioStreamOutWriteBehind::setParameters(const String8& keyValuePairs)
+{
+    return mOut->setParameters(keyValuePairs);
+}
+
+String8 AudioStreamOutWriteBehind::getParameters(const String8& keys)
+{
+    return mOut->getParameters(keys);
+}
+
+status_t AudioStreamOutWriteBehind::getRenderPosition(uint32_t *dspFrames)
+{
+    return mOut->getRenderPosition(dspFrames);
+}
+
+#ifndef ICS_AUDIO_BLOB
+status_t AudioStreamOutWriteBehind::getNextWriteTimestamp(int64_t *timestamp)
+{
+    return mOut->getNextWriteTimestamp(timestamp);
+}
+#endif
+
+bool AudioStreamOutWriteBehind::writeQueued()
+{
+    size_t count;
+    {
+        AutoMutex lock(mLock);
+        while (!mExit && mRing.availableToRead() == 0) {
+            // lets standby() know the ring is drained
+            mSpaceCond.broadcast();
+            mWriterWaiting = true;
+            if (!mActive || mStarved || mChunkDuration == 0) {
+                mDataCond.wait(mLock);
+                mWriterWaiting = false;
+                continue;
+            }
+            // the wrapped stream has less than one buffer left to play when nothing is
+            // queued for a whole buffer duration: count a starvation once, not once per wake up
+            status_t status = mDataCond.waitRelative(mLock, mChunkDuration);
+            mWriterWaiting = false;
+            if (status == TIMED_OUT && mRing.availableToRead() == 0 && mActive) {
+                mStarved = true;
+                android_atomic_inc(&mUnderruns);
+                ALOGV("writeQueued() underrun");
+            }
+        }
+        if (mExit) {
+            return false;
+        }
+        count = mRing.read(mChunk, mChunkSize);
+        mWriting = true;
+        mSpaceCond.broadcast();
+    }
+
+    ssize_t ret = mOut->write(mChunk, count);
+    if (ret < 0) {
+        ALOGW("writeQueued() write error %d", (int)ret);
+    } else if ((size_t)ret < count) {
+        ALOGW("writeQueued() short write %d of %u bytes", (int)ret, (unsigned int)count);
+    }
+
+    AutoMutex lock(mLock);
+    mWriting = false;
+    if (ret < 0) {
+        mWriteError = (status_t)ret;
+    } else if ((size_t)ret < count) {
+        mWriteError = NOT_ENOUGH_DATA;
+    }
+    if (mRing.availableToRead() == 0) {
+        mSpaceCond.broadcast();
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_STREAM_OUT_WRITE_BEHIND_H
+#define ANDROID_AUDIO_STREAM_OUT_WRITE_BEHIND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+
+#include <hardware_legacy/AudioHardwareInterface.h>
+
+#include "AudioRingBuffer.h"
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::AutoMutex;
+    using android::Condition;
+    using android::Thread;
+    using android::sp;
+
+// ----------------------------------------------------------------------------
+
+// Capacity of the write-behind ring, in buffers of the wrapped stream
+#define WRITE_BEHIND_BUFFER_COUNT 4
+
+// Output stream decorator queuing the written audio in a ring buffer which a dedicated thread
+// writes to the wrapped stream. Legacy streams blocking in write() on a socket (A2DP) or
+// sleeping to pace themselves (generic) then only stall the caller until there is room in the
+// ring, and their write jitter is absorbed by the ring.
+class AudioStreamOutWriteBehind : public AudioStreamOut {
+public:
+    // the wrapped stream is not deleted with the decorator
+                        AudioStreamOutWriteBehind(AudioStreamOut *out);
+    virtual             ~AudioStreamOutWriteBehind();
+
+            status_t    initCheck() const;
+            AudioStreamOut* finalStream() const { return mOut; }
+
+    virtual uint32_t    sampleRate() const;
+    virtual size_t      bufferSize() const;
+    virtual uint32_t    channels() const;
+    virtual int         format() const;
+    // latency of the wrapped stream plus the duration of the ring
+    virtual uint32_t    latency() const;
+    virtual status_t    setVolume(float left, float right);
+    // returns the error of a failed or short write of previously queued audio, if any,
+    // instead of queuing the buffer
+    virtual ssize_t     write(const void* buffer, size_t bytes);
+    // waits for the queued audio to be written before putting the wrapped stream in standby
+    virtual status_t    standby();
+    virtual status_t    dump(int fd, const Vector<String16>& args);
+    virtual status_t    setParameters(const String8& keyValuePairs);
+    virtual String8     getParameters(const String8& keys);
+    virtual status_t    getRenderPosition(uint32_t *dspFrames);
+#ifndef ICS_AUDIO_BLOB
+    virtual status_t    getNextWriteTimestamp(int64_t *timestamp);
+#endif
+
+private:
+    class WriterThread : public Thread {
+    public:
+                        WriterThread(AudioStreamOutWriteBehind *stream)
+                            : Thread(false), mStream(stream) {}
+    private:
+        virtual bool    threadLoop() { return mStream->writeQueued(); }
+        AudioStreamOutWriteBehind *mStream;
+    };
+
+    // writes one buffer of queued audio to the wrapped stream. Returns false to stop the
+    // writer thread.
+            bool        writeQueued();
+
+    AudioStreamOut      *mOut;
+    AudioRingBuffer     mRing;
+    uint8_t             *mChunk;        // buffer used by the writer thread
+    size_t              mChunkSize;
+    nsecs_t             mChunkDuration;
+    sp<WriterThread>    mThread;
+
+    // data goes through mRing without lock. mLock protects the state below and the sleeps:
+    // write() takes it once per chunk queued, but only signals the writer thread if it waits.
+    Mutex               mLock;
+    Condition           mDataCond;      // audio queued or exit requested
+    Condition           mSpaceCond;     // audio dequeued or queue drained
+    bool                mExit;
+    bool                mWriting;       // writer thread in mOut->write()
+    bool                mWriterWaiting; // writer thread waiting on mDataCond
+    bool                mActive;        // audio written since the last standby
+    bool                mStarved;       // ring found empty since the last write()
+    // error or short count of the last write to the wrapped stream, returned by the next
+    // write()
+    status_t            mWriteError;
+
+    // the ring was empty while the stream was active
+    volatile int32_t    mUnderruns;
+    // write() waited for room in the ring for more than one buffer duration
+    volatile int32_t    mOverruns;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_STREAM_OUT_WRITE_BEHIND_H
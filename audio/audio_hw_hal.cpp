@@ -17,8 +17,12 @@
 #define LOG_TAG "legacy_audio_hw_hal"
 //#define LOG_NDEBUG 0
 
+#include <pthread.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <cutils/properties.h>
+#include <utils/Timers.h>
 #include <hardware/hardware.h>
 #include <system/audio.h>
 #include <hardware/audio.h>
@@ -26,6 +30,13 @@
 #include <hardware_legacy/AudioHardwareInterface.h>
 #include <hardware_legacy/AudioSystemLegacy.h>
 
+#include "AudioEffectChain.h"
+#include "AudioStreamConverter.h"
+#include "AudioStreamOutWriteBehind.h"
+
+/* queue output writes in a ring buffer written to the legacy stream by a dedicated thread */
+#define LEGACY_WRITE_BEHIND_PROPERTY "ro.audio.legacy_write_behind"
+
 namespace android_audio_legacy {
 
 extern "C" {
@@ -38,18 +49,37 @@ struct legacy_audio_device {
     struct audio_hw_device device;
 
     struct AudioHardwareInterface *hwif;
+    bool write_behind;
 };
 
 struct legacy_stream_out {
     struct audio_stream_out stream;
 
+    /* stream called by the shim: the last decorator applied to final_out, if any */
     AudioStreamOut *legacy_out;
+    /* stream opened by hwif */
+    AudioStreamOut *final_out;
+    AudioStreamOutWriteBehind *wb_out;
+    AudioStreamOutConverter *conv_out;
+
+    /* presentation clock for legacy streams which do not report their position */
+    pthread_mutex_t clock_lock;
+    /* frames written since the stream left standby */
+    uint64_t frames_written;
+    /* CLOCK_MONOTONIC time at which the last write completed, 0 in standby */
+    nsecs_t last_write_ns;
+
+    AudioEffectChain *fx;
+    /* processed copy of the buffer written by the framework */
+    int16_t *fx_buffer;
+    size_t fx_buffer_size;
 };
 
 struct legacy_stream_in {
     struct audio_stream_in stream;
 
     AudioStreamIn *legacy_in;
+    AudioEffectChain *fx;
 };
 
 
@@ -59,61 +89,158 @@ enum {
     HAL_API_REV_NUM
 } hal_api_rev;
 
-static uint32_t audio_device_conv_table[][HAL_API_REV_NUM] =
-{
-    /* output devices */
-    { AudioSystem::DEVICE_OUT_EARPIECE, AUDIO_DEVICE_OUT_EARPIECE },
-    { AudioSystem::DEVICE_OUT_SPEAKER, AUDIO_DEVICE_OUT_SPEAKER },
-    { AudioSystem::DEVICE_OUT_WIRED_HEADSET, AUDIO_DEVICE_OUT_WIRED_HEADSET },
-    { AudioSystem::DEVICE_OUT_WIRED_HEADPHONE, AUDIO_DEVICE_OUT_WIRED_HEADPHONE },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO, AUDIO_DEVICE_OUT_BLUETOOTH_SCO },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_CARKIT, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER },
-    { AudioSystem::DEVICE_OUT_AUX_DIGITAL, AUDIO_DEVICE_OUT_AUX_DIGITAL },
-    { AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET, AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET },
-    { AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET, AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET },
-    { AudioSystem::DEVICE_OUT_DEFAULT, AUDIO_DEVICE_OUT_DEFAULT },
-    /* input devices */
-    { AudioSystem::DEVICE_IN_COMMUNICATION, AUDIO_DEVICE_IN_COMMUNICATION },
-    { AudioSystem::DEVICE_IN_AMBIENT, AUDIO_DEVICE_IN_AMBIENT },
-    { AudioSystem::DEVICE_IN_BUILTIN_MIC, AUDIO_DEVICE_IN_BUILTIN_MIC },
-    { AudioSystem::DEVICE_IN_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET },
-    { AudioSystem::DEVICE_IN_WIRED_HEADSET, AUDIO_DEVICE_IN_WIRED_HEADSET },
-    { AudioSystem::DEVICE_IN_AUX_DIGITAL, AUDIO_DEVICE_IN_AUX_DIGITAL },
-    { AudioSystem::DEVICE_IN_VOICE_CALL, AUDIO_DEVICE_IN_VOICE_CALL },
-    { AudioSystem::DEVICE_IN_BACK_MIC, AUDIO_DEVICE_IN_BACK_MIC },
-    { AudioSystem::DEVICE_IN_DEFAULT, AUDIO_DEVICE_IN_DEFAULT },
-};
+/* Pairs of equivalent legacy and HAL devices, one device on each side. A legacy device listed
+ * twice (DEVICE_OUT_DEFAULT is DEVICE_OUT_SPEAKER on QCOM_HARDWARE) converts to the HAL device
+ * of its first entry. */
+#define LEGACY_OUT_DEVICE_CONVERSIONS(X) \
+    X(AudioSystem::DEVICE_OUT_EARPIECE, AUDIO_DEVICE_OUT_EARPIECE) \
+    X(AudioSystem::DEVICE_OUT_SPEAKER, AUDIO_DEVICE_OUT_SPEAKER) \
+    X(AudioSystem::DEVICE_OUT_WIRED_HEADSET, AUDIO_DEVICE_OUT_WIRED_HEADSET) \
+    X(AudioSystem::DEVICE_OUT_WIRED_HEADPHONE, AUDIO_DEVICE_OUT_WIRED_HEADPHONE) \
+    X(AudioSystem::DEVICE_OUT_BLUETOOTH_SCO, AUDIO_DEVICE_OUT_BLUETOOTH_SCO) \
+    X(AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET) \
+    X(AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_CARKIT, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT) \
+    X(AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP) \
+    X(AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES) \
+    X(AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER) \
+    X(AudioSystem::DEVICE_OUT_AUX_DIGITAL, AUDIO_DEVICE_OUT_AUX_DIGITAL) \
+    X(AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET, AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET) \
+    X(AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET, AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET) \
+    X(AudioSystem::DEVICE_OUT_DEFAULT, AUDIO_DEVICE_OUT_DEFAULT)
+
+#define LEGACY_IN_DEVICE_CONVERSIONS(X) \
+    X(AudioSystem::DEVICE_IN_COMMUNICATION, AUDIO_DEVICE_IN_COMMUNICATION) \
+    X(AudioSystem::DEVICE_IN_AMBIENT, AUDIO_DEVICE_IN_AMBIENT) \
+    X(AudioSystem::DEVICE_IN_BUILTIN_MIC, AUDIO_DEVICE_IN_BUILTIN_MIC) \
+    X(AudioSystem::DEVICE_IN_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET) \
+    X(AudioSystem::DEVICE_IN_WIRED_HEADSET, AUDIO_DEVICE_IN_WIRED_HEADSET) \
+    X(AudioSystem::DEVICE_IN_AUX_DIGITAL, AUDIO_DEVICE_IN_AUX_DIGITAL) \
+    X(AudioSystem::DEVICE_IN_VOICE_CALL, AUDIO_DEVICE_IN_VOICE_CALL) \
+    X(AudioSystem::DEVICE_IN_BACK_MIC, AUDIO_DEVICE_IN_BACK_MIC) \
+    X(AudioSystem::DEVICE_IN_DEFAULT, AUDIO_DEVICE_IN_DEFAULT)
+
+/* legacy devices deliberately left without HAL equivalent: they convert to no device */
+#ifdef QCOM_HARDWARE
+#define LEGACY_OUT_DEVICES_UNCONVERTED (AudioSystem::DEVICE_OUT_ANC_HEADSET | \
+        AudioSystem::DEVICE_OUT_ANC_HEADPHONE | AudioSystem::DEVICE_OUT_PROXY)
+#define LEGACY_IN_DEVICES_UNCONVERTED (AudioSystem::DEVICE_IN_ANC_HEADSET | \
+        AudioSystem::DEVICE_IN_PROXY | AudioSystem::DEVICE_IN_ANLG_DOCK_HEADSET)
+#else
+#define LEGACY_OUT_DEVICES_UNCONVERTED 0
+#define LEGACY_IN_DEVICES_UNCONVERTED 0
+#endif
+
+#define DEVICE_CONV_OR_LEGACY(legacy, hal) | (uint32_t)(legacy)
+#define DEVICE_CONV_HAL_BITS(hal) ((uint32_t)(hal) & ~(uint32_t)AUDIO_DEVICE_BIT_IN)
+#define DEVICE_CONV_SINGLE(legacy, hal) \
+    && ((legacy) & ((legacy) - 1)) == 0 \
+    && (DEVICE_CONV_HAL_BITS(hal) & (DEVICE_CONV_HAL_BITS(hal) - 1)) == 0
+
+/* every legacy device is either converted or listed as unconverted, and every entry converts
+ * a single device so that the tables below can be indexed by bit position */
+typedef char legacy_out_devices_complete[
+        ((0 LEGACY_OUT_DEVICE_CONVERSIONS(DEVICE_CONV_OR_LEGACY)) |
+         (uint32_t)LEGACY_OUT_DEVICES_UNCONVERTED) ==
+                (uint32_t)AudioSystem::DEVICE_OUT_ALL ? 1 : -1];
+typedef char legacy_in_devices_complete[
+        ((0 LEGACY_IN_DEVICE_CONVERSIONS(DEVICE_CONV_OR_LEGACY)) |
+         (uint32_t)LEGACY_IN_DEVICES_UNCONVERTED) ==
+                (uint32_t)AudioSystem::DEVICE_IN_ALL ? 1 : -1];
+typedef char device_conversions_single[
+        (1 LEGACY_OUT_DEVICE_CONVERSIONS(DEVICE_CONV_SINGLE)
+           LEGACY_IN_DEVICE_CONVERSIONS(DEVICE_CONV_SINGLE)) ? 1 : -1];
+
+/* Direct-indexed conversion tables, filled once from the lists above. Legacy input and output
+ * devices share one bit space; HAL devices are indexed without AUDIO_DEVICE_BIT_IN. */
+static uint32_t legacy_to_hal_device[32];
+static uint32_t hal_out_to_legacy_device[32];
+static uint32_t hal_in_to_legacy_device[32];
+static pthread_once_t device_conv_once = PTHREAD_ONCE_INIT;
+
+static void add_device_conversion(uint32_t legacy, uint32_t hal, uint32_t *hal_to_legacy)
+{
+    uint32_t legacy_bit = 31 - __builtin_clz(legacy);
+    uint32_t hal_bit = 31 - __builtin_clz(DEVICE_CONV_HAL_BITS(hal));
+
+    if (legacy_to_hal_device[legacy_bit] == AUDIO_DEVICE_NONE)
+        legacy_to_hal_device[legacy_bit] = hal;
+    hal_to_legacy[hal_bit] = legacy;
+}
+
+static void init_device_conversions()
+{
+#define DEVICE_CONV_ADD_OUT(legacy, hal) \
+    add_device_conversion(legacy, hal, hal_out_to_legacy_device);
+#define DEVICE_CONV_ADD_IN(legacy, hal) \
+    add_device_conversion(legacy, hal, hal_in_to_legacy_device);
+    LEGACY_OUT_DEVICE_CONVERSIONS(DEVICE_CONV_ADD_OUT)
+    LEGACY_IN_DEVICE_CONVERSIONS(DEVICE_CONV_ADD_IN)
+#undef DEVICE_CONV_ADD_OUT
+#undef DEVICE_CONV_ADD_IN
+}
 
 static uint32_t convert_audio_device(uint32_t from_device, int from_rev, int to_rev)
 {
-    const uint32_t k_num_devices = sizeof(audio_device_conv_table)/sizeof(uint32_t)/HAL_API_REV_NUM;
+    const uint32_t *table;
     uint32_t to_device = AUDIO_DEVICE_NONE;
-    uint32_t in_bit = 0;
 
-    if (from_rev != HAL_API_REV_1_0) {
-        in_bit = from_device & AUDIO_DEVICE_BIT_IN;
+    if (from_rev == to_rev)
+        return from_device;
+
+    if (from_rev == HAL_API_REV_1_0) {
+        table = legacy_to_hal_device;
+    } else if (from_device & AUDIO_DEVICE_BIT_IN) {
+        table = hal_in_to_legacy_device;
         from_device &= ~AUDIO_DEVICE_BIT_IN;
+    } else {
+        table = hal_out_to_legacy_device;
     }
 
     while (from_device) {
         uint32_t i = 31 - __builtin_clz(from_device);
-        uint32_t cur_device = (1 << i) | in_bit;
 
-        for (i = 0; i < k_num_devices; i++) {
-            if (audio_device_conv_table[i][from_rev] == cur_device) {
-                to_device |= audio_device_conv_table[i][to_rev];
-                break;
-            }
-        }
-        from_device &= ~cur_device;
+        to_device |= table[i];
+        from_device &= ~(1u << i);
     }
     return to_device;
 }
 
+/* Converts the device of the routing key of a key/value pair string. Strings without routing
+ * key are returned unchanged, without copy, and a lone routing pair, which is what routing
+ * updates send, is rewritten in a stack buffer. Only strings mixing the routing key with other
+ * keys go through AudioParameter. */
+static String8 convert_routing_parameters(const String8& kvpairs, int from_rev, int to_rev)
+{
+    static const char k_routing_pair[] = AUDIO_PARAMETER_STREAM_ROUTING "=";
+    const char *str = kvpairs.string();
+    int val;
+
+    if (strstr(str, AUDIO_PARAMETER_STREAM_ROUTING) == NULL)
+        return kvpairs;
+
+    if (strncmp(str, k_routing_pair, sizeof(k_routing_pair) - 1) == 0 &&
+            strchr(str, ';') == NULL) {
+        char buf[sizeof(k_routing_pair) + 16];
+        const char *value = str + sizeof(k_routing_pair) - 1;
+        char *end;
+
+        val = strtol(value, &end, 0);
+        if (end == value || *end != '\0')
+            return kvpairs;
+        val = convert_audio_device(val, from_rev, to_rev);
+        snprintf(buf, sizeof(buf), "%s%d", k_routing_pair, val);
+        return String8(buf);
+    }
+
+    AudioParameter parms = AudioParameter(kvpairs);
+    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) != NO_ERROR)
+        return kvpairs;
+    val = convert_audio_device(val, from_rev, to_rev);
+    parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
+    parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
+    return parms.toString();
+}
+
 
 /** audio_stream_out implementation **/
 static uint32_t out_get_sample_rate(const struct audio_stream *stream)
@@ -123,14 +250,44 @@ static uint32_t out_get_sample_rate(const struct audio_stream *stream)
     return out->legacy_out->sampleRate();
 }
 
+/* formats, channels and rates not supported by the legacy stream are converted. The
+ * converter is inserted and reconfigured in standby only: out_write() and the getters of
+ * other threads must not see legacy_out change under them. */
+static int out_set_config(struct legacy_stream_out *out, int format, uint32_t channels,
+                          uint32_t rate)
+{
+    AudioStreamOut *legacy_out = out->legacy_out;
+    bool standby;
+
+    if (format == legacy_out->format() && channels == legacy_out->channels() &&
+            rate == legacy_out->sampleRate())
+        return 0;
+
+    pthread_mutex_lock(&out->clock_lock);
+    standby = out->last_write_ns == 0;
+    pthread_mutex_unlock(&out->clock_lock);
+    if (!standby) {
+        ALOGW("%s: stream not in standby", __func__);
+        return -EBUSY;
+    }
+    if (!out->conv_out) {
+        if (!AudioPcmConverter::isSupported(format, popcount(channels)))
+            return -EINVAL;
+        out->conv_out = new AudioStreamOutConverter(legacy_out);
+        out->legacy_out = out->conv_out;
+    }
+    out->conv_out->standby();
+    if (out->conv_out->set(format, channels, rate) != NO_ERROR)
+        return -EINVAL;
+    return 0;
+}
+
 static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 {
     struct legacy_stream_out *out =
         reinterpret_cast<struct legacy_stream_out *>(stream);
 
-    ALOGE("(%s:%d) %s: Implement me!", __FILE__, __LINE__, __func__);
-    /* TODO: implement this */
-    return 0;
+    return out_set_config(out, out->legacy_out->format(), out->legacy_out->channels(), rate);
 }
 
 static size_t out_get_buffer_size(const struct audio_stream *stream)
@@ -159,16 +316,48 @@ static int out_set_format(struct audio_stream *stream, audio_format_t format)
 {
     struct legacy_stream_out *out =
         reinterpret_cast<struct legacy_stream_out *>(stream);
-    ALOGE("(%s:%d) %s: Implement me!", __FILE__, __LINE__, __func__);
-    /* TODO: implement me */
-    return 0;
+
+    return out_set_config(out, format, out->legacy_out->channels(),
+                          out->legacy_out->sampleRate());
+}
+
+/* The legacy stream holds latency() ms of audio when a write completes, then plays it in
+ * real time: estimates the frames presented and the audio still queued at time now. */
+static void out_get_presentation(const struct legacy_stream_out *out, nsecs_t now,
+                                 uint64_t *presented, nsecs_t *queued_ns)
+{
+    pthread_mutex_t *lock = const_cast<pthread_mutex_t *>(&out->clock_lock);
+    uint64_t frames;
+    nsecs_t last_write_ns;
+    uint64_t queued_frames;
+
+    pthread_mutex_lock(lock);
+    frames = out->frames_written;
+    last_write_ns = out->last_write_ns;
+    pthread_mutex_unlock(lock);
+
+    *queued_ns = 0;
+    if (last_write_ns != 0)
+        *queued_ns = milliseconds_to_nanoseconds(out->legacy_out->latency()) -
+                (now - last_write_ns);
+    if (*queued_ns < 0)
+        *queued_ns = 0;
+
+    queued_frames = (uint64_t)*queued_ns * out->legacy_out->sampleRate() / 1000000000LL;
+    *presented = (queued_frames < frames) ? frames - queued_frames : 0;
 }
 
 static int out_standby(struct audio_stream *stream)
 {
     struct legacy_stream_out *out =
         reinterpret_cast<struct legacy_stream_out *>(stream);
-    return out->legacy_out->standby();
+    int ret = out->legacy_out->standby();
+
+    pthread_mutex_lock(&out->clock_lock);
+    out->frames_written = 0;
+    out->last_write_ns = 0;
+    pthread_mutex_unlock(&out->clock_lock);
+    return ret;
 }
 
 static int out_dump(const struct audio_stream *stream, int fd)
@@ -176,6 +365,7 @@ static int out_dump(const struct audio_stream *stream, int fd)
     const struct legacy_stream_out *out =
         reinterpret_cast<const struct legacy_stream_out *>(stream);
     Vector<String16> args;
+    out->fx->dump(fd);
     return out->legacy_out->dump(fd, args);
 }
 
@@ -183,18 +373,13 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
     struct legacy_stream_out *out =
         reinterpret_cast<struct legacy_stream_out *>(stream);
-    int val;
-    String8 s8 = String8(kvpairs);
-    AudioParameter parms = AudioParameter(String8(kvpairs));
-
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_2_0, HAL_API_REV_1_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
+    String8 s8 = out->fx->setParameters(String8(kvpairs));
 
-    return out->legacy_out->setParameters(s8);
+    /* only effect parameters */
+    if (s8.isEmpty() && kvpairs[0] != '\0')
+        return 0;
+    return out->legacy_out->setParameters(
+            convert_routing_parameters(s8, HAL_API_REV_2_0, HAL_API_REV_1_0));
 }
 
 static char * out_get_parameters(const struct audio_stream *stream, const char *keys)
@@ -202,16 +387,24 @@ static char * out_get_parameters(const struct audio_stream *stream, const char *
     const struct legacy_stream_out *out =
         reinterpret_cast<const struct legacy_stream_out *>(stream);
     String8 s8;
-    int val;
 
     s8 = out->legacy_out->getParameters(String8(keys));
-
-    AudioParameter parms = AudioParameter(s8);
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_1_0, HAL_API_REV_2_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
+    s8 = convert_routing_parameters(s8, HAL_API_REV_1_0, HAL_API_REV_2_0);
+
+    /* answer the drain time from the presentation clock if the legacy stream does not */
+    if (strstr(keys, AUDIO_PARAMETER_STREAM_DRAIN_MS) != NULL) {
+        AudioParameter reply = AudioParameter(s8);
+        String8 key = String8(AUDIO_PARAMETER_STREAM_DRAIN_MS);
+        String8 value;
+        uint64_t presented;
+        nsecs_t queued_ns;
+
+        if (reply.get(key, value) != NO_ERROR) {
+            out_get_presentation(out, systemTime(SYSTEM_TIME_MONOTONIC), &presented,
+                                 &queued_ns);
+            reply.addInt(key, (int)nanoseconds_to_milliseconds(queued_ns));
+            s8 = reply.toString();
+        }
     }
 
     return strdup(s8.string());
@@ -237,7 +430,39 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
 {
     struct legacy_stream_out *out =
         reinterpret_cast<struct legacy_stream_out *>(stream);
-    return out->legacy_out->write(buffer, bytes);
+    ssize_t ret;
+
+    /* the effects process 16 bit PCM just before the legacy stream */
+    if (!out->fx->isEmpty() && out->legacy_out->format() == AUDIO_FORMAT_PCM_16_BIT) {
+        uint32_t channel_count = popcount(out->legacy_out->channels());
+
+        if (bytes > out->fx_buffer_size) {
+            int16_t *fx_buffer = (int16_t *)realloc(out->fx_buffer, bytes);
+            if (fx_buffer) {
+                out->fx_buffer = fx_buffer;
+                out->fx_buffer_size = bytes;
+            }
+        }
+        if (bytes <= out->fx_buffer_size) {
+            out->fx->process((const int16_t *)buffer, out->fx_buffer,
+                             bytes / (channel_count * sizeof(int16_t)),
+                             out->legacy_out->sampleRate(), channel_count);
+            buffer = out->fx_buffer;
+        }
+    }
+
+    ret = out->legacy_out->write(buffer, bytes);
+
+    if (ret > 0) {
+        size_t frame_size = audio_stream_frame_size(&stream->common);
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        pthread_mutex_lock(&out->clock_lock);
+        out->frames_written += ret / frame_size;
+        out->last_write_ns = now;
+        pthread_mutex_unlock(&out->clock_lock);
+    }
+    return ret;
 }
 
 static int out_get_render_position(const struct audio_stream_out *stream,
@@ -245,7 +470,15 @@ static int out_get_render_position(const struct audio_stream_out *stream,
 {
     const struct legacy_stream_out *out =
         reinterpret_cast<const struct legacy_stream_out *>(stream);
-    return out->legacy_out->getRenderPosition(dsp_frames);
+    uint64_t presented;
+    nsecs_t queued_ns;
+
+    if (out->legacy_out->getRenderPosition(dsp_frames) == NO_ERROR)
+        return 0;
+
+    out_get_presentation(out, systemTime(SYSTEM_TIME_MONOTONIC), &presented, &queued_ns);
+    *dsp_frames = (uint32_t)presented;
+    return 0;
 }
 
 #ifndef ICS_AUDIO_BLOB
@@ -254,10 +487,25 @@ static int out_get_next_write_timestamp(const struct audio_stream_out *stream,
 {
     const struct legacy_stream_out *out =
         reinterpret_cast<const struct legacy_stream_out *>(stream);
-    return out->legacy_out->getNextWriteTimestamp(timestamp);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint64_t presented;
+    nsecs_t queued_ns;
+
+    if (out->legacy_out->getNextWriteTimestamp(timestamp) == NO_ERROR)
+        return 0;
+
+    /* audio written now plays after the queued audio, or after the full latency of the
+     * legacy stream if it ran dry */
+    out_get_presentation(out, now, &presented, &queued_ns);
+    if (queued_ns == 0)
+        queued_ns = milliseconds_to_nanoseconds(out->legacy_out->latency());
+    *timestamp = nanoseconds_to_microseconds(now + queued_ns);
+    return 0;
 }
 #endif
 
+/* AudioFlinger already runs the effects of output sessions: only the built-in effects are
+ * applied by out_write() */
 static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
 {
     return 0;
@@ -328,6 +576,7 @@ static int in_dump(const struct audio_stream *stream, int fd)
     const struct legacy_stream_in *in =
         reinterpret_cast<const struct legacy_stream_in *>(stream);
     Vector<String16> args;
+    in->fx->dump(fd);
     return in->legacy_in->dump(fd, args);
 }
 
@@ -335,18 +584,13 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
     struct legacy_stream_in *in =
         reinterpret_cast<struct legacy_stream_in *>(stream);
-    int val;
-    AudioParameter parms = AudioParameter(String8(kvpairs));
-    String8 s8 = String8(kvpairs);
-
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_2_0, HAL_API_REV_1_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
+    String8 s8 = in->fx->setParameters(String8(kvpairs));
 
-    return in->legacy_in->setParameters(s8);
+    /* only effect parameters */
+    if (s8.isEmpty() && kvpairs[0] != '\0')
+        return 0;
+    return in->legacy_in->setParameters(
+            convert_routing_parameters(s8, HAL_API_REV_2_0, HAL_API_REV_1_0));
 }
 
 static char * in_get_parameters(const struct audio_stream *stream,
@@ -355,17 +599,9 @@ static char * in_get_parameters(const struct audio_stream *stream,
     const struct legacy_stream_in *in =
         reinterpret_cast<const struct legacy_stream_in *>(stream);
     String8 s8;
-    int val;
 
     s8 = in->legacy_in->getParameters(String8(keys));
-
-    AudioParameter parms = AudioParameter(s8);
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_1_0, HAL_API_REV_2_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
+    s8 = convert_routing_parameters(s8, HAL_API_REV_1_0, HAL_API_REV_2_0);
 
     return strdup(s8.string());
 }
@@ -382,7 +618,16 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
 {
     struct legacy_stream_in *in =
         reinterpret_cast<struct legacy_stream_in *>(stream);
-    return in->legacy_in->read(buffer, bytes);
+    ssize_t ret = in->legacy_in->read(buffer, bytes);
+
+    if (ret > 0 && !in->fx->isEmpty() &&
+            in->legacy_in->format() == AUDIO_FORMAT_PCM_16_BIT) {
+        uint32_t channel_count = popcount(in->legacy_in->channels());
+        in->fx->process((int16_t *)buffer, (int16_t *)buffer,
+                        ret / (channel_count * sizeof(int16_t)),
+                        in->legacy_in->sampleRate(), channel_count);
+    }
+    return ret;
 }
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
@@ -396,13 +641,20 @@ static int in_add_audio_effect(const struct audio_stream *stream, effect_handle_
 {
     const struct legacy_stream_in *in =
         reinterpret_cast<const struct legacy_stream_in *>(stream);
-    return in->legacy_in->addAudioEffect(effect);
+
+    /* effects the legacy stream cannot run are run by the shim */
+    if (in->legacy_in->addAudioEffect(effect) == NO_ERROR)
+        return 0;
+    return in->fx->addEffect(effect);
 }
 
 static int in_remove_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
 {
     const struct legacy_stream_in *in =
         reinterpret_cast<const struct legacy_stream_in *>(stream);
+
+    if (in->fx->removeEffect(effect) == NO_ERROR)
+        return 0;
     return in->legacy_in->removeAudioEffect(effect);
 }
 
@@ -517,6 +769,15 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     status_t status;
     struct legacy_stream_out *out;
     int ret;
+#ifndef ICS_AUDIO_BLOB
+    int *format = (int *) &config->format;
+    uint32_t *channels = &config->channel_mask;
+    uint32_t *sample_rate = &config->sample_rate;
+#endif
+    int req_format = *format;
+    uint32_t req_channels = *channels;
+    uint32_t req_rate = *sample_rate;
+    bool convert = false;
 
     out = (struct legacy_stream_out *)calloc(1, sizeof(*out));
     if (!out)
@@ -524,20 +785,50 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 
     devices = convert_audio_device(devices, HAL_API_REV_2_0, HAL_API_REV_1_0);
 
-#ifndef ICS_AUDIO_BLOB
-    out->legacy_out = ladev->hwif->openOutputStream(devices, (int *) &config->format,
-                                                    &config->channel_mask,
-                                                    &config->sample_rate, &status);
-#else
     out->legacy_out = ladev->hwif->openOutputStream(devices, format, channels,
                                                     sample_rate, &status);
-#endif
+
+    /* legacy streams reject a configuration they do not support and return the one they
+     * support instead: open the stream with that one and convert to it */
+    if (!out->legacy_out && status == BAD_VALUE && req_rate != 0 &&
+            AudioPcmConverter::isSupported(req_format, popcount(req_channels))) {
+        out->legacy_out = ladev->hwif->openOutputStream(devices, format, channels,
+                                                        sample_rate, &status);
+        convert = true;
+    }
 
     if (!out->legacy_out) {
         ret = status;
         goto err_open;
     }
 
+    out->final_out = out->legacy_out;
+    if (ladev->write_behind) {
+        out->wb_out = new AudioStreamOutWriteBehind(out->final_out);
+        if (out->wb_out->initCheck() == NO_ERROR) {
+            out->legacy_out = out->wb_out;
+        } else {
+            ALOGW("%s: write-behind unavailable, writing synchronously", __func__);
+            delete out->wb_out;
+            out->wb_out = NULL;
+        }
+    }
+
+    if (convert) {
+        out->conv_out = new AudioStreamOutConverter(out->legacy_out);
+        if (out->conv_out->set(req_format, req_channels, req_rate) != NO_ERROR) {
+            ret = -EINVAL;
+            goto err_convert;
+        }
+        out->legacy_out = out->conv_out;
+        *format = req_format;
+        *channels = req_channels;
+        *sample_rate = req_rate;
+    }
+
+    pthread_mutex_init(&out->clock_lock, NULL);
+    out->fx = new AudioEffectChain(AudioEffectChain::OUTPUT);
+
     out->stream.common.get_sample_rate = out_get_sample_rate;
     out->stream.common.set_sample_rate = out_set_sample_rate;
     out->stream.common.get_buffer_size = out_get_buffer_size;
@@ -561,6 +852,10 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     *stream_out = &out->stream;
     return 0;
 
+err_convert:
+    delete out->conv_out;
+    delete out->wb_out;
+    ladev->hwif->closeOutputStream(out->final_out);
 err_open:
     free(out);
     *stream_out = NULL;
@@ -573,7 +868,16 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
     struct legacy_audio_device *ladev = to_ladev(dev);
     struct legacy_stream_out *out = reinterpret_cast<struct legacy_stream_out *>(stream);
 
-    ladev->hwif->closeOutputStream(out->legacy_out);
+    delete out->conv_out;
+    if (out->wb_out) {
+        /* queued audio is played before the legacy stream is closed */
+        out->wb_out->standby();
+        delete out->wb_out;
+    }
+    ladev->hwif->closeOutputStream(out->final_out);
+    pthread_mutex_destroy(&out->clock_lock);
+    delete out->fx;
+    free(out->fx_buffer);
     free(out);
 }
 
@@ -615,6 +919,8 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         goto err_open;
     }
 
+    in->fx = new AudioEffectChain(AudioEffectChain::INPUT);
+
     in->stream.common.get_sample_rate = in_get_sample_rate;
     in->stream.common.set_sample_rate = in_set_sample_rate;
     in->stream.common.get_buffer_size = in_get_buffer_size;
@@ -648,6 +954,7 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
         reinterpret_cast<struct legacy_stream_in *>(stream);
 
     ladev->hwif->closeInputStream(in->legacy_in);
+    delete in->fx;
     free(in);
 }
 
@@ -684,6 +991,8 @@ static int legacy_adev_open(const hw_module_t* module, const char* name,
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0)
         return -EINVAL;
 
+    pthread_once(&device_conv_once, init_device_conversions);
+
     ladev = (struct legacy_audio_device *)calloc(1, sizeof(*ladev));
     if (!ladev)
         return -ENOMEM;
@@ -717,6 +1026,10 @@ static int legacy_adev_open(const hw_module_t* module, const char* name,
         goto err_create_audio_hw;
     }
 
+    char value[PROPERTY_VALUE_MAX];
+    property_get(LEGACY_WRITE_BEHIND_PROPERTY, value, "0");
+    ladev->write_behind = (strcmp(value, "1") == 0) || (strcasecmp(value, "true") == 0);
+
     *device = &ladev->device.common;
 
     return 0;
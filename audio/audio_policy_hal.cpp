@@ -25,9 +25,14 @@
 #include <hardware/audio_policy.h>
 
 #include <hardware_legacy/AudioPolicyInterface.h>
+#include <hardware_legacy/AudioPolicyRoutingTrace.h>
 #include <hardware_legacy/AudioSystemLegacy.h>
 
 #include "AudioPolicyCompatClient.h"
+#include "AudioPolicyTrace.h"
+
+// File where the routing trace of the policy manager is written if mediaserver crashes
+#define AUDIO_POLICY_ROUTING_TRACE_FILE "/data/misc/audio/audio_policy_routing_trace"
 
 namespace android_audio_legacy {
 
@@ -48,6 +53,9 @@ struct legacy_audio_policy {
     struct audio_policy_service_ops *aps_ops;
     AudioPolicyCompatClient *service_client;
     AudioPolicyInterface *apm;
+#ifdef AUDIO_POLICY_RECORD
+    AudioPolicyTraceRecorder *recorder;
+#endif
 };
 
 static inline struct legacy_audio_policy * to_lap(struct audio_policy *pol)
@@ -60,6 +68,37 @@ static inline const struct legacy_audio_policy * to_clap(const struct audio_poli
     return reinterpret_cast<const struct legacy_audio_policy *>(pol);
 }
 
+// call recording, see AudioPolicyTrace.h. Compiled out unless AUDIO_POLICY_RECORD is defined.
+static inline audio_policy_trace_record *trace_begin(const struct legacy_audio_policy *lap,
+                                                     audio_policy_trace_call call,
+                                                     int32_t arg0 = 0, int32_t arg1 = 0,
+                                                     int32_t arg2 = 0, int32_t arg3 = 0,
+                                                     int32_t arg4 = 0, int32_t arg5 = 0)
+{
+#ifdef AUDIO_POLICY_RECORD
+    return lap->recorder->begin(call, arg0, arg1, arg2, arg3, arg4, arg5);
+#else
+    return NULL;
+#endif
+}
+
+static inline void trace_address(audio_policy_trace_record *record, const char *address)
+{
+    if (record != NULL && address != NULL) {
+        strncpy(record->address, address, AUDIO_POLICY_TRACE_ADDRESS_LEN - 1);
+        record->address[AUDIO_POLICY_TRACE_ADDRESS_LEN - 1] = '\0';
+    }
+}
+
+static inline void trace_end(const struct legacy_audio_policy *lap,
+                             audio_policy_trace_record *record,
+                             int32_t result)
+{
+#ifdef AUDIO_POLICY_RECORD
+    lap->recorder->end(record, result);
+#endif
+}
+
 
 static int ap_set_device_connection_state(struct audio_policy *pol,
                                           audio_devices_t device,
@@ -67,10 +106,15 @@ static int ap_set_device_connection_state(struct audio_policy *pol,
                                           const char *device_address)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setDeviceConnectionState(
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_DEVICE_CONNECTION_STATE,
+                                                    device, state);
+    trace_address(record, device_address);
+    int ret = lap->apm->setDeviceConnectionState(
                     (AudioSystem::audio_devices)device,
                     (AudioSystem::device_connection_state)state,
                     device_address);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static audio_policy_dev_state_t ap_get_device_connection_state(
@@ -79,16 +123,23 @@ static audio_policy_dev_state_t ap_get_device_connection_state(
                                             const char *device_address)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return (audio_policy_dev_state_t)lap->apm->getDeviceConnectionState(
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_DEVICE_CONNECTION_STATE,
+                                                    device);
+    trace_address(record, device_address);
+    audio_policy_dev_state_t state = (audio_policy_dev_state_t)lap->apm->getDeviceConnectionState(
                     (AudioSystem::audio_devices)device,
                     device_address);
+    trace_end(lap, record, state);
+    return state;
 }
 
 static void ap_set_phone_state(struct audio_policy *pol, audio_mode_t state)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_PHONE_STATE, state);
     // as this is the legacy API, don't change it to use audio_mode_t instead of int
     lap->apm->setPhoneState((int) state);
+    trace_end(lap, record, 0);
 }
 
     /* indicate a change in ringer mode */
@@ -104,8 +155,10 @@ static void ap_set_force_use(struct audio_policy *pol,
                           audio_policy_forced_cfg_t config)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_FORCE_USE, usage, config);
     lap->apm->setForceUse((AudioSystem::force_use)usage,
                           (AudioSystem::forced_config)config);
+    trace_end(lap, record, 0);
 }
 
     /* retreive current device category forced for a given usage */
@@ -114,8 +167,11 @@ static audio_policy_forced_cfg_t ap_get_force_use(
                                                audio_policy_force_use_t usage)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return (audio_policy_forced_cfg_t)lap->apm->getForceUse(
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_FORCE_USE, usage);
+    audio_policy_forced_cfg_t config = (audio_policy_forced_cfg_t)lap->apm->getForceUse(
                           (AudioSystem::force_use)usage);
+    trace_end(lap, record, config);
+    return config;
 }
 
 /* if can_mute is true, then audio streams that are marked ENFORCED_AUDIBLE
@@ -124,13 +180,19 @@ static void ap_set_can_mute_enforced_audible(struct audio_policy *pol,
                                              bool can_mute)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_CAN_MUTE_ENFORCED_AUDIBLE,
+                                                    can_mute);
     lap->apm->setSystemProperty("ro.camera.sound.forced", can_mute ? "0" : "1");
+    trace_end(lap, record, 0);
 }
 
 static int ap_init_check(const struct audio_policy *pol)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->initCheck();
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_INIT_CHECK);
+    int ret = lap->apm->initCheck();
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static audio_io_handle_t ap_get_output(struct audio_policy *pol,
@@ -143,32 +205,46 @@ static audio_io_handle_t ap_get_output(struct audio_policy *pol,
     struct legacy_audio_policy *lap = to_lap(pol);
 
     ALOGV("%s: tid %d", __func__, gettid());
-    return lap->apm->getOutput((AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_OUTPUT, stream,
+                                                    sampling_rate, format, channelMask, flags);
+    audio_io_handle_t output = lap->apm->getOutput((AudioSystem::stream_type)stream,
                                sampling_rate, (int) format, channelMask,
                                (AudioSystem::output_flags)flags);
+    trace_end(lap, record, output);
+    return output;
 }
 
 static int ap_start_output(struct audio_policy *pol, audio_io_handle_t output,
                            audio_stream_type_t stream, int session)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->startOutput(output, (AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_START_OUTPUT, output, stream,
+                                                    session);
+    int ret = lap->apm->startOutput(output, (AudioSystem::stream_type)stream,
                                  session);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_stop_output(struct audio_policy *pol, audio_io_handle_t output,
                           audio_stream_type_t stream, int session)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->stopOutput(output, (AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_STOP_OUTPUT, output, stream,
+                                                    session);
+    int ret = lap->apm->stopOutput(output, (AudioSystem::stream_type)stream,
                                 session);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static void ap_release_output(struct audio_policy *pol,
                               audio_io_handle_t output)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_RELEASE_OUTPUT, output);
     lap->apm->releaseOutput(output);
+    trace_end(lap, record, 0);
 }
 
 static audio_io_handle_t ap_get_input(struct audio_policy *pol, audio_source_t inputSource,
@@ -178,26 +254,39 @@ static audio_io_handle_t ap_get_input(struct audio_policy *pol, audio_source_t i
                                       audio_in_acoustics_t acoustics)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->getInput((int) inputSource, sampling_rate, (int) format, channelMask,
-                              (AudioSystem::audio_in_acoustics)acoustics);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_INPUT, inputSource,
+                                                    sampling_rate, format, channelMask,
+                                                    acoustics);
+    audio_io_handle_t input = lap->apm->getInput((int) inputSource, sampling_rate, (int) format,
+                              channelMask, (AudioSystem::audio_in_acoustics)acoustics);
+    trace_end(lap, record, input);
+    return input;
 }
 
 static int ap_start_input(struct audio_policy *pol, audio_io_handle_t input)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->startInput(input);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_START_INPUT, input);
+    int ret = lap->apm->startInput(input);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_stop_input(struct audio_policy *pol, audio_io_handle_t input)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->stopInput(input);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_STOP_INPUT, input);
+    int ret = lap->apm->stopInput(input);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static void ap_release_input(struct audio_policy *pol, audio_io_handle_t input)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_RELEASE_INPUT, input);
     lap->apm->releaseInput(input);
+    trace_end(lap, record, 0);
 }
 
 static void ap_init_stream_volume(struct audio_policy *pol,
@@ -205,8 +294,11 @@ static void ap_init_stream_volume(struct audio_policy *pol,
                                   int index_max)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_INIT_STREAM_VOLUME, stream,
+                                                    index_min, index_max);
     lap->apm->initStreamVolume((AudioSystem::stream_type)stream, index_min,
                                index_max);
+    trace_end(lap, record, 0);
 }
 
 static int ap_set_stream_volume_index(struct audio_policy *pol,
@@ -214,9 +306,13 @@ static int ap_set_stream_volume_index(struct audio_policy *pol,
                                       int index)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_STREAM_VOLUME_INDEX, stream,
+                                                    index, AUDIO_DEVICE_OUT_DEFAULT);
+    int ret = lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
                                           AUDIO_DEVICE_OUT_DEFAULT);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_get_stream_volume_index(const struct audio_policy *pol,
@@ -224,9 +320,16 @@ static int ap_get_stream_volume_index(const struct audio_policy *pol,
                                       int *index)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->getStreamVolumeIndex((AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_STREAM_VOLUME_INDEX, stream,
+                                                    0, AUDIO_DEVICE_OUT_DEFAULT);
+    int ret = lap->apm->getStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
                                           AUDIO_DEVICE_OUT_DEFAULT);
+    if (record != NULL) {
+        record->args[1] = *index;
+    }
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_set_stream_volume_index_for_device(struct audio_policy *pol,
@@ -235,9 +338,13 @@ static int ap_set_stream_volume_index_for_device(struct audio_policy *pol,
                                       audio_devices_t device)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_STREAM_VOLUME_INDEX, stream,
+                                                    index, device);
+    int ret = lap->apm->setStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
                                           device);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_get_stream_volume_index_for_device(const struct audio_policy *pol,
@@ -246,30 +353,48 @@ static int ap_get_stream_volume_index_for_device(const struct audio_policy *pol,
                                       audio_devices_t device)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->getStreamVolumeIndex((AudioSystem::stream_type)stream,
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_STREAM_VOLUME_INDEX, stream,
+                                                    0, device);
+    int ret = lap->apm->getStreamVolumeIndex((AudioSystem::stream_type)stream,
                                           index,
                                           device);
+    if (record != NULL) {
+        record->args[1] = *index;
+    }
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static uint32_t ap_get_strategy_for_stream(const struct audio_policy *pol,
                                            audio_stream_type_t stream)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->getStrategyForStream((AudioSystem::stream_type)stream);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_STRATEGY_FOR_STREAM, stream);
+    uint32_t strategy = lap->apm->getStrategyForStream((AudioSystem::stream_type)stream);
+    trace_end(lap, record, strategy);
+    return strategy;
 }
 
 static audio_devices_t ap_get_devices_for_stream(const struct audio_policy *pol,
                                        audio_stream_type_t stream)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->getDevicesForStream((AudioSystem::stream_type)stream);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_DEVICES_FOR_STREAM, stream);
+    audio_devices_t devices = lap->apm->getDevicesForStream((AudioSystem::stream_type)stream);
+    trace_end(lap, record, devices);
+    return devices;
 }
 
 static audio_io_handle_t ap_get_output_for_effect(struct audio_policy *pol,
                                             const struct effect_descriptor_s *desc)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->getOutputForEffect(desc);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_GET_OUTPUT_FOR_EFFECT,
+                                                    desc->cpuLoad, desc->memoryUsage,
+                                                    desc->flags);
+    audio_io_handle_t output = lap->apm->getOutputForEffect(desc);
+    trace_end(lap, record, output);
+    return output;
 }
 
 static int ap_register_effect(struct audio_policy *pol,
@@ -280,37 +405,60 @@ static int ap_register_effect(struct audio_policy *pol,
                               int id)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->registerEffect(desc, io, strategy, session, id);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_REGISTER_EFFECT, io, strategy,
+                                                    session, id, desc->cpuLoad,
+                                                    desc->memoryUsage);
+    int ret = lap->apm->registerEffect(desc, io, strategy, session, id);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_unregister_effect(struct audio_policy *pol, int id)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->unregisterEffect(id);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_UNREGISTER_EFFECT, id);
+    int ret = lap->apm->unregisterEffect(id);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static int ap_set_effect_enabled(struct audio_policy *pol, int id, bool enabled)
 {
     struct legacy_audio_policy *lap = to_lap(pol);
-    return lap->apm->setEffectEnabled(id, enabled);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_SET_EFFECT_ENABLED, id, enabled);
+    int ret = lap->apm->setEffectEnabled(id, enabled);
+    trace_end(lap, record, ret);
+    return ret;
 }
 
 static bool ap_is_stream_active(const struct audio_policy *pol, audio_stream_type_t stream,
                                 uint32_t in_past_ms)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->isStreamActive((int) stream, in_past_ms);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_IS_STREAM_ACTIVE, stream,
+                                                    in_past_ms);
+    bool active = lap->apm->isStreamActive((int) stream, in_past_ms);
+    trace_end(lap, record, active);
+    return active;
 }
 
 static bool ap_is_source_active(const struct audio_policy *pol, audio_source_t source)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
-    return lap->apm->isSourceActive(source);
+    audio_policy_trace_record *record = trace_begin(lap, AP_TRACE_IS_SOURCE_ACTIVE, source);
+    bool active = lap->apm->isSourceActive(source);
+    trace_end(lap, record, active);
+    return active;
 }
 
 static int ap_dump(const struct audio_policy *pol, int fd)
 {
     const struct legacy_audio_policy *lap = to_clap(pol);
+#ifdef AUDIO_POLICY_RECORD
+    // dumpsys also saves the recorded calls for audio_policy_replay
+    lap->recorder->dump(fd);
+    lap->recorder->writeToFile(AUDIO_POLICY_TRACE_FILE);
+#endif
     return lap->apm->dump(fd);
 }
 
@@ -365,6 +513,9 @@ static int create_legacy_ap(const struct audio_policy_device *device,
 
     lap->service = service;
     lap->aps_ops = aps_ops;
+#ifdef AUDIO_POLICY_RECORD
+    lap->recorder = new AudioPolicyTraceRecorder();
+#endif
     lap->service_client =
         new AudioPolicyCompatClient(aps_ops, service);
     if (!lap->service_client) {
@@ -377,6 +528,7 @@ static int create_legacy_ap(const struct audio_policy_device *device,
         ret = -ENOMEM;
         goto err_create_apm;
     }
+    AudioPolicyRoutingTrace::installFatalSignalHandler(AUDIO_POLICY_ROUTING_TRACE_FILE);
 
     *ap = &lap->policy;
     return 0;
@@ -384,6 +536,9 @@ static int create_legacy_ap(const struct audio_policy_device *device,
 err_create_apm:
     delete lap->service_client;
 err_new_compat_client:
+#ifdef AUDIO_POLICY_RECORD
+    delete lap->recorder;
+#endif
     free(lap);
     *ap = NULL;
     return ret;
@@ -401,6 +556,9 @@ static int destroy_legacy_ap(const struct audio_policy_device *ap_dev,
         destroyAudioPolicyManager(lap->apm);
     if (lap->service_client)
         delete lap->service_client;
+#ifdef AUDIO_POLICY_RECORD
+    delete lap->recorder;
+#endif
     free(lap);
     return 0;
 }
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <new>
+#include <cutils/atomic.h>
+
+#include "AllocationCounter.h"
+
+static volatile int32_t gAllocations = 0;
+
+int32_t allocationCount()
+{
+    return android_atomic_acquire_load(&gAllocations);
+}
+
+#ifdef __GLIBC__
+// glibc lets the program interpose malloc: operator new goes through malloc() and is counted
+// there
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+    android_atomic_inc(&gAllocations);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    android_atomic_inc(&gAllocations);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+    android_atomic_inc(&gAllocations);
+    return __libc_realloc(p, size);
+}
+#endif
+
+void *operator new(size_t size)
+{
+#ifndef __GLIBC__
+    android_atomic_inc(&gAllocations);
+#endif
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        abort();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p)
+{
+    free(p);
+}
+
+void operator delete[](void *p)
+{
+    free(p);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_BENCH_ALLOCATION_COUNTER_H
+#define ANDROID_AUDIO_BENCH_ALLOCATION_COUNTER_H
+
+#include <stdint.h>
+
+// Heap allocation counting for the benchmarks. Linking AllocationCounter.cpp into a benchmark
+// replaces operator new and, with glibc, malloc(), calloc() and realloc(), so that the storage
+// allocated by the C library and by SharedBuffer (Vector, KeyedVector, String8...) is counted
+// as well as the objects created with new.
+
+// number of heap allocations made by the process so far, from any thread
+int32_t allocationCount();
+
+#endif // ANDROID_AUDIO_BENCH_ALLOCATION_COUNTER_H
@@ -0,0 +1,73 @@
+# Copyright 2013 The Android Open Source Project
+
+LOCAL_PATH := $(call my-dir)
+
+ifeq ($(AUDIO_POLICY_BENCH),true)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    AllocationCounter.cpp \
+    FakeAudioPolicyClient.cpp \
+    policy_bench.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+    libaudiopolicy_legacy_host \
+    libmedia_helper \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := audio_policy_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    FakeAudioPolicyClient.cpp \
+    policy_replay.cpp \
+    ../AudioPolicyTrace.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_STATIC_LIBRARIES := \
+    libaudiopolicy_legacy_host \
+    libmedia_helper \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := audio_policy_replay
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
+ifeq ($(AUDIO_HAL_BENCH),true)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    AllocationCounter.cpp \
+    hal_bench.cpp
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+
+LOCAL_STATIC_LIBRARIES := \
+    libaudiohw_legacy_host \
+    libmedia_helper \
+    libutils \
+    libcutils \
+    liblog
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := audio_hw_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FakeAudioPolicyClient"
+//#define LOG_NDEBUG 0
+
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <hardware/audio.h>
+
+#include "FakeAudioPolicyClient.h"
+
+namespace android_audio_legacy {
+
+// latencies reported by the simulated outputs, in milliseconds
+#define FAKE_PRIMARY_LATENCY_MS 40
+#define FAKE_FAST_LATENCY_MS 20
+#define FAKE_DEEP_BUFFER_LATENCY_MS 160
+#define FAKE_DIRECT_LATENCY_MS 50
+
+FakeAudioPolicyClient::Command::Command()
+    : mType(LOAD_HW_MODULE), mIo(0), mArg(0), mDelayMs(0), mVolume(0)
+{
+}
+
+FakeAudioPolicyClient::FakeAudioPolicyClient()
+    : mNextModule(1), mNextIo(1), mOpenDelayUs(0),
+      mSupSamplingRates(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES "=32000|44100|48000"),
+      mSupFormats(AUDIO_PARAMETER_STREAM_SUP_FORMATS "=AUDIO_FORMAT_PCM_16_BIT"),
+      mSupChannels(AUDIO_PARAMETER_STREAM_SUP_CHANNELS
+                   "=AUDIO_CHANNEL_OUT_STEREO|AUDIO_CHANNEL_OUT_5POINT1"),
+      mRecording(false)
+{
+    memset(mCommandCount, 0, sizeof(mCommandCount));
+}
+
+void FakeAudioPolicyClient::setDirectOutputCapabilities(const char *samplingRates,
+                                                        const char *formats,
+                                                        const char *channels)
+{
+    android::Mutex::Autolock _l(mLock);
+    mSupSamplingRates = String8(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES "=");
+    mSupSamplingRates.append(samplingRates);
+    mSupFormats = String8(AUDIO_PARAMETER_STREAM_SUP_FORMATS "=");
+    mSupFormats.append(formats);
+    mSupChannels = String8(AUDIO_PARAMETER_STREAM_SUP_CHANNELS "=");
+    mSupChannels.append(channels);
+}
+
+void FakeAudioPolicyClient::setRecording(bool record)
+{
+    android::Mutex::Autolock _l(mLock);
+    mRecording = record;
+}
+
+Vector<FakeAudioPolicyClient::Command> FakeAudioPolicyClient::commands()
+{
+    android::Mutex::Autolock _l(mLock);
+    return mCommands;
+}
+
+void FakeAudioPolicyClient::clearCommands()
+{
+    android::Mutex::Autolock _l(mLock);
+    mCommands.clear();
+    memset(mCommandCount, 0, sizeof(mCommandCount));
+}
+
+uint32_t FakeAudioPolicyClient::commandCount(command_type type)
+{
+    android::Mutex::Autolock _l(mLock);
+    return mCommandCount[type];
+}
+
+uint32_t FakeAudioPolicyClient::totalCommandCount()
+{
+    android::Mutex::Autolock _l(mLock);
+    uint32_t count = 0;
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        count += mCommandCount[i];
+    }
+    return count;
+}
+
+const char *FakeAudioPolicyClient::commandName(command_type type)
+{
+    static const char * const sNames[NUM_COMMANDS] = {
+        "loadHwModule",
+        "openOutput",
+        "openDuplicateOutput",
+        "closeOutput",
+        "suspendOutput",
+        "restoreOutput",
+        "openInput",
+        "closeInput",
+        "setStreamVolume",
+        "setStreamOutput",
+        "setParameters",
+        "getParameters",
+        "startTone",
+        "stopTone",
+        "setVoiceVolume",
+        "moveEffects"
+    };
+    if (type < 0 || type >= NUM_COMMANDS) {
+        return "unknown";
+    }
+    return sNames[type];
+}
+
+// must be called with mLock held
+void FakeAudioPolicyClient::record(command_type type, int io, int arg, int delayMs,
+                                   float volume, const String8& params)
+{
+    mCommandCount[type]++;
+    if (!mRecording) {
+        return;
+    }
+    Command command;
+    command.mType = type;
+    command.mIo = io;
+    command.mArg = arg;
+    command.mDelayMs = delayMs;
+    command.mVolume = volume;
+    command.mParams = params;
+    mCommands.add(command);
+}
+
+audio_module_handle_t FakeAudioPolicyClient::loadHwModule(const char *name)
+{
+    android::Mutex::Autolock _l(mLock);
+    audio_module_handle_t module = (audio_module_handle_t)mNextModule++;
+    record(LOAD_HW_MODULE, module, 0, 0, 0, String8(name));
+    return module;
+}
+
+audio_io_handle_t FakeAudioPolicyClient::openOutput(audio_module_handle_t module,
+                                                    audio_devices_t *pDevices,
+                                                    uint32_t *pSamplingRate,
+                                                    audio_format_t *pFormat,
+                                                    audio_channel_mask_t *pChannelMask,
+                                                    uint32_t *pLatencyMs,
+                                                    audio_output_flags_t flags)
+{
+    // the delay is not spent with the lock held: a real HAL opens streams in parallel
+    if (mOpenDelayUs != 0) {
+        usleep(mOpenDelayUs);
+    }
+    android::Mutex::Autolock _l(mLock);
+    if (*pSamplingRate == 0) {
+        *pSamplingRate = 44100;
+    }
+    if (*pFormat == AUDIO_FORMAT_DEFAULT) {
+        *pFormat = AUDIO_FORMAT_PCM_16_BIT;
+    }
+    if (*pChannelMask == 0) {
+        *pChannelMask = AUDIO_CHANNEL_OUT_STEREO;
+    }
+    if (flags & AUDIO_OUTPUT_FLAG_DIRECT) {
+        *pLatencyMs = FAKE_DIRECT_LATENCY_MS;
+    } else if (flags & AUDIO_OUTPUT_FLAG_DEEP_BUFFER) {
+        *pLatencyMs = FAKE_DEEP_BUFFER_LATENCY_MS;
+    } else if (flags & AUDIO_OUTPUT_FLAG_FAST) {
+        *pLatencyMs = FAKE_FAST_LATENCY_MS;
+    } else {
+        *pLatencyMs = FAKE_PRIMARY_LATENCY_MS;
+    }
+    audio_io_handle_t output = (audio_io_handle_t)mNextIo++;
+    record(OPEN_OUTPUT, output, *pDevices, 0, 0, String8(""));
+    ALOGV("openOutput() module %d device %x flags %x returns %d", module, *pDevices, flags,
+          output);
+    return output;
+}
+
+audio_io_handle_t FakeAudioPolicyClient::openDuplicateOutput(audio_io_handle_t output1,
+                                                             audio_io_handle_t output2)
+{
+    android::Mutex::Autolock _l(mLock);
+    audio_io_handle_t output = (audio_io_handle_t)mNextIo++;
+    record(OPEN_DUPLICATE_OUTPUT, output, output1, output2);
+    return output;
+}
+
+status_t FakeAudioPolicyClient::closeOutput(audio_io_handle_t output)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(CLOSE_OUTPUT, output);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::suspendOutput(audio_io_handle_t output)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(SUSPEND_OUTPUT, output);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::restoreOutput(audio_io_handle_t output)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(RESTORE_OUTPUT, output);
+    return NO_ERROR;
+}
+
+audio_io_handle_t FakeAudioPolicyClient::openInput(audio_module_handle_t module,
+                                                   audio_devices_t *pDevices,
+                                                   uint32_t *pSamplingRate,
+                                                   audio_format_t *pFormat,
+                                                   audio_channel_mask_t *pChannelMask)
+{
+    if (mOpenDelayUs != 0) {
+        usleep(mOpenDelayUs);
+    }
+    android::Mutex::Autolock _l(mLock);
+    if (*pSamplingRate == 0) {
+        *pSamplingRate = 16000;
+    }
+    if (*pFormat == AUDIO_FORMAT_DEFAULT) {
+        *pFormat = AUDIO_FORMAT_PCM_16_BIT;
+    }
+    if (*pChannelMask == 0) {
+        *pChannelMask = AUDIO_CHANNEL_IN_MONO;
+    }
+    audio_io_handle_t input = (audio_io_handle_t)mNextIo++;
+    record(OPEN_INPUT, input, *pDevices);
+    return input;
+}
+
+status_t FakeAudioPolicyClient::closeInput(audio_io_handle_t input)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(CLOSE_INPUT, input);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::setStreamVolume(AudioSystem::stream_type stream,
+                                                float volume,
+                                                audio_io_handle_t output,
+                                                int delayMs)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(SET_STREAM_VOLUME, output, stream, delayMs, volume);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::setStreamOutput(AudioSystem::stream_type stream,
+                                                audio_io_handle_t output)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(SET_STREAM_OUTPUT, output, stream);
+    return NO_ERROR;
+}
+
+void FakeAudioPolicyClient::setParameters(audio_io_handle_t ioHandle,
+                                          const String8& keyValuePairs,
+                                          int delayMs)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(SET_PARAMETERS, ioHandle, 0, delayMs, 0, keyValuePairs);
+}
+
+String8 FakeAudioPolicyClient::getParameters(audio_io_handle_t ioHandle, const String8& keys)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(GET_PARAMETERS, ioHandle, 0, 0, 0, keys);
+    if (strstr(keys.string(), AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES) != NULL) {
+        return mSupSamplingRates;
+    }
+    if (strstr(keys.string(), AUDIO_PARAMETER_STREAM_SUP_FORMATS) != NULL) {
+        return mSupFormats;
+    }
+    if (strstr(keys.string(), AUDIO_PARAMETER_STREAM_SUP_CHANNELS) != NULL) {
+        return mSupChannels;
+    }
+    return String8("");
+}
+
+status_t FakeAudioPolicyClient::startTone(ToneGenerator::tone_type tone,
+                                          AudioSystem::stream_type stream)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(START_TONE, stream, tone);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::stopTone()
+{
+    android::Mutex::Autolock _l(mLock);
+    record(STOP_TONE, 0);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::setVoiceVolume(float volume, int delayMs)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(SET_VOICE_VOLUME, 0, 0, delayMs, volume);
+    return NO_ERROR;
+}
+
+status_t FakeAudioPolicyClient::moveEffects(int session,
+                                            audio_io_handle_t srcOutput,
+                                            audio_io_handle_t dstOutput)
+{
+    android::Mutex::Autolock _l(mLock);
+    record(MOVE_EFFECTS, dstOutput, session, 0, 0, String8(""));
+    return NO_ERROR;
+}
+
+}; // namespace android_audio_legacy
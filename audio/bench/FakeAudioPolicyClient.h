@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FAKEAUDIOPOLICYCLIENT_H
+#define ANDROID_FAKEAUDIOPOLICYCLIENT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <utils/String8.h>
+
+#include <hardware_legacy/AudioPolicyInterface.h>
+
+namespace android_audio_legacy {
+
+// In-process audio policy client used to run AudioPolicyManagerBase without AudioFlinger.
+// Outputs and inputs are handles only: opening one optionally sleeps to simulate the time
+// spent by a real audio HAL. All commands received from the policy manager can be recorded
+// so that a scenario can be checked or replayed.
+class FakeAudioPolicyClient : public AudioPolicyClientInterface
+{
+public:
+    enum command_type {
+        LOAD_HW_MODULE,
+        OPEN_OUTPUT,
+        OPEN_DUPLICATE_OUTPUT,
+        CLOSE_OUTPUT,
+        SUSPEND_OUTPUT,
+        RESTORE_OUTPUT,
+        OPEN_INPUT,
+        CLOSE_INPUT,
+        SET_STREAM_VOLUME,
+        SET_STREAM_OUTPUT,
+        SET_PARAMETERS,
+        GET_PARAMETERS,
+        START_TONE,
+        STOP_TONE,
+        SET_VOICE_VOLUME,
+        MOVE_EFFECTS,
+        NUM_COMMANDS
+    };
+
+    // command received from the policy manager
+    class Command
+    {
+    public:
+        Command();
+
+        command_type mType;
+        int mIo;            // output or input handle, module handle for LOAD_HW_MODULE
+        int mArg;           // stream, device, session or tone depending on mType
+        int mDelayMs;
+        float mVolume;
+        String8 mParams;    // key value pairs or module name
+    };
+
+                FakeAudioPolicyClient();
+    virtual     ~FakeAudioPolicyClient() {}
+
+    // time spent in openOutput() and openInput(), in microseconds
+    void setOpenDelayUs(uint32_t delayUs) { mOpenDelayUs = delayUs; }
+    // replies to the sup_xxx keys queried on direct outputs with dynamic parameters
+    void setDirectOutputCapabilities(const char *samplingRates,
+                                     const char *formats,
+                                     const char *channels);
+    // when enabled, every command is appended to the list returned by commands()
+    void setRecording(bool record);
+    Vector<Command> commands();
+    void clearCommands();
+    uint32_t commandCount(command_type type);
+    uint32_t totalCommandCount();
+    static const char *commandName(command_type type);
+
+    // AudioPolicyClientInterface
+    virtual audio_module_handle_t loadHwModule(const char *name);
+    virtual audio_io_handle_t openOutput(audio_module_handle_t module,
+                                         audio_devices_t *pDevices,
+                                         uint32_t *pSamplingRate,
+                                         audio_format_t *pFormat,
+                                         audio_channel_mask_t *pChannelMask,
+                                         uint32_t *pLatencyMs,
+                                         audio_output_flags_t flags);
+    virtual audio_io_handle_t openDuplicateOutput(audio_io_handle_t output1,
+                                                  audio_io_handle_t output2);
+    virtual status_t closeOutput(audio_io_handle_t output);
+    virtual status_t suspendOutput(audio_io_handle_t output);
+    virtual status_t restoreOutput(audio_io_handle_t output);
+    virtual audio_io_handle_t openInput(audio_module_handle_t module,
+                                        audio_devices_t *pDevices,
+                                        uint32_t *pSamplingRate,
+                                        audio_format_t *pFormat,
+                                        audio_channel_mask_t *pChannelMask);
+    virtual status_t closeInput(audio_io_handle_t input);
+    virtual status_t setStreamVolume(AudioSystem::stream_type stream,
+                                     float volume,
+                                     audio_io_handle_t output,
+                                     int delayMs = 0);
+    virtual status_t setStreamOutput(AudioSystem::stream_type stream, audio_io_handle_t output);
+    virtual void setParameters(audio_io_handle_t ioHandle,
+                               const String8& keyValuePairs,
+                               int delayMs = 0);
+    virtual String8 getParameters(audio_io_handle_t ioHandle, const String8& keys);
+    virtual status_t startTone(ToneGenerator::tone_type tone, AudioSystem::stream_type stream);
+    virtual status_t stopTone();
+    virtual status_t setVoiceVolume(float volume, int delayMs = 0);
+    virtual status_t moveEffects(int session,
+                                 audio_io_handle_t srcOutput,
+                                 audio_io_handle_t dstOutput);
+
+private:
+    void record(command_type type, int io, int arg = 0, int delayMs = 0,
+                float volume = 0, const String8& params = String8(""));
+
+    // outputs are opened concurrently when a device is connected
+    android::Mutex mLock;
+    int mNextModule;
+    int mNextIo;
+    uint32_t mOpenDelayUs;
+    String8 mSupSamplingRates;
+    String8 mSupFormats;
+    String8 mSupChannels;
+    bool mRecording;
+    Vector<Command> mCommands;
+    uint32_t mCommandCount[NUM_COMMANDS];
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_FAKEAUDIOPOLICYCLIENT_H
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the time and heap allocations of the legacy HAL shim (audio_hw_hal.cpp) entry
+// points over the stub audio hardware, i.e. the cost added by the shim on top of the legacy
+// stream virtuals.
+//
+// usage: audio_hw_bench [-n samples] [-b batch] [-p]
+//
+// Each sample times a batch of calls so that the timer resolution does not hide calls taking
+// less than a microsecond; the results are per call. By default the stub streams return
+// immediately. With -p, they sleep for the duration of the audio written or read like the
+// stub hardware does, which shows the shim overhead against a paced stream.
+
+#define LOG_TAG "audio_hw_bench"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <hardware/hardware.h>
+#include <hardware/audio.h>
+
+#include "AllocationCounter.h"
+#include "AudioHardwareStub.h"
+
+using namespace android_audio_legacy;
+
+// ----------------------------------------------------------------------------
+// stub hardware
+
+static bool gPaced = false;
+
+// the stub streams sleep in write() and read() to simulate the hardware timing
+class BenchStreamOut : public AudioStreamOutStub {
+public:
+    virtual ssize_t     write(const void* buffer, size_t bytes) {
+        return gPaced ? AudioStreamOutStub::write(buffer, bytes) : (ssize_t)bytes;
+    }
+};
+
+class BenchStreamIn : public AudioStreamInStub {
+public:
+    virtual ssize_t     read(void* buffer, ssize_t bytes) {
+        if (gPaced) {
+            return AudioStreamInStub::read(buffer, bytes);
+        }
+        memset(buffer, 0, bytes);
+        return bytes;
+    }
+};
+
+class BenchAudioHardware : public AudioHardwareStub {
+public:
+    virtual AudioStreamOut* openOutputStream(uint32_t devices, int *format, uint32_t *channels,
+                                             uint32_t *sampleRate, status_t *status) {
+        BenchStreamOut *out = new BenchStreamOut();
+        status_t lStatus = out->set(format, channels, sampleRate);
+        if (status) {
+            *status = lStatus;
+        }
+        return out;
+    }
+
+    virtual AudioStreamIn* openInputStream(uint32_t devices, int *format, uint32_t *channels,
+                                           uint32_t *sampleRate, status_t *status,
+                                           AudioSystem::audio_in_acoustics acoustics) {
+        BenchStreamIn *in = new BenchStreamIn();
+        status_t lStatus = in->set(format, channels, sampleRate, acoustics);
+        if (status) {
+            *status = lStatus;
+        }
+        return in;
+    }
+};
+
+namespace android_audio_legacy {
+
+// the shim opens the legacy hardware with this factory
+extern "C" AudioHardwareInterface* createAudioHardware(void)
+{
+    return new BenchAudioHardware();
+}
+
+};
+
+// the shim module, built in the same executable
+extern "C" struct hw_module_t HAL_MODULE_INFO_SYM;
+
+// ----------------------------------------------------------------------------
+
+struct BenchContext {
+    struct audio_hw_device *mDevice;
+    struct audio_stream_out *mOut;
+    struct audio_stream_in *mIn;
+    void *mBuffer;
+    size_t mOutBytes;
+    size_t mInBytes;
+};
+
+// one call of a benchmark. Returns false if the call failed
+typedef bool (*bench_func_t)(BenchContext *context, int iteration);
+
+static bool benchOutWrite(BenchContext *context, int iteration)
+{
+    return context->mOut->write(context->mOut, context->mBuffer, context->mOutBytes) ==
+            (ssize_t)context->mOutBytes;
+}
+
+// out_write through the shim effect chain, configured by main() before this benchmark runs
+static bool benchOutWriteFx(BenchContext *context, int iteration)
+{
+    return benchOutWrite(context, iteration);
+}
+
+static bool benchInRead(BenchContext *context, int iteration)
+{
+    return context->mIn->read(context->mIn, context->mBuffer, context->mInBytes) ==
+            (ssize_t)context->mInBytes;
+}
+
+static bool benchOutSetRouting(BenchContext *context, int iteration)
+{
+    char kvpairs[32];
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d", AUDIO_PARAMETER_STREAM_ROUTING,
+             (iteration & 1) ? AUDIO_DEVICE_OUT_SPEAKER : AUDIO_DEVICE_OUT_WIRED_HEADSET);
+    return context->mOut->common.set_parameters(&context->mOut->common, kvpairs) == 0;
+}
+
+static bool benchOutSetParameters(BenchContext *context, int iteration)
+{
+    char kvpairs[64];
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d;screen_state=%s", AUDIO_PARAMETER_STREAM_ROUTING,
+             AUDIO_DEVICE_OUT_SPEAKER, (iteration & 1) ? "on" : "off");
+    return context->mOut->common.set_parameters(&context->mOut->common, kvpairs) == 0;
+}
+
+static bool benchInSetRouting(BenchContext *context, int iteration)
+{
+    char kvpairs[32];
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d", AUDIO_PARAMETER_STREAM_ROUTING,
+             (int)AUDIO_DEVICE_IN_BUILTIN_MIC);
+    return context->mIn->common.set_parameters(&context->mIn->common, kvpairs) == 0;
+}
+
+static bool getParameters(struct audio_stream *stream, const char *keys)
+{
+    char *reply = stream->get_parameters(stream, keys);
+    if (reply == NULL) {
+        return false;
+    }
+    free(reply);
+    return true;
+}
+
+static bool benchOutGetRouting(BenchContext *context, int iteration)
+{
+    return getParameters(&context->mOut->common, AUDIO_PARAMETER_STREAM_ROUTING);
+}
+
+static bool benchOutGetDrainMs(BenchContext *context, int iteration)
+{
+    return getParameters(&context->mOut->common, AUDIO_PARAMETER_STREAM_DRAIN_MS);
+}
+
+static bool benchInGetRouting(BenchContext *context, int iteration)
+{
+    return getParameters(&context->mIn->common, AUDIO_PARAMETER_STREAM_ROUTING);
+}
+
+static bool benchOutRenderPosition(BenchContext *context, int iteration)
+{
+    uint32_t frames;
+    return context->mOut->get_render_position(context->mOut, &frames) == 0;
+}
+
+static bool benchOpenCloseOutput(BenchContext *context, int iteration)
+{
+    struct audio_config config;
+    struct audio_stream_out *out;
+
+    memset(&config, 0, sizeof(config));
+    if (context->mDevice->open_output_stream(context->mDevice, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                             AUDIO_OUTPUT_FLAG_NONE, &config, &out) != 0) {
+        return false;
+    }
+    context->mDevice->close_output_stream(context->mDevice, out);
+    return true;
+}
+
+struct Benchmark {
+    const char *mName;
+    bench_func_t mFunc;
+};
+
+static const Benchmark sBenchmarks[] = {
+    { "out_write", benchOutWrite },
+    { "out_write(fx_gain)", benchOutWriteFx },
+    { "in_read", benchInRead },
+    { "out_set_parameters(routing)", benchOutSetRouting },
+    { "out_set_parameters(routing;screen_state)", benchOutSetParameters },
+    { "in_set_parameters(routing)", benchInSetRouting },
+    { "out_get_parameters(routing)", benchOutGetRouting },
+    { "out_get_parameters(drain_ms)", benchOutGetDrainMs },
+    { "in_get_parameters(routing)", benchInGetRouting },
+    { "out_get_render_position", benchOutRenderPosition },
+    { "adev_open/close_output_stream", benchOpenCloseOutput },
+};
+
+static int compareNsecs(const void *a, const void *b)
+{
+    nsecs_t na = *(const nsecs_t *)a;
+    nsecs_t nb = *(const nsecs_t *)b;
+    return (na < nb) ? -1 : ((na > nb) ? 1 : 0);
+}
+
+static void runBenchmark(const Benchmark *benchmark, BenchContext *context, int samples,
+                         int batch)
+{
+    nsecs_t *durations = new nsecs_t[samples];
+    int32_t allocations = allocationCount();
+    bool ok = true;
+    for (int i = 0; i < samples && ok; i++) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int j = 0; j < batch && ok; j++) {
+            ok = benchmark->mFunc(context, i * batch + j);
+        }
+        durations[i] = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+    allocations = allocationCount() - allocations;
+
+    if (!ok) {
+        printf("%-42s failed\n", benchmark->mName);
+    } else {
+        qsort(durations, samples, sizeof(nsecs_t), compareNsecs);
+        nsecs_t total = 0;
+        for (int i = 0; i < samples; i++) {
+            total += durations[i];
+        }
+        double calls = (double)samples * batch;
+        printf("%-42s %9.0f %9.0f %9.0f %9.0f %9.2f %11.0f\n",
+               benchmark->mName,
+               (double)total / calls,
+               (double)durations[samples / 2] / batch,
+               (double)durations[(samples * 99) / 100] / batch,
+               (double)durations[samples - 1] / batch,
+               (double)allocations / calls,
+               calls * 1000000000.0 / (double)total);
+    }
+    delete[] durations;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n samples] [-b batch] [-p]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int samples = 1000;
+    int batch = 100;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:p")) != -1) {
+        switch (opt) {
+        case 'n':
+            samples = atoi(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'p':
+            gPaced = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (samples <= 0 || batch <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    hw_device_t *device;
+    if (HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM, AUDIO_HARDWARE_INTERFACE,
+                                          &device) != 0) {
+        fprintf(stderr, "cannot open the legacy audio HAL\n");
+        return 1;
+    }
+
+    BenchContext context;
+    context.mDevice = (struct audio_hw_device *)device;
+    struct audio_config config;
+    memset(&config, 0, sizeof(config));
+    if (context.mDevice->open_output_stream(context.mDevice, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                            AUDIO_OUTPUT_FLAG_NONE, &config,
+                                            &context.mOut) != 0) {
+        fprintf(stderr, "cannot open an output stream\n");
+        return 1;
+    }
+    memset(&config, 0, sizeof(config));
+    if (context.mDevice->open_input_stream(context.mDevice, 0, AUDIO_DEVICE_IN_BUILTIN_MIC,
+                                           &config, &context.mIn) != 0) {
+        fprintf(stderr, "cannot open an input stream\n");
+        return 1;
+    }
+    context.mOutBytes = context.mOut->common.get_buffer_size(&context.mOut->common);
+    context.mInBytes = context.mIn->common.get_buffer_size(&context.mIn->common);
+    size_t bufferSize = (context.mOutBytes > context.mInBytes) ?
+            context.mOutBytes : context.mInBytes;
+    context.mBuffer = calloc(1, bufferSize);
+
+    printf("%d samples of %d calls, %s stub streams, write %u bytes, read %u bytes\n",
+           samples, batch, gPaced ? "paced" : "immediate",
+           (unsigned int)context.mOutBytes, (unsigned int)context.mInBytes);
+    printf("%-42s %9s %9s %9s %9s %9s %11s\n",
+           "", "mean ns", "p50 ns", "p99 ns", "max ns", "allocs", "calls/s");
+    for (size_t i = 0; i < sizeof(sBenchmarks) / sizeof(sBenchmarks[0]); i++) {
+        bool fx = sBenchmarks[i].mFunc == benchOutWriteFx;
+        if (fx) {
+            context.mOut->common.set_parameters(&context.mOut->common, "fx_gain=-6");
+        }
+        runBenchmark(&sBenchmarks[i], &context, samples, batch);
+        if (fx) {
+            context.mOut->common.set_parameters(&context.mOut->common, "fx_gain=0");
+        }
+    }
+
+    free(context.mBuffer);
+    context.mDevice->close_input_stream(context.mDevice, context.mIn);
+    context.mDevice->close_output_stream(context.mDevice, context.mOut);
+    device->close(device);
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the latency, heap allocations and HAL commands of the main audio policy entry
+// points against FakeAudioPolicyClient.
+//
+// usage: audio_policy_bench [-n iterations] [-d open_delay_us] [-s] [config_dir ...]
+//
+// The policy manager runs on a virtual clock unless -s is given: the waits it does while
+// routing changes propagate then return immediately and are not included in the results.
+//
+// Each config_dir must contain an audio_policy.conf describing the platform to simulate. The
+// current directory is used if none is given, and the built-in default configuration if it
+// does not contain an audio_policy.conf either.
+
+#define LOG_TAG "audio_policy_bench"
+//#define LOG_NDEBUG 0
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <hardware/audio.h>
+
+#include <hardware_legacy/AudioPolicyManagerBase.h>
+
+#include "AllocationCounter.h"
+#include "FakeAudioPolicyClient.h"
+
+using namespace android_audio_legacy;
+using android::Vector;
+
+// ----------------------------------------------------------------------------
+
+struct BenchContext {
+    AudioPolicyManagerBase *mApm;
+    FakeAudioPolicyClient *mClient;
+    audio_io_handle_t mMusicOutput;
+};
+
+// one iteration of a benchmark. Returns false if the scenario cannot run on the configuration
+typedef bool (*bench_func_t)(BenchContext *context, int iteration);
+
+static bool benchGetOutput(BenchContext *context, int iteration)
+{
+    return context->mApm->getOutput(AudioSystem::MUSIC, 44100, AudioSystem::PCM_16_BIT,
+                                    AudioSystem::CHANNEL_OUT_STEREO,
+                                    AudioSystem::OUTPUT_FLAG_INDIRECT) != 0;
+}
+
+static bool benchGetOutputFast(BenchContext *context, int iteration)
+{
+    return context->mApm->getOutput(AudioSystem::SYSTEM, 44100, AudioSystem::PCM_16_BIT,
+                                    AudioSystem::CHANNEL_OUT_STEREO,
+                                    (AudioSystem::output_flags)AUDIO_OUTPUT_FLAG_FAST) != 0;
+}
+
+static bool benchStartStopMusic(BenchContext *context, int iteration)
+{
+    if (context->mApm->startOutput(context->mMusicOutput, AudioSystem::MUSIC) != NO_ERROR) {
+        return false;
+    }
+    return context->mApm->stopOutput(context->mMusicOutput, AudioSystem::MUSIC) == NO_ERROR;
+}
+
+static bool benchStartStopNotification(BenchContext *context, int iteration)
+{
+    if (context->mApm->startOutput(context->mMusicOutput,
+                                   AudioSystem::NOTIFICATION) != NO_ERROR) {
+        return false;
+    }
+    return context->mApm->stopOutput(context->mMusicOutput,
+                                     AudioSystem::NOTIFICATION) == NO_ERROR;
+}
+
+static bool connectDisconnect(BenchContext *context, audio_devices_t device, const char *address)
+{
+    if (context->mApm->setDeviceConnectionState(device,
+                                                AudioSystem::DEVICE_STATE_AVAILABLE,
+                                                address) != NO_ERROR) {
+        return false;
+    }
+    return context->mApm->setDeviceConnectionState(device,
+                                                   AudioSystem::DEVICE_STATE_UNAVAILABLE,
+                                                   address) == NO_ERROR;
+}
+
+static bool benchWiredHeadset(BenchContext *context, int iteration)
+{
+    return connectDisconnect(context, AUDIO_DEVICE_OUT_WIRED_HEADSET, "");
+}
+
+static bool benchHdmi(BenchContext *context, int iteration)
+{
+    return connectDisconnect(context, AUDIO_DEVICE_OUT_AUX_DIGITAL, "");
+}
+
+static bool benchA2dp(BenchContext *context, int iteration)
+{
+    return connectDisconnect(context, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP, "00:11:22:33:44:55");
+}
+
+static bool benchPhoneState(BenchContext *context, int iteration)
+{
+    context->mApm->setPhoneState(AudioSystem::MODE_IN_CALL);
+    context->mApm->setPhoneState(AudioSystem::MODE_NORMAL);
+    return true;
+}
+
+static bool benchStreamVolume(BenchContext *context, int iteration)
+{
+    return context->mApm->setStreamVolumeIndex(AudioSystem::MUSIC, iteration % 16,
+                                               AUDIO_DEVICE_OUT_DEFAULT) == NO_ERROR;
+}
+
+static bool benchStreamVolumeActive(BenchContext *context, int iteration)
+{
+    if (iteration == 0 &&
+            context->mApm->startOutput(context->mMusicOutput, AudioSystem::MUSIC) != NO_ERROR) {
+        return false;
+    }
+    return benchStreamVolume(context, iteration);
+}
+
+struct Benchmark {
+    const char *mName;
+    bench_func_t mFunc;
+};
+
+static const Benchmark sBenchmarks[] = {
+    { "getOutput(MUSIC)", benchGetOutput },
+    { "getOutput(SYSTEM, FAST)", benchGetOutputFast },
+    { "startOutput/stopOutput(MUSIC)", benchStartStopMusic },
+    { "startOutput/stopOutput(NOTIFICATION)", benchStartStopNotification },
+    { "connect/disconnect(WIRED_HEADSET)", benchWiredHeadset },
+    { "connect/disconnect(AUX_DIGITAL)", benchHdmi },
+    { "connect/disconnect(BLUETOOTH_A2DP)", benchA2dp },
+    { "setPhoneState(IN_CALL/NORMAL)", benchPhoneState },
+    { "setStreamVolumeIndex(MUSIC)", benchStreamVolume },
+    { "setStreamVolumeIndex(MUSIC, active)", benchStreamVolumeActive },
+};
+
+static int compareNsecs(const void *a, const void *b)
+{
+    nsecs_t na = *(const nsecs_t *)a;
+    nsecs_t nb = *(const nsecs_t *)b;
+    return (na < nb) ? -1 : ((na > nb) ? 1 : 0);
+}
+
+static AudioPolicyManagerBase *createPolicy(FakeAudioPolicyClient *client,
+                                            AudioPolicyClock *clock)
+{
+    AudioPolicyManagerBase *apm = new AudioPolicyManagerBase(client, clock);
+    if (apm->initCheck() != NO_ERROR) {
+        delete apm;
+        return NULL;
+    }
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        apm->initStreamVolume((AudioSystem::stream_type)i, 0, 15);
+    }
+    return apm;
+}
+
+static void runBenchmark(const Benchmark *benchmark, int iterations, uint32_t openDelayUs,
+                         bool systemClock)
+{
+    // each benchmark starts from a freshly booted policy so that the order of the benchmarks
+    // does not change their results
+    FakeAudioPolicyClient client;
+    client.setOpenDelayUs(openDelayUs);
+    AudioPolicyVirtualClock virtualClock;
+    AudioPolicyManagerBase *apm = createPolicy(&client, systemClock ? NULL : &virtualClock);
+    if (apm == NULL) {
+        printf("%-40s policy initialization failed\n", benchmark->mName);
+        return;
+    }
+    BenchContext context;
+    context.mApm = apm;
+    context.mClient = &client;
+    context.mMusicOutput = apm->getOutput(AudioSystem::MUSIC);
+
+    nsecs_t *durations = new nsecs_t[iterations];
+    client.clearCommands();
+    int32_t allocations = allocationCount();
+    bool supported = true;
+    for (int i = 0; i < iterations && supported; i++) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        supported = benchmark->mFunc(&context, i);
+        durations[i] = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+    allocations = allocationCount() - allocations;
+
+    if (!supported) {
+        printf("%-40s not supported by this configuration\n", benchmark->mName);
+    } else {
+        qsort(durations, iterations, sizeof(nsecs_t), compareNsecs);
+        nsecs_t total = 0;
+        for (int i = 0; i < iterations; i++) {
+            total += durations[i];
+        }
+        printf("%-40s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+               benchmark->mName,
+               (double)total / iterations / 1000,
+               (double)durations[iterations / 2] / 1000,
+               (double)durations[(iterations * 99) / 100] / 1000,
+               (double)durations[iterations - 1] / 1000,
+               (double)allocations / iterations,
+               (double)client.totalCommandCount() / iterations);
+    }
+
+    delete[] durations;
+    delete apm;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-d open_delay_us] [-s] [config_dir ...]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 1000;
+    uint32_t openDelayUs = 0;
+    bool systemClock = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:s")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'd':
+            openDelayUs = (uint32_t)atoi(optarg);
+            break;
+        case 's':
+            systemClock = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Vector<const char *> configs;
+    for (int i = optind; i < argc; i++) {
+        configs.add(argv[i]);
+    }
+    if (configs.size() == 0) {
+        configs.add(".");
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("getcwd");
+        return 1;
+    }
+    for (size_t i = 0; i < configs.size(); i++) {
+        // the host build of the policy manager reads audio_policy.conf in the current directory
+        if (chdir(configs[i]) != 0) {
+            perror(configs[i]);
+            continue;
+        }
+        printf("\nconfiguration %s, %d iterations, open delay %u us, %s clock\n",
+               configs[i], iterations, openDelayUs, systemClock ? "system" : "virtual");
+        printf("%-40s %9s %9s %9s %9s %9s %9s\n",
+               "", "mean us", "p50 us", "p99 us", "max us", "allocs", "hal cmds");
+        for (size_t j = 0; j < sizeof(sBenchmarks) / sizeof(sBenchmarks[0]); j++) {
+            runBenchmark(&sBenchmarks[j], iterations, openDelayUs, systemClock);
+        }
+        if (chdir(cwd) != 0) {
+            perror(cwd);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a trace of audio policy HAL calls recorded by audio_policy_hal.cpp (built with
+// AUDIO_POLICY_RECORD) on AudioPolicyManagerBase running against FakeAudioPolicyClient.
+//
+// usage: audio_policy_replay [-r] [-v] [-c config_dir] trace_file
+//   -r  replay at the recorded pace instead of as fast as possible. By default the policy
+//       manager runs on a virtual clock following the record timestamps: the replay takes no
+//       longer than the calls themselves but sees the same time elapse as the device did.
+//   -v  print every call with the HAL commands it produced
+//   -c  directory containing the audio_policy.conf of the recorded device
+//
+// I/O handles differ between the device and the replay: they are mapped using the values
+// returned by get_output(), get_input() and get_output_for_effect(). A trace that does not
+// start at boot (header.dropped != 0) begins with a policy state that cannot be restored
+// and its first calls may diverge.
+
+#define LOG_TAG "audio_policy_replay"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <utils/KeyedVector.h>
+#include <utils/Vector.h>
+#include <hardware/audio.h>
+#include <hardware/audio_effect.h>
+
+#include <hardware_legacy/AudioPolicyManagerBase.h>
+
+#include "AudioPolicyTrace.h"
+#include "FakeAudioPolicyClient.h"
+
+using namespace android_audio_legacy;
+using android::KeyedVector;
+using android::Vector;
+
+struct CallStats {
+    uint32_t mCount;
+    uint32_t mMismatches;
+    nsecs_t mRecordedTotal;
+    nsecs_t mRecordedMax;
+    nsecs_t mReplayTotal;
+    nsecs_t mReplayMax;
+};
+
+// recorded I/O handle to replayed I/O handle
+static KeyedVector<int32_t, int32_t> sHandles;
+static uint32_t sUnmappedHandles = 0;
+
+static int32_t mapHandle(int32_t recorded)
+{
+    if (recorded == 0) {
+        return 0;
+    }
+    ssize_t index = sHandles.indexOfKey(recorded);
+    if (index < 0) {
+        sUnmappedHandles++;
+        return recorded;
+    }
+    return sHandles.valueAt(index);
+}
+
+// learns or checks the handle returned by the replayed call. Returns false on mismatch
+static bool checkHandle(int32_t recorded, int32_t replayed)
+{
+    if (recorded == 0 || replayed == 0) {
+        return recorded == replayed;
+    }
+    ssize_t index = sHandles.indexOfKey(recorded);
+    if (index < 0) {
+        sHandles.add(recorded, replayed);
+        return true;
+    }
+    return sHandles.valueAt(index) == replayed;
+}
+
+// replays one record. Returns false if the result differs from the recorded one
+static bool replay(AudioPolicyManagerBase *apm, const audio_policy_trace_record *record)
+{
+    const int32_t *args = record->args;
+    char address[AUDIO_POLICY_TRACE_ADDRESS_LEN + 1];
+    memcpy(address, record->address, AUDIO_POLICY_TRACE_ADDRESS_LEN);
+    address[AUDIO_POLICY_TRACE_ADDRESS_LEN] = '\0';
+
+    switch (record->call) {
+    case AP_TRACE_SET_DEVICE_CONNECTION_STATE:
+        return apm->setDeviceConnectionState((audio_devices_t)args[0],
+                                             (AudioSystem::device_connection_state)args[1],
+                                             address) == record->result;
+    case AP_TRACE_GET_DEVICE_CONNECTION_STATE:
+        return apm->getDeviceConnectionState((audio_devices_t)args[0],
+                                             address) == record->result;
+    case AP_TRACE_SET_PHONE_STATE:
+        apm->setPhoneState(args[0]);
+        return true;
+    case AP_TRACE_SET_FORCE_USE:
+        apm->setForceUse((AudioSystem::force_use)args[0], (AudioSystem::forced_config)args[1]);
+        return true;
+    case AP_TRACE_GET_FORCE_USE:
+        return apm->getForceUse((AudioSystem::force_use)args[0]) == record->result;
+    case AP_TRACE_SET_CAN_MUTE_ENFORCED_AUDIBLE:
+        apm->setSystemProperty("ro.camera.sound.forced", args[0] ? "0" : "1");
+        return true;
+    case AP_TRACE_INIT_CHECK:
+        return apm->initCheck() == record->result;
+    case AP_TRACE_GET_OUTPUT:
+        return checkHandle(record->result,
+                           apm->getOutput((AudioSystem::stream_type)args[0], args[1], args[2],
+                                          args[3], (AudioSystem::output_flags)args[4]));
+    case AP_TRACE_START_OUTPUT:
+        return apm->startOutput(mapHandle(args[0]), (AudioSystem::stream_type)args[1],
+                                args[2]) == record->result;
+    case AP_TRACE_STOP_OUTPUT:
+        return apm->stopOutput(mapHandle(args[0]), (AudioSystem::stream_type)args[1],
+                               args[2]) == record->result;
+    case AP_TRACE_RELEASE_OUTPUT:
+        apm->releaseOutput(mapHandle(args[0]));
+        return true;
+    case AP_TRACE_GET_INPUT:
+        return checkHandle(record->result,
+                           apm->getInput(args[0], args[1], args[2], args[3],
+                                         (AudioSystem::audio_in_acoustics)args[4]));
+    case AP_TRACE_START_INPUT:
+        return apm->startInput(mapHandle(args[0])) == record->result;
+    case AP_TRACE_STOP_INPUT:
+        return apm->stopInput(mapHandle(args[0])) == record->result;
+    case AP_TRACE_RELEASE_INPUT:
+        apm->releaseInput(mapHandle(args[0]));
+        return true;
+    case AP_TRACE_INIT_STREAM_VOLUME:
+        apm->initStreamVolume((AudioSystem::stream_type)args[0], args[1], args[2]);
+        return true;
+    case AP_TRACE_SET_STREAM_VOLUME_INDEX:
+        return apm->setStreamVolumeIndex((AudioSystem::stream_type)args[0], args[1],
+                                         (audio_devices_t)args[2]) == record->result;
+    case AP_TRACE_GET_STREAM_VOLUME_INDEX: {
+        int index = 0;
+        status_t status = apm->getStreamVolumeIndex((AudioSystem::stream_type)args[0], &index,
+                                                    (audio_devices_t)args[2]);
+        return status == record->result && index == args[1];
+    }
+    case AP_TRACE_GET_STRATEGY_FOR_STREAM:
+        return apm->getStrategyForStream((AudioSystem::stream_type)args[0]) ==
+                (uint32_t)record->result;
+    case AP_TRACE_GET_DEVICES_FOR_STREAM:
+        return apm->getDevicesForStream((AudioSystem::stream_type)args[0]) ==
+                (audio_devices_t)record->result;
+    case AP_TRACE_GET_OUTPUT_FOR_EFFECT: {
+        effect_descriptor_t desc;
+        memset(&desc, 0, sizeof(desc));
+        desc.cpuLoad = args[0];
+        desc.memoryUsage = args[1];
+        desc.flags = args[2];
+        return checkHandle(record->result, apm->getOutputForEffect(&desc));
+    }
+    case AP_TRACE_REGISTER_EFFECT: {
+        effect_descriptor_t desc;
+        memset(&desc, 0, sizeof(desc));
+        desc.cpuLoad = args[4];
+        desc.memoryUsage = args[5];
+        strcpy(desc.name, "replayed effect");
+        return apm->registerEffect(&desc, mapHandle(args[0]), args[1], args[2],
+                                   args[3]) == record->result;
+    }
+    case AP_TRACE_UNREGISTER_EFFECT:
+        return apm->unregisterEffect(args[0]) == record->result;
+    case AP_TRACE_SET_EFFECT_ENABLED:
+        return apm->setEffectEnabled(args[0], args[1] != 0) == record->result;
+    case AP_TRACE_IS_STREAM_ACTIVE:
+        return apm->isStreamActive(args[0], args[1]) == (record->result != 0);
+    case AP_TRACE_IS_SOURCE_ACTIVE:
+        return apm->isSourceActive((audio_source_t)args[0]) == (record->result != 0);
+    default:
+        return true;
+    }
+}
+
+static void printCommands(FakeAudioPolicyClient *client)
+{
+    Vector<FakeAudioPolicyClient::Command> commands = client->commands();
+    for (size_t i = 0; i < commands.size(); i++) {
+        const FakeAudioPolicyClient::Command& command = commands[i];
+        printf("    -> %s io %d arg %d delay %d ms", FakeAudioPolicyClient::commandName(command.mType),
+               command.mIo, command.mArg, command.mDelayMs);
+        if (command.mType == FakeAudioPolicyClient::SET_STREAM_VOLUME ||
+                command.mType == FakeAudioPolicyClient::SET_VOICE_VOLUME) {
+            printf(" volume %.3f", command.mVolume);
+        }
+        if (command.mParams.size() != 0) {
+            printf(" \"%s\"", command.mParams.string());
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-r] [-v] [-c config_dir] trace_file\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    bool realTime = false;
+    bool verbose = false;
+    const char *configDir = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "rvc:")) != -1) {
+        switch (opt) {
+        case 'r':
+            realTime = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'c':
+            configDir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    audio_policy_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != AUDIO_POLICY_TRACE_MAGIC ||
+            header.version != AUDIO_POLICY_TRACE_VERSION ||
+            header.record_size != sizeof(audio_policy_trace_record)) {
+        fprintf(stderr, "%s: not an audio policy trace\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+    audio_policy_trace_record *records = new audio_policy_trace_record[header.count];
+    size_t count = fread(records, sizeof(audio_policy_trace_record), header.count, file);
+    fclose(file);
+    if (count != header.count) {
+        fprintf(stderr, "%s: truncated, %zu records out of %u\n", argv[optind], count,
+                header.count);
+    }
+    if (header.dropped != 0) {
+        fprintf(stderr, "warning: %u calls made before the first record are missing\n",
+                header.dropped);
+    }
+
+    // the host build of the policy manager reads audio_policy.conf in the current directory
+    if (configDir != NULL && chdir(configDir) != 0) {
+        perror(configDir);
+        return 1;
+    }
+    FakeAudioPolicyClient client;
+    AudioPolicyVirtualClock virtualClock;
+    nsecs_t virtualStart = virtualClock.now();
+    AudioPolicyManagerBase *apm = new AudioPolicyManagerBase(&client,
+                                                             realTime ? NULL : &virtualClock);
+    client.clearCommands();
+    client.setRecording(verbose);
+
+    CallStats stats[AP_TRACE_CALL_CNT];
+    memset(stats, 0, sizeof(stats));
+    nsecs_t replayStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (size_t i = 0; i < count; i++) {
+        const audio_policy_trace_record *record = &records[i];
+        if (record->call >= AP_TRACE_CALL_CNT) {
+            continue;
+        }
+        nsecs_t offset = record->timestamp_ns - records[0].timestamp_ns;
+        if (realTime) {
+            nsecs_t target = replayStart + offset;
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (target > now) {
+                usleep((useconds_t)ns2us(target - now));
+            }
+        } else {
+            // time slept by the policy manager during previous calls is already included
+            // in the recorded timestamps
+            virtualClock.advanceTo(virtualStart + offset);
+        }
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        bool match = replay(apm, record);
+        nsecs_t duration = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+        CallStats *callStats = &stats[record->call];
+        callStats->mCount++;
+        callStats->mRecordedTotal += record->duration_ns;
+        if (record->duration_ns > callStats->mRecordedMax) {
+            callStats->mRecordedMax = record->duration_ns;
+        }
+        callStats->mReplayTotal += duration;
+        if (duration > callStats->mReplayMax) {
+            callStats->mReplayMax = duration;
+        }
+        if (!match) {
+            callStats->mMismatches++;
+        }
+
+        if (verbose) {
+            printf("%8.3f %s(%d, %d, %d, %d, %d, %d%s%s) = %d%s %.1f us (recorded %.1f us)\n",
+                   (double)(record->timestamp_ns - records[0].timestamp_ns) / 1000000000,
+                   audioPolicyTraceCallName(record->call),
+                   record->args[0], record->args[1], record->args[2],
+                   record->args[3], record->args[4], record->args[5],
+                   record->address[0] != '\0' ? ", " : "", record->address,
+                   record->result, match ? "" : " MISMATCH",
+                   (double)duration / 1000, (double)record->duration_ns / 1000);
+            printCommands(&client);
+            client.clearCommands();
+        }
+    }
+
+    printf("\n%-32s %8s %10s %10s %10s %10s %10s\n", "call", "count", "mismatch",
+           "rec mean", "rec max", "mean us", "max us");
+    for (int i = 0; i < AP_TRACE_CALL_CNT; i++) {
+        if (stats[i].mCount == 0) {
+            continue;
+        }
+        printf("%-32s %8u %10u %10.1f %10.1f %10.1f %10.1f\n",
+               audioPolicyTraceCallName(i), stats[i].mCount, stats[i].mMismatches,
+               (double)stats[i].mRecordedTotal / stats[i].mCount / 1000,
+               (double)stats[i].mRecordedMax / 1000,
+               (double)stats[i].mReplayTotal / stats[i].mCount / 1000,
+               (double)stats[i].mReplayMax / 1000);
+    }
+    if (!verbose) {
+        printf("\n%-32s %8s\n", "HAL command", "count");
+        for (int i = 0; i < FakeAudioPolicyClient::NUM_COMMANDS; i++) {
+            FakeAudioPolicyClient::command_type type = (FakeAudioPolicyClient::command_type)i;
+            if (client.commandCount(type) != 0) {
+                printf("%-32s %8u\n", FakeAudioPolicyClient::commandName(type),
+                       client.commandCount(type));
+            }
+        }
+    }
+    if (sUnmappedHandles != 0) {
+        printf("\n%u calls used an I/O handle not returned earlier in the trace\n",
+               sUnmappedHandles);
+    }
+
+    delete apm;
+    delete[] records;
+    return 0;
+}
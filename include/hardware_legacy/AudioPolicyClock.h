@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYCLOCK_H
+#define ANDROID_AUDIOPOLICYCLOCK_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <utils/Timers.h>
+#include <utils/threads.h>
+
+namespace android_audio_legacy {
+
+// Time source used by AudioPolicyManagerBase for stream activity tracking and for the waits
+// done while routing changes propagate.
+class AudioPolicyClock
+{
+public:
+    virtual ~AudioPolicyClock() {}
+
+    // current monotonic time in nanoseconds
+    virtual nsecs_t now() = 0;
+    // blocks the calling thread for the specified duration
+    virtual void sleepUs(uint32_t us) = 0;
+};
+
+// Real time: systemTime() and usleep(). Used when no clock is given to the policy manager.
+class AudioPolicySystemClock : public AudioPolicyClock
+{
+public:
+    virtual nsecs_t now() { return systemTime(); }
+    virtual void sleepUs(uint32_t us) { usleep(us); }
+};
+
+// Simulated time for tests and benchmarks: time only moves when advanced explicitly or when
+// the policy manager sleeps, which returns immediately. Long scenarios involving mute or
+// activity delays then run as fast as the code itself.
+class AudioPolicyVirtualClock : public AudioPolicyClock
+{
+public:
+    // Stream stop times are initialized to 0: the default start time is far enough from 0 for
+    // streams that never played not to be seen as recently active.
+    AudioPolicyVirtualClock(nsecs_t start = s2ns(3600))
+        : mNow(start), mSleptNs(0) {}
+
+    virtual nsecs_t now()
+    {
+        android::Mutex::Autolock _l(mLock);
+        return mNow;
+    }
+    virtual void sleepUs(uint32_t us)
+    {
+        android::Mutex::Autolock _l(mLock);
+        mNow += us2ns(us);
+        mSleptNs += us2ns(us);
+    }
+
+    void advance(nsecs_t ns)
+    {
+        android::Mutex::Autolock _l(mLock);
+        mNow += ns;
+    }
+    // moves the clock forward to the specified time, never backward
+    void advanceTo(nsecs_t time)
+    {
+        android::Mutex::Autolock _l(mLock);
+        if (time > mNow) {
+            mNow = time;
+        }
+    }
+    // total time the policy manager spent sleeping, in nanoseconds
+    nsecs_t sleptNs()
+    {
+        android::Mutex::Autolock _l(mLock);
+        return mSleptNs;
+    }
+
+private:
+    android::Mutex mLock;
+    nsecs_t mNow;
+    nsecs_t mSleptNs;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYCLOCK_H
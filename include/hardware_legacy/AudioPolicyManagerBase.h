@@ -24,6 +24,11 @@
 #include <utils/KeyedVector.h>
 #include <utils/SortedVector.h>
 #include <hardware_legacy/AudioPolicyInterface.h>
+#include <hardware_legacy/AudioPolicyClock.h>
+#include <hardware_legacy/AudioPolicyStats.h>
+#include <hardware_legacy/AudioPolicyRoutingTrace.h>
+#include <hardware_legacy/AudioPolicyTransaction.h>
+#include <hardware_legacy/AudioPolicyWorker.h>
 
 
 namespace android_audio_legacy {
@@ -50,6 +55,32 @@ namespace android_audio_legacy {
 
 #define NUM_TEST_OUTPUTS 5
 
+// Maximum number of unused direct outputs kept open for reuse by getOutput()
+#define MAX_IDLE_DIRECT_OUTPUTS 2
+// Maximum number of connected device configurations for which the dynamic parameters read from
+// direct outputs are remembered
+#define MAX_CACHED_DEVICE_CAPABILITIES 8
+// Time in milliseconds after the last stream stopped during which the output is assumed to be
+// still out of standby (matches the playback thread standby delay in AudioFlinger)
+#define OUTPUT_STANDBY_DELAY_MS 3000
+// Estimated time in milliseconds needed to bring an output in standby back to playback
+#define OUTPUT_WAKEUP_TIME_MS 40
+// Estimated time in milliseconds added to the time to play by each stream already active on
+// an output
+#define OUTPUT_ACTIVE_STREAM_TIME_MS 2
+// Time in milliseconds during which the drain time read from an output is reused instead of
+// querying the HAL again. See outputDrainWaitMs()
+#define OUTPUT_DRAIN_TIME_CACHE_MS 5
+// Number of outputs whose usage state is kept in the shared stream state table. Outputs
+// opened beyond this number keep their state in their descriptor. See OutputStreamTable
+#define MAX_OUTPUT_SLOTS 32
+// Minimum time in milliseconds between two writes of the policy state file caused by volume
+// changes. See savePolicyState()
+#define POLICY_STATE_SAVE_INTERVAL_MS 2000
+// Time in milliseconds after restorePolicyState() during which the framework is expected to
+// connect again the restored devices. Devices it did not connect are disconnected after that.
+#define POLICY_STATE_CONFIRM_TIMEOUT_MS 10000
+
 #define NUM_VOL_CURVE_KNEES 2
 
 // ----------------------------------------------------------------------------
@@ -68,7 +99,10 @@ class AudioPolicyManagerBase: public AudioPolicyInterface
 {
 
 public:
-                AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface);
+                // clock is the time source for activity tracking and routing waits.
+                // The system clock is used if NULL. The caller keeps ownership.
+                AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface,
+                                       AudioPolicyClock *clock = NULL);
         virtual ~AudioPolicyManagerBase();
 
         // AudioPolicyInterface
@@ -137,6 +171,11 @@ public:
 
         virtual status_t dump(int fd);
 
+        // entry point latencies and HAL command counters as key=value pairs, in the
+        // format returned by AudioHardwareInterface::getParameters(). See AudioPolicyStats.
+        // Printed on the "Statistics:" line of dump().
+        String8 getStatistics() const;
+
 protected:
 
         enum routing_strategy {
@@ -204,6 +243,9 @@ protected:
 
             void dump(int fd);
 
+            // true if some parameters are read from the output stream when it is opened
+            bool isDynamic() const;
+
             // by convention, "0' in the first entry in mSamplingRates, mChannelMasks or mFormats
             // indicates the supported parameters should be read from the output stream
             // after it is opened for the first time
@@ -214,6 +256,9 @@ protected:
                                                // routed to)
             audio_output_flags_t mFlags; // attribute flags (e.g primary output,
                                                 // direct output...). For outputs only.
+            uint32_t mMaxOpenStreams;    // streams that can be open at the same time from this
+                                         // profile. Direct outputs opened to query dynamic
+                                         // parameters are only kept open if this is above 1.
             HwModule *mModule;                     // audio HW module exposing this I/O stream
         };
 
@@ -232,18 +277,65 @@ protected:
         // default volume curves per stream and device category. See initializeVolumeCurves()
         static const VolumeCurvePoint *sVolumeProfiles[AUDIO_STREAM_CNT][DEVICE_CATEGORY_CNT];
 
+        // usage state of the outputs listed in mOutputs, stored stream major: the values of one
+        // stream for all outputs are contiguous so that isStreamActive() reads one or two cache
+        // lines instead of one descriptor per output. Only the state read by isStreamActive()
+        // is kept here.
+        class OutputStreamTable
+        {
+        public:
+            OutputStreamTable();
+
+            // returns a free slot or -1 if all MAX_OUTPUT_SLOTS slots are used
+            int allocateSlot();
+            // resets the state of the slot and makes it available again
+            void releaseSlot(int slot);
+            uint32_t slotCount() const { return __builtin_popcount(mUsedSlots); }
+            // same as AudioOutputDescriptor::isActive() for one stream, over all used slots
+            bool isStreamActive(int stream, uint32_t inPastMs, nsecs_t sysTime) const;
+
+            uint32_t mRefCount[AudioSystem::NUM_STREAM_TYPES][MAX_OUTPUT_SLOTS];
+            nsecs_t mStopTime[AudioSystem::NUM_STREAM_TYPES][MAX_OUTPUT_SLOTS];
+            uint32_t mUsedSlots;    // bit field of the slots in use
+        };
+
+        // indexes the per stream state of an output by stream type, wherever it is stored:
+        // in the descriptor itself (stride 1) or in a column of OutputStreamTable
+        // (stride MAX_OUTPUT_SLOTS)
+        template <typename T>
+        class StreamStateRef
+        {
+        public:
+            StreamStateRef() : mBase(NULL), mStride(1) {}
+            T& operator[](int stream) const { return mBase[stream * mStride]; }
+            void set(T *base, int stride) { mBase = base; mStride = stride; }
+        private:
+            T *mBase;
+            int mStride;
+        };
+
         // descriptor for audio outputs. Used to maintain current configuration of each opened audio output
         // and keep track of the usage of this output by each audio stream type.
         class AudioOutputDescriptor
         {
         public:
             AudioOutputDescriptor(const IOProfile *profile);
+            ~AudioOutputDescriptor();
+
+            // moves the usage state to a slot of the table. The state stays in the
+            // descriptor if the table is full.
+            void attach(OutputStreamTable *table);
+            // moves the usage state back to the descriptor and frees the slot
+            void detach();
 
             status_t    dump(int fd);
 
             audio_devices_t device();
             void changeRefCount(AudioSystem::stream_type, int delta);
             uint32_t refCount();
+            // true if a stream is active on the output or was in the past inPastMs milliseconds
+            // before sysTime
+            bool isActive(uint32_t inPastMs, nsecs_t sysTime) const;
             uint32_t strategyRefCount(routing_strategy strategy);
             bool isUsedByStrategy(routing_strategy strategy) { return (strategyRefCount(strategy) != 0);}
             bool isDuplicated() const { return (mOutput1 != NULL && mOutput2 != NULL); }
@@ -258,8 +350,8 @@ protected:
             uint32_t mLatency;                  //
             audio_output_flags_t mFlags;   //
             audio_devices_t mDevice;                   // current device this output is routed to
-            uint32_t mRefCount[AudioSystem::NUM_STREAM_TYPES]; // number of streams of each type using this output
-            nsecs_t mStopTime[AudioSystem::NUM_STREAM_TYPES];
+            StreamStateRef<uint32_t> mRefCount; // number of streams of each type using this output
+            StreamStateRef<nsecs_t> mStopTime;
             AudioOutputDescriptor *mOutput1;    // used by duplicated outputs: first output
             AudioOutputDescriptor *mOutput2;    // used by duplicated outputs: second output
             float mCurVolume[AudioSystem::NUM_STREAM_TYPES];   // current stream volume
@@ -267,6 +359,20 @@ protected:
             const IOProfile *mProfile;          // I/O profile this output derives from
             bool mStrategyMutedByDevice[NUM_STRATEGIES]; // strategies muted because of incompatible
                                                 // device selection. See checkDeviceMuteStrategies()
+            bool mDrainTimeSupported;           // false once the HAL did not report the drain time
+            int32_t mDrainTimeMs;               // last drain time read, see queryDrainTimeMs()
+            nsecs_t mDrainTimeQueried;          // time at which mDrainTimeMs was read
+            uint32_t mOpenGeneration;           // mOutputsGeneration when added to mOutputs
+
+        private:
+            AudioOutputDescriptor(const AudioOutputDescriptor&);
+            AudioOutputDescriptor& operator=(const AudioOutputDescriptor&);
+
+            // storage of the usage state while not attached to a table
+            uint32_t mLocalRefCount[AudioSystem::NUM_STREAM_TYPES];
+            nsecs_t mLocalStopTime[AudioSystem::NUM_STREAM_TYPES];
+            OutputStreamTable *mTable;          // table holding the usage state or NULL
+            int mSlot;                          // slot in mTable
         };
 
         // descriptor for audio inputs. Used to maintain current configuration of each opened audio input
@@ -318,7 +424,25 @@ protected:
             bool mEnabled;              // enabled state: CPU load being used or not
         };
 
+        // dynamic parameters read from a direct output opened for a connected device
+        class DeviceCapabilities
+        {
+        public:
+            DeviceCapabilities() : mLastUsed(0), mVerified(false) {}
+
+            String8 mSupSamplingRates;  // reply to AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES
+            String8 mSupFormats;        // reply to AUDIO_PARAMETER_STREAM_SUP_FORMATS
+            String8 mSupChannels;       // reply to AUDIO_PARAMETER_STREAM_SUP_CHANNELS
+            uint32_t mLastUsed;         // value of mCapabilitiesUseCount when last used
+            bool mVerified;             // false until read again from an opened output
+        };
+
         void addOutput(audio_io_handle_t id, AudioOutputDescriptor *outputDesc);
+        // removes an output from mOutputs. Must be called before the descriptor is deleted.
+        void removeOutput(audio_io_handle_t id);
+        // makes the current set of outputs the previous outputs compared against by
+        // checkOutputForStrategy()
+        void snapshotOutputs();
 
         // return the strategy corresponding to a given stream type
         static routing_strategy getStrategy(AudioSystem::stream_type stream);
@@ -401,19 +525,122 @@ protected:
         // true if given state represents a device in a telephony or VoIP call
         virtual bool isStateInCall(int state);
 
+        // true if a stream that must not be delayed by a deep buffer output is active
+        virtual bool isLatencySensitiveStreamActive();
+
+        // true if media streams should be placed on a deep buffer output to save power:
+        // power mode enabled and screen off or no latency sensitive stream active
+        bool mediaPrefersDeepBuffer();
+
+        // moves active media streams to or from the deep buffer output when the conditions
+        // checked by mediaPrefersDeepBuffer() change. toDeepBuffer indicates the direction
+        // the caller is interested in so that each transition invalidates tracks only once.
+        void checkMediaDeepBufferPlacement(bool toDeepBuffer);
+
         // when a device is connected, checks if an open output can be routed
         // to this device. If none is open, tries to open one of the available outputs.
         // Returns an output suitable to this device or 0.
         // when a device is disconnected, checks if an output is not used any more and
         // returns its handle if any.
         // transfers the audio tracks and effects from one output thread to another accordingly.
+        // address is the address of the device as passed to setDeviceConnectionState().
+        // If directProbes is not NULL, the direct outputs opened only to query dynamic
+        // parameters are also added to it.
         status_t checkOutputsForDevice(audio_devices_t device,
                                        AudioSystem::device_connection_state state,
-                                       SortedVector<audio_io_handle_t>& outputs);
+                                       SortedVector<audio_io_handle_t>& outputs,
+                                       const String8& address = String8(""),
+                                       SortedVector<audio_io_handle_t> *directProbes = NULL);
+
+        // read the parameters of a dynamic profile from an output opened from it
+        void queryDynamicParameters(const IOProfile *profile,
+                                    audio_io_handle_t output,
+                                    String8 *samplingRates,
+                                    String8 *formats,
+                                    String8 *channels);
+        // add the parameters listed in the replies to the dynamic parameters of a profile.
+        // Returns false if a parameter to be read from the output is missing.
+        bool loadDynamicParameters(IOProfile *profile,
+                                   const String8& samplingRates,
+                                   const String8& formats,
+                                   const String8& channels);
+        // forget the dynamic parameters of a profile
+        void resetDynamicParameters(IOProfile *profile);
+
+        //
+        // Cache of dynamic parameters per connected device (mCapabilitiesCache)
+        //
+        // identifies the connected device among the ones of the same type: its address or,
+        // for an HDMI sink, the AUDIO_PARAMETER_DEVICE_SINK_ID read from the HAL. Empty if
+        // the device cannot be identified: its parameters are then not cached.
+        String8 capabilitiesDeviceId(audio_devices_t device, const String8& address);
+        String8 capabilitiesKey(const IOProfile *profile,
+                                audio_devices_t device,
+                                const String8& deviceId);
+        // load the dynamic parameters of a profile from the cache. Returns false if the device
+        // is unknown: an output must then be opened to read them.
+        bool loadCachedCapabilities(IOProfile *profile,
+                                    audio_devices_t device,
+                                    const String8& deviceId);
+        void storeCapabilities(const String8& key,
+                               const String8& samplingRates,
+                               const String8& formats,
+                               const String8& channels,
+                               bool verified);
+        // have mWorker read the parameters of an output opened from a profile loaded from the
+        // cache, for applyCapabilitiesChecks(). If output is 0, the cached parameters are
+        // discarded.
+        void verifyCachedCapabilities(IOProfile *profile, audio_io_handle_t output);
+        // compare the parameters read by mWorker with the cache and update the cache and the
+        // profiles if needed. Called at the beginning of the entry points using the profiles.
+        void applyCapabilitiesChecks();
+        void loadCapabilitiesCache();
+        void saveCapabilitiesCache();
+
+        //
+        // Policy state kept across mediaserver restarts (AUDIO_POLICY_PERSIST_STATE)
+        //
+        // restores the state saved during the current boot: connected output devices and
+        // their addresses, phone state, forced usages, volume index ranges and volume indexes,
+        // then routes outputs and applies volumes once. Devices are connected through
+        // setDeviceConnectionState() so that a device whose outputs cannot be opened is not
+        // restored. Called by the constructor after the attached outputs are opened.
+        void restorePolicyState();
+        // true during POLICY_STATE_CONFIRM_TIMEOUT_MS after restorePolicyState(): the calls
+        // sent again by the framework that do not change the restored state are ignored
+        bool isRestoringState() const;
+        // disconnects the restored devices the framework did not connect again in time
+        void checkRestoredDevices();
+        // address of a connected device as passed to setDeviceConnectionState()
+        String8 deviceAddress(audio_devices_t device) const;
+        // has mWorker write the state if it changed since the last write. Unless force is
+        // true, writes are at least POLICY_STATE_SAVE_INTERVAL_MS apart.
+        void savePolicyState(bool force);
+        static String8 currentBootId();
 
         // close an output and its companion duplicating output.
         void closeOutput(audio_io_handle_t output);
 
+        // move an unused direct output from mOutputs to the idle direct output pool instead of
+        // closing it. The least recently parked output is closed if the pool is full.
+        void parkDirectOutput(audio_io_handle_t output);
+
+        // remove from the idle pool and return a direct output opened from the specified profile
+        // with a configuration matching the request, or NULL if none is available.
+        AudioOutputDescriptor *takeIdleDirectOutput(const IOProfile *profile,
+                                                    uint32_t samplingRate,
+                                                    uint32_t format,
+                                                    uint32_t channelMask,
+                                                    audio_output_flags_t flags);
+
+        // close idle direct outputs that cannot be routed to an available device any more,
+        // or all of them if all is true.
+        void closeIdleDirectOutputs(bool all);
+
+        // close the idle direct outputs opened from the specified profile so that the HAL can
+        // open a stream with another configuration. Returns the number of outputs closed.
+        size_t evictIdleDirectOutputs(const IOProfile *profile);
+
         // checks and if necessary changes outputs used for all strategies.
         // must be called every time a condition that affects the output choice for a given strategy
         // changes: connected device, phone state, force use...
@@ -470,7 +697,10 @@ protected:
         static audio_devices_t getDeviceForVolume(audio_devices_t device);
 
         SortedVector<audio_io_handle_t> getOutputsForDevice(audio_devices_t device,
-                        DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> openOutputs);
+                        const DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *>& openOutputs);
+        // same as getOutputsForDevice() for the outputs opened when snapshotOutputs() was last
+        // called
+        SortedVector<audio_io_handle_t> getPreviousOutputsForDevice(audio_devices_t device);
         bool vectorsEqual(SortedVector<audio_io_handle_t>& outputs1,
                                            SortedVector<audio_io_handle_t>& outputs2);
 
@@ -484,6 +714,31 @@ protected:
 
         audio_io_handle_t selectOutput(const SortedVector<audio_io_handle_t>& outputs,
                                        AudioSystem::output_flags flags);
+        // estimated time in milliseconds before audio written to this output is heard,
+        // including the time to leave standby and the load of the streams already active
+        uint32_t outputTimeToPlay(AudioOutputDescriptor *outputDesc);
+
+        // waits for a routing or mute change to take effect
+        void sleepMs(uint32_t delayMs);
+
+        // time in milliseconds after which the audio queued on the output so far has been
+        // played: the drain time reported by the HAL (AUDIO_PARAMETER_STREAM_DRAIN_MS) plus
+        // marginMs for the audio not yet written by AudioFlinger, or twice the latency if the
+        // HAL does not report it. Never more than twice the latency.
+        uint32_t outputDrainWaitMs(AudioOutputDescriptor *outputDesc, uint32_t marginMs);
+        // drain time reported by the HAL, < 0 if not supported
+        int32_t queryDrainTimeMs(AudioOutputDescriptor *outputDesc);
+
+        // records a routing decision in mRoutingTrace
+        void traceRouting(routing_event_type type, routing_event_reason reason,
+                          uint32_t detail, audio_io_handle_t output,
+                          audio_devices_t prevDevice, audio_devices_t device,
+                          uint32_t delayMs, uint32_t muteWaitMs = 0, int32_t value = 0)
+        {
+            mRoutingTrace.record(mClock->now(), type, reason, (uint8_t)detail,
+                                 (uint8_t)mStats.currentCall(), output, prevDevice, device,
+                                 delayMs, muteWaitMs, value);
+        }
         IOProfile *getInputProfile(audio_devices_t device,
                                    uint32_t samplingRate,
                                    uint32_t format,
@@ -518,14 +773,44 @@ protected:
         void defaultAudioPolicyConfig(void);
 
 
+        // updated by const entry points such as isStreamActive()
+        mutable AudioPolicyStats mStats;
+        // counts the HAL commands before forwarding them to the client given to the
+        // constructor
+        AudioPolicyStatsClient mStatsClient;
+        // coalesces the routing and volume commands issued by one entry point before
+        // forwarding them to mStatsClient. mpClientInterface points to it.
+        AudioPolicyTransactionClient mTransactionClient;
+        // reads output parameters and writes files in the background. Calls the client given
+        // to the constructor directly.
+        AudioPolicyWorker mWorker;
+        // last routing, mute and volume decisions, printed by dump()
+        AudioPolicyRoutingTrace mRoutingTrace;
         AudioPolicyClientInterface *mpClientInterface;  // audio policy client interface
+        AudioPolicyClock *mClock;   // time source, see AudioPolicyClock.h
         audio_io_handle_t mPrimaryOutput;              // primary output handle
         // list of descriptors for outputs currently opened
         DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> mOutputs;
-        // copy of mOutputs before setDeviceConnectionState() opens new outputs
-        // reset to mOutputs when updateDevicesAndOutputs() is called.
-        DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> mPreviousOutputs;
+        // usage state of the outputs in mOutputs, see addOutput() and removeOutput()
+        OutputStreamTable mStreamTable;
+        // incremented each time an output is added to or removed from mOutputs
+        uint32_t mOutputsGeneration;
+        // mOutputsGeneration before setDeviceConnectionState() opens new outputs
+        // reset when updateDevicesAndOutputs() is called. The previous outputs are the outputs
+        // of mOutputs opened at or before this generation plus mRetiredOutputs.
+        uint32_t mPreviousOutputsGeneration;
+        // outputs in the previous outputs removed from mOutputs since then
+        struct RetiredOutput {
+            audio_io_handle_t mId;
+            audio_devices_t mSupportedDevices;
+        };
+        RetiredOutput mRetiredOutputs[MAX_OUTPUT_SLOTS];
+        size_t mRetiredOutputCount;
         DefaultKeyedVector<audio_io_handle_t, AudioInputDescriptor *> mInputs;     // list of input descriptors
+        // direct outputs kept open after being released by releaseOutput() or after being opened
+        // by checkOutputsForDevice() to query dynamic parameters. They are not listed in mOutputs
+        // until reused by getOutput(). Ordered from least to most recently parked.
+        Vector <AudioOutputDescriptor *> mIdleDirectOutputs;
         audio_devices_t mAvailableOutputDevices; // bit field of all available output devices
         audio_devices_t mAvailableInputDevices; // bit field of all available input devices
                                                 // without AUDIO_DEVICE_BIT_IN to allow direct bit
@@ -559,6 +844,27 @@ protected:
 
         Vector <HwModule *> mHwModules;
 
+        // dynamic parameters of direct profiles per connected device, indexed by
+        // capabilitiesKey(). Least recently used entries are evicted first.
+        KeyedVector<String8, DeviceCapabilities> mCapabilitiesCache;
+        uint32_t mCapabilitiesUseCount;
+        // profiles loaded from mCapabilitiesCache and not verified yet, with their cache key
+        DefaultKeyedVector<const IOProfile *, String8> mUnverifiedProfiles;
+        // profiles whose parameters are being read by mWorker, with their cache key
+        DefaultKeyedVector<const IOProfile *, String8> mCheckedProfiles;
+
+        bool mStateDirty;           // state changed since savePolicyState() last wrote it
+        bool mRestoringState;       // restorePolicyState() in progress
+        nsecs_t mStateSaveTime;     // time of the last write of the state
+        nsecs_t mRestoreTime;       // time of restorePolicyState(), 0 if nothing was restored
+        audio_devices_t mUnconfirmedDevices; // restored devices not connected again yet
+        String8 mBootId;            // read once by the constructor
+
+        bool mDeepBufferPowerMode; // media is steered to deep buffer outputs to save power
+        bool mScreenOn;            // last screen state received by setSystemProperty()
+        bool mMediaSteeredToDeepBuffer; // a media stream was placed on a deep buffer output by
+                                        // the power mode and not by its client
+
 #ifdef AUDIO_POLICY_TEST
         Mutex   mLock;
         Condition mWaitWorkCV;
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYROUTINGTRACE_H
+#define ANDROID_AUDIOPOLICYROUTINGTRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Timers.h>
+#include <system/audio.h>
+
+namespace android_audio_legacy {
+
+// number of routing events kept, must be a power of 2
+#define AUDIO_POLICY_ROUTING_EVENTS 512
+
+enum routing_event_type {
+    ROUTING_EVENT_SET_OUTPUT_DEVICE,    // setOutputDevice()
+    ROUTING_EVENT_MOVE_STRATEGY,        // checkOutputForStrategy() moved tracks
+    ROUTING_EVENT_MUTE_STRATEGY,        // checkDeviceMuteStrategies() muted or unmuted
+    ROUTING_EVENT_SET_VOLUME,           // checkAndSetVolume() sent a new volume
+
+    ROUTING_EVENT_TYPE_CNT
+};
+
+enum routing_event_reason {
+    ROUTING_REASON_NONE,
+    ROUTING_REASON_DEVICE_CHANGED,      // setOutputDevice() sent a routing command
+    ROUTING_REASON_FORCED,              // same device routed again because force was set
+    ROUTING_REASON_UNCHANGED,           // same or no device: no routing command sent
+    ROUTING_REASON_INCOMPATIBLE_DEVICE, // strategy muted while routed to a device combination
+    ROUTING_REASON_COMPATIBLE_DEVICE,   // strategy unmuted after the device combination ended
+    ROUTING_REASON_DEVICE_SWITCH,       // temporary mute while the output changes device
+    ROUTING_REASON_VOLUME_CHANGED,
+    ROUTING_REASON_VOLUME_FORCED,
+
+    ROUTING_REASON_CNT
+};
+
+struct routing_event {
+    nsecs_t mTime;                  // AudioPolicyClock time
+    volatile int32_t mSequence;     // index of the event + 1, 0 while being written
+    uint8_t mType;                  // routing_event_type
+    uint8_t mReason;                // routing_event_reason
+    uint8_t mDetail;                // strategy or stream type
+    uint8_t mCall;                  // AudioPolicyStats::api of the entry point
+    audio_io_handle_t mOutput;
+    audio_devices_t mPrevDevice;
+    audio_devices_t mDevice;
+    uint16_t mDelayMs;              // delay requested by the caller
+    uint16_t mMuteWaitMs;           // time waited for muted audio to drain
+    int32_t mValue;                 // destination output for moves, volume x 1000
+    uint32_t mReserved;
+};
+
+// Fixed size ring of the routing decisions taken by AudioPolicyManagerBase.
+// record() takes no lock and does not allocate: events recorded concurrently with a dump
+// may be missing from it but are never printed partially written.
+class AudioPolicyRoutingTrace
+{
+public:
+                AudioPolicyRoutingTrace();
+                ~AudioPolicyRoutingTrace();
+
+    void record(nsecs_t time, routing_event_type type, routing_event_reason reason,
+                uint8_t detail, uint8_t call, audio_io_handle_t output,
+                audio_devices_t prevDevice, audio_devices_t device,
+                uint32_t delayMs, uint32_t muteWaitMs, int32_t value);
+
+    // prints the events, oldest first. Only uses write(): can be called from a signal
+    // handler.
+    void dump(int fd) const;
+
+    // dumps the trace of the policy manager most recently created, if any. Meant for crash
+    // handlers which have no reference to the policy manager.
+    static void dumpCurrent(int fd);
+
+    // installs a handler for the fatal signals (SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV)
+    // which writes dumpCurrent() to the file at path, or to stderr if it cannot be created,
+    // then hands the signal over to the handler installed before (e.g. debuggerd's).
+    // path must stay valid. Only the first call has an effect.
+    static void installFatalSignalHandler(const char *path);
+
+    static const char *typeName(uint32_t type);
+    static const char *reasonName(uint32_t reason);
+
+private:
+    routing_event mEvents[AUDIO_POLICY_ROUTING_EVENTS];
+    volatile int32_t mNext;     // index of the next event, before wrapping
+
+    static AudioPolicyRoutingTrace * volatile sCurrent;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYROUTINGTRACE_H
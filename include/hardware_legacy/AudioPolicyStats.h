@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYSTATS_H
+#define ANDROID_AUDIOPOLICYSTATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <hardware_legacy/AudioPolicyInterface.h>
+
+namespace android_audio_legacy {
+    using android::status_t;
+
+// Latency histograms of the AudioPolicyInterface entry points and counters of the work
+// they cause, reported by AudioPolicyManagerBase::dump().
+// All updates are atomic increments: no lock is taken and nothing is allocated.
+// The call nesting and the entry point in progress are kept per thread, as the policy
+// entry points are called concurrently from binder threads and AudioFlinger threads.
+class AudioPolicyStats
+{
+public:
+    enum api {
+        API_SET_DEVICE_CONNECTION_STATE,
+        API_GET_DEVICE_CONNECTION_STATE,
+        API_SET_PHONE_STATE,
+        API_SET_FORCE_USE,
+        API_GET_FORCE_USE,
+        API_SET_SYSTEM_PROPERTY,
+        API_GET_OUTPUT,
+        API_START_OUTPUT,
+        API_STOP_OUTPUT,
+        API_RELEASE_OUTPUT,
+        API_GET_INPUT,
+        API_START_INPUT,
+        API_STOP_INPUT,
+        API_RELEASE_INPUT,
+        API_INIT_STREAM_VOLUME,
+        API_SET_STREAM_VOLUME_INDEX,
+        API_GET_STREAM_VOLUME_INDEX,
+        API_GET_STRATEGY_FOR_STREAM,
+        API_GET_DEVICES_FOR_STREAM,
+        API_GET_OUTPUT_FOR_EFFECT,
+        API_REGISTER_EFFECT,
+        API_UNREGISTER_EFFECT,
+        API_SET_EFFECT_ENABLED,
+        API_IS_STREAM_ACTIVE,
+        API_IS_SOURCE_ACTIVE,
+
+        API_CNT
+    };
+
+    enum counter {
+        COUNTER_SLEEPS,             // waits for routing or mute changes to take effect
+        COUNTER_SLEEP_MS,           // total duration of these waits
+        COUNTER_OPEN_OUTPUT,        // includes duplicated outputs
+        COUNTER_CLOSE_OUTPUT,
+        COUNTER_OPEN_INPUT,
+        COUNTER_CLOSE_INPUT,
+        COUNTER_ROUTING,            // setParameters() carrying a routing command
+        COUNTER_SET_PARAMETERS,     // other setParameters()
+        COUNTER_GET_PARAMETERS,
+        COUNTER_SET_STREAM_VOLUME,
+        COUNTER_INVALIDATE_STREAM,  // setStreamOutput()
+
+        COUNTER_CNT
+    };
+
+    // latency histogram bucket 0 counts calls shorter than 1 us, bucket n calls lasting
+    // [2^(n-1), 2^n[ us. The last bucket also counts all longer calls.
+    static const int HISTOGRAM_BUCKETS = 24;
+
+                AudioPolicyStats();
+                ~AudioPolicyStats();
+
+    // records the duration of an entry point call
+    void recordCall(api call, nsecs_t duration);
+    void increment(counter c, int32_t value = 1);
+
+    // entry points call other entry points, e.g. isStreamActive(): only the outermost call
+    // is recorded. Returns false if a call is already in progress on the calling thread.
+    bool enterCall();
+    void exitCall();
+    // entry point of the outermost call in progress on the calling thread, API_CNT if none
+    api currentCall() const;
+    void setCurrentCall(api call);
+
+    status_t dump(int fd) const;
+    // key=value pairs separated by ';', see AudioPolicyManagerBase::getStatistics()
+    String8 toString() const;
+
+    static const char *apiName(api call);
+    static const char *counterName(counter c);
+
+    // times the enclosing scope and records it for the specified entry point
+    class CallTimer
+    {
+    public:
+        CallTimer(AudioPolicyStats& stats, api call)
+            : mStats(stats), mCall(call), mOutermost(stats.enterCall()),
+              mStart(mOutermost ? systemTime() : 0)
+        {
+            if (mOutermost) {
+                mStats.setCurrentCall(call);
+            }
+        }
+        ~CallTimer()
+        {
+            if (mOutermost) {
+                mStats.recordCall(mCall, systemTime() - mStart);
+                mStats.setCurrentCall(API_CNT);
+            }
+            mStats.exitCall();
+        }
+    private:
+        AudioPolicyStats& mStats;
+        const api mCall;
+        const bool mOutermost;
+        const nsecs_t mStart;
+    };
+
+private:
+    // upper bound in us of the bucket containing the specified percentile of the calls
+    uint32_t percentileUs(api call, uint32_t count, int percent) const;
+
+    volatile int32_t mHistograms[API_CNT][HISTOGRAM_BUCKETS];
+    volatile int32_t mMaxUs[API_CNT];
+    volatile int32_t mCounters[COUNTER_CNT];
+    // per thread call state stored in the key value itself: nesting depth << 8 | entry point
+    pthread_key_t mThreadKey;
+    bool mThreadKeyValid;
+};
+
+// Forwards all calls to the audio policy client and counts the HAL commands issued.
+class AudioPolicyStatsClient : public AudioPolicyClientInterface
+{
+public:
+    AudioPolicyStatsClient(AudioPolicyClientInterface *client, AudioPolicyStats *stats)
+        : mClient(client), mStats(stats) {}
+    virtual ~AudioPolicyStatsClient() {}
+
+    virtual audio_module_handle_t loadHwModule(const char *name);
+
+    virtual audio_io_handle_t openOutput(audio_module_handle_t module,
+                                         audio_devices_t *pDevices,
+                                         uint32_t *pSamplingRate,
+                                         audio_format_t *pFormat,
+                                         audio_channel_mask_t *pChannelMask,
+                                         uint32_t *pLatencyMs,
+                                         audio_output_flags_t flags);
+    virtual audio_io_handle_t openDuplicateOutput(audio_io_handle_t output1,
+                                                  audio_io_handle_t output2);
+    virtual status_t closeOutput(audio_io_handle_t output);
+    virtual status_t suspendOutput(audio_io_handle_t output);
+    virtual status_t restoreOutput(audio_io_handle_t output);
+
+    virtual audio_io_handle_t openInput(audio_module_handle_t module,
+                                        audio_devices_t *pDevices,
+                                        uint32_t *pSamplingRate,
+                                        audio_format_t *pFormat,
+                                        audio_channel_mask_t *pChannelMask);
+    virtual status_t closeInput(audio_io_handle_t input);
+
+    virtual status_t setStreamVolume(AudioSystem::stream_type stream, float volume,
+                                     audio_io_handle_t output, int delayMs = 0);
+    virtual status_t setStreamOutput(AudioSystem::stream_type stream, audio_io_handle_t output);
+    virtual void setParameters(audio_io_handle_t ioHandle, const String8& keyValuePairs,
+                               int delayMs = 0);
+    virtual String8 getParameters(audio_io_handle_t ioHandle, const String8& keys);
+    virtual status_t startTone(ToneGenerator::tone_type tone, AudioSystem::stream_type stream);
+    virtual status_t stopTone();
+    virtual status_t setVoiceVolume(float volume, int delayMs = 0);
+    virtual status_t moveEffects(int session,
+                                 audio_io_handle_t srcOutput,
+                                 audio_io_handle_t dstOutput);
+
+private:
+    AudioPolicyClientInterface *mClient;
+    AudioPolicyStats *mStats;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYSTATS_H
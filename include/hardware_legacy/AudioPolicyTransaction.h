@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYTRANSACTION_H
+#define ANDROID_AUDIOPOLICYTRANSACTION_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+#include <hardware_legacy/AudioPolicyInterface.h>
+
+namespace android_audio_legacy {
+    using android::status_t;
+
+// Forwards all calls to the audio policy client. While a transaction is open, routing
+// commands, stream volumes and voice volume are held back instead and only their net effect
+// is sent when the transaction is committed: for a given I/O handle, stream and delay, only
+// the last value requested is sent, in the order the first request was made. A policy call
+// routing an output to A then B then applying volumes twice thus results in one routing
+// command and one volume per stream. A command is not merged with an earlier one if a
+// routing command on the same output was requested in between, so that volumes set before
+// and after a routing change still reach the HAL on each side of it.
+// Commands with different delays are kept apart so that mute windows (mute now, restore
+// after a delay) are preserved. Any other call to the client, and sleeps done by the policy
+// manager while waiting for muted audio to drain, first flush the pending commands.
+class AudioPolicyTransactionClient : public AudioPolicyClientInterface
+{
+public:
+    AudioPolicyTransactionClient(AudioPolicyClientInterface *client)
+        : mClient(client), mDepth(0), mCoalesced(0) {}
+    virtual ~AudioPolicyTransactionClient() {}
+
+    // transactions can be nested: commands are sent when the outermost one is committed
+    void begin();
+    void commit();
+    // sends the pending commands without ending the transaction
+    void flush();
+    // number of commands dropped because a later command superseded them
+    uint32_t coalescedCount() const { return mCoalesced; }
+
+    // opens a transaction for the lifetime of the enclosing scope
+    class Scope
+    {
+    public:
+        Scope(AudioPolicyTransactionClient& client) : mClient(client) { mClient.begin(); }
+        ~Scope() { mClient.commit(); }
+    private:
+        AudioPolicyTransactionClient& mClient;
+    };
+
+    virtual audio_module_handle_t loadHwModule(const char *name);
+
+    virtual audio_io_handle_t openOutput(audio_module_handle_t module,
+                                         audio_devices_t *pDevices,
+                                         uint32_t *pSamplingRate,
+                                         audio_format_t *pFormat,
+                                         audio_channel_mask_t *pChannelMask,
+                                         uint32_t *pLatencyMs,
+                                         audio_output_flags_t flags);
+    virtual audio_io_handle_t openDuplicateOutput(audio_io_handle_t output1,
+                                                  audio_io_handle_t output2);
+    virtual status_t closeOutput(audio_io_handle_t output);
+    virtual status_t suspendOutput(audio_io_handle_t output);
+    virtual status_t restoreOutput(audio_io_handle_t output);
+
+    virtual audio_io_handle_t openInput(audio_module_handle_t module,
+                                        audio_devices_t *pDevices,
+                                        uint32_t *pSamplingRate,
+                                        audio_format_t *pFormat,
+                                        audio_channel_mask_t *pChannelMask);
+    virtual status_t closeInput(audio_io_handle_t input);
+
+    virtual status_t setStreamVolume(AudioSystem::stream_type stream, float volume,
+                                     audio_io_handle_t output, int delayMs = 0);
+    virtual status_t setStreamOutput(AudioSystem::stream_type stream, audio_io_handle_t output);
+    virtual void setParameters(audio_io_handle_t ioHandle, const String8& keyValuePairs,
+                               int delayMs = 0);
+    virtual String8 getParameters(audio_io_handle_t ioHandle, const String8& keys);
+    virtual status_t startTone(ToneGenerator::tone_type tone, AudioSystem::stream_type stream);
+    virtual status_t stopTone();
+    virtual status_t setVoiceVolume(float volume, int delayMs = 0);
+    virtual status_t moveEffects(int session,
+                                 audio_io_handle_t srcOutput,
+                                 audio_io_handle_t dstOutput);
+
+private:
+    enum command_type {
+        ROUTING,        // setParameters() with a routing key only
+        STREAM_VOLUME,
+        VOICE_VOLUME
+    };
+
+    struct PendingCommand {
+        command_type mType;
+        audio_io_handle_t mIoHandle;
+        int mStream;
+        int mDelayMs;
+        float mVolume;
+        String8 mKeyValuePairs;
+    };
+
+    // adds a command or replaces the last pending one with the same key. Called with mLock
+    // held
+    void queue_l(const PendingCommand& command);
+    void flush_l();
+
+    AudioPolicyClientInterface *mClient;
+    // the policy manager calls the client from the binder threads of AudioPolicyService and
+    // from its own threads
+    android::Mutex mLock;
+    int mDepth;
+    Vector<PendingCommand> mPending;
+    uint32_t mCoalesced;
+};
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIOPOLICYTRANSACTION_H
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2013 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIOPOLICYWORKER_H
+#define ANDROID_AUDIOPOLICYWORKER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+#include <hardware_legacy/AudioPolicyInterface.h>
+
+namespace android_audio_legacy {
+    using android::KeyedVector;
+    using android::Mutex;
+    using android::Condition;
+    using android::Thread;
+    using android::sp;
+
+// Runs on a background thread the work the policy manager does not need to wait for: reading
+// parameters from an output and writing files. Requests are queued by the policy manager,
+// which collects the parameter replies at one of its next entry points.
+// Queries go to the client given to the constructor and not through the transaction client,
+// which must only be used by the thread holding the policy lock. The thread is started with
+// the first request; if it cannot be started, requests are served by the caller.
+class AudioPolicyWorker
+{
+public:
+    // a request to read parameters from an output, and its replies
+    class Query
+    {
+    public:
+        Query() : mOutput(0) {}
+
+        audio_io_handle_t mOutput;
+        String8 mTag;               // identifies the request for the policy manager
+        Vector <String8> mKeys;     // keys to read, one getParameters() call each. No call
+                                    // is made for an empty key
+        Vector <String8> mReplies;  // replies in the order of mKeys. Empty if the output
+                                    // is gone or does not know the key
+    };
+
+    AudioPolicyWorker(AudioPolicyClientInterface *client);
+    // stops the thread and writes the files still queued. Pending queries are dropped.
+    ~AudioPolicyWorker();
+
+    void query(const Query& query);
+    // true if replies are waiting to be taken. Does not take the lock.
+    bool hasReplies() const;
+    // moves the queries answered since the last call to replies
+    void takeReplies(Vector <Query> *replies);
+
+    // replaces the content of the file at path with data. Only the last data queued for a
+    // path is written if the previous write has not started yet.
+    void writeFile(const String8& path, const String8& data);
+
+private:
+    class WorkerThread : public Thread {
+    public:
+                        WorkerThread(AudioPolicyWorker *worker)
+                            : Thread(false), mWorker(worker) {}
+    private:
+        virtual bool    threadLoop() { return mWorker->processNext(); }
+        AudioPolicyWorker *mWorker;
+    };
+
+    // starts the thread if not done yet. Returns false if it is not running.
+    // Must be called with mLock held.
+    bool startLocked();
+    // serves one request. Returns false to stop the thread.
+    bool processNext();
+    void readParameters(Query *query);
+    static bool writeFileNow(const String8& path, const String8& data);
+
+    AudioPolicyClientInterface *mClient;
+    sp<WorkerThread> mThread;
+    bool mStarted;                          // start attempted: do not retry if it failed
+    Mutex mLock;                            // protects the state below
+    Condition mWorkCond;                    // request queued or exit requested
+    bool mExit;
+    Vector <Query> mQueries;
+    Vector <Query> mReplies;
+    KeyedVector<String8, String8> mWrites;  // data to write, indexed by file path
+    volatile int32_t mReplyCount;           // size of mReplies, read without lock
+};
+
+};  // namespace android_audio_legacy
+
+#endif  // ANDROID_AUDIOPOLICYWORKER_H
@@ -28,6 +28,11 @@ namespace android_audio_legacy {
 using android::status_t;
 using android::AudioParameter;
 
+// Output stream parameter returning the time in milliseconds needed to play the audio
+// currently buffered by the audio HAL, for instance "drain_ms=12". Read by the audio policy
+// manager to time mutes and device switches. HALs which do not know it return no value.
+#define AUDIO_PARAMETER_STREAM_DRAIN_MS "drain_ms"
+
 enum {
     OK                  = android::OK,
     NO_ERROR            = android::NO_ERROR,
@@ -25,8 +25,12 @@
 
 #define AUDIO_HARDWARE_MODULE_ID_MAX_LEN 32
 
+#ifndef AUDIO_POLICY_CONFIG_FILE
 #define AUDIO_POLICY_CONFIG_FILE "/system/etc/audio_policy.conf"
+#endif
+#ifndef AUDIO_POLICY_VENDOR_CONFIG_FILE
 #define AUDIO_POLICY_VENDOR_CONFIG_FILE "/vendor/etc/audio_policy.conf"
+#endif
 
 // global configuration
 #define GLOBAL_CONFIG_TAG "global_configuration"
@@ -46,6 +50,8 @@
 #define CHANNELS_TAG "channel_masks"
 #define DEVICES_TAG "devices"
 #define FLAGS_TAG "flags"
+#define MAX_OPEN_STREAMS_TAG "max_open_streams" // number of streams the HAL can keep open
+                                                // concurrently on a direct output profile
 
 #define DYNAMIC_VALUE_TAG "dynamic" // special value for "channel_masks", "sampling_rates" and
                                     // "formats" in outputs descriptors indicating that supported